@@ -0,0 +1,104 @@
+// arena.h
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "stats.h"
+
+// Fixed-size run of objects living in an Arena.
+template <typename T>
+struct ArenaSpan {
+    T* items = nullptr;
+    uint32_t count = 0;
+
+    T* begin() const { return items; }
+    T* end() const { return items + count; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    T& operator[](size_t i) const { return items[i]; }
+};
+
+// Bump allocator. Everything allocated from it is released together by reset()
+// or the destructor, so only trivially destructible types may live here.
+class Arena {
+public:
+    explicit Arena(size_t blockSize = 64 * 1024) : blockSize(blockSize) {}
+    ~Arena() { release(0); }
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* allocate(size_t size, size_t align) {
+        size_t offset = (used + align - 1) & ~(align - 1);
+        if (blocks.empty() || offset + size > blocks[current].size) {
+            newBlock(size + align);
+            offset = (used + align - 1) & ~(align - 1);
+        }
+        used = offset + size;
+        bytes += size;
+        if constexpr (statsEnabled) ++count;
+        return blocks[current].data + offset;
+    }
+
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    template <typename T>
+    ArenaSpan<T> copy(const std::vector<T>& values) {
+        static_assert(std::is_trivially_copyable<T>::value, "arena spans are copied bytewise");
+        ArenaSpan<T> span;
+        if (values.empty()) return span;
+        span.items = static_cast<T*>(allocate(sizeof(T) * values.size(), alignof(T)));
+        span.count = static_cast<uint32_t>(values.size());
+        for (size_t i = 0; i < values.size(); ++i) span.items[i] = values[i];
+        return span;
+    }
+
+    // drops every allocation but keeps the first block for reuse
+    void reset() {
+        release(1);
+        current = 0;
+        used = 0;
+        bytes = 0;
+        count = 0;
+    }
+
+    size_t bytesAllocated() const { return bytes; }
+    // objects and spans allocated, when statsEnabled; otherwise 0
+    size_t allocations() const { return count; }
+
+private:
+    struct Block {
+        char* data;
+        size_t size;
+    };
+
+    size_t blockSize;
+    std::vector<Block> blocks;
+    size_t current = 0;
+    size_t used = 0;
+    size_t bytes = 0;
+    size_t count = 0;
+
+    void newBlock(size_t minSize) {
+        size_t size = minSize > blockSize ? minSize : blockSize;
+        char* data = static_cast<char*>(std::malloc(size));
+        if (!data) throw std::bad_alloc();
+        blocks.push_back({ data, size });
+        current = blocks.size() - 1;
+        used = 0;
+    }
+
+    void release(size_t keep) {
+        while (blocks.size() > keep) {
+            std::free(blocks.back().data);
+            blocks.pop_back();
+        }
+    }
+};
@@ -0,0 +1,270 @@
+// benchmark.cpp
+// Throughput of each stage over a corpus of scripts, for tracking over time.
+//   benchmark [--repeat N] [corpus directory, default "benchmarks"]
+// Every script in the directory plus a few generated ones is run through
+//   lex    Lexer::nextToken to the end                  tokens/s
+//   parse  Parser::parseTopLevel to the end             nodes/s
+//   run    Interpreter::callFunction("main")            ops/s (bytecode instructions)
+//   jit    the same with Interpreter::setJit(true)      ops/s (instructions the run stage counted)
+// Results go to stdout as one JSON object per line; a summary table goes to stderr.
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "lexer.h"
+#include "parser.h"
+#include "interpreter.h"
+#include "mappedfile.h"
+#include "profiler.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Script {
+    std::string name;
+    std::string generated;  // empty for corpus files, which are mapped instead
+    std::string path;
+};
+
+struct Result {
+    double seconds;
+    uint64_t items;
+};
+
+// print() output is part of the work, but not worth keeping
+class DiscardSink : public OutputSink {
+public:
+    void write(const char*, size_t) override {}
+};
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Nodes reachable from a top-level node, without recursion: generated
+// expression chains are far deeper than the stack.
+uint64_t countNodes(const ASTNode* root) {
+    uint64_t count = 0;
+    std::vector<const ASTNode*> pending{ root };
+    auto list = [&pending](const NodeList& nodes) {
+        for (auto* node : nodes) pending.push_back(node);
+    };
+    while (!pending.empty()) {
+        const ASTNode* node = pending.back();
+        pending.pop_back();
+        if (!node) continue;
+        count++;
+        switch (node->kind) {
+        case NodeKind::FunctionDecl: list(static_cast<const FunctionDecl*>(node)->body); break;
+        case NodeKind::ReturnStmt: pending.push_back(static_cast<const ReturnStmt*>(node)->expression); break;
+        case NodeKind::PrintStmt: pending.push_back(static_cast<const PrintStmt*>(node)->expression); break;
+        case NodeKind::BinaryExpr: {
+            auto bin = static_cast<const BinaryExpr*>(node);
+            pending.push_back(bin->left);
+            pending.push_back(bin->right);
+            break;
+        }
+        case NodeKind::VarDecl: pending.push_back(static_cast<const VarDecl*>(node)->initializer); break;
+        case NodeKind::AssignStmt: pending.push_back(static_cast<const AssignStmt*>(node)->value); break;
+        case NodeKind::IndexAssignStmt: {
+            auto assign = static_cast<const IndexAssignStmt*>(node);
+            pending.push_back(assign->index);
+            pending.push_back(assign->value);
+            break;
+        }
+        case NodeKind::ExpressionStmt: pending.push_back(static_cast<const ExpressionStmt*>(node)->expr); break;
+        case NodeKind::ForStmt: {
+            auto loop = static_cast<const ForStmt*>(node);
+            pending.push_back(loop->init);
+            pending.push_back(loop->condition);
+            pending.push_back(loop->increment);
+            list(loop->body);
+            break;
+        }
+        case NodeKind::ForEachStmt: {
+            auto loop = static_cast<const ForEachStmt*>(node);
+            pending.push_back(loop->iterable);
+            list(loop->body);
+            break;
+        }
+        case NodeKind::WhileStmt: {
+            auto loop = static_cast<const WhileStmt*>(node);
+            pending.push_back(loop->condition);
+            list(loop->body);
+            break;
+        }
+        case NodeKind::IndexExpr: {
+            auto index = static_cast<const IndexExpr*>(node);
+            pending.push_back(index->array);
+            pending.push_back(index->index);
+            break;
+        }
+        case NodeKind::CallExpr: list(static_cast<const CallExpr*>(node)->args); break;
+        case NodeKind::ArrayLiteral: list(static_cast<const ArrayLiteral*>(node)->elements); break;
+        default: break;
+        }
+    }
+    return count;
+}
+
+Result lex(std::string_view source) {
+    auto start = Clock::now();
+    Lexer lexer(source);
+    uint64_t tokens = 0;
+    while (lexer.nextToken().type != token_type::End) tokens++;
+    return { secondsSince(start), tokens };
+}
+
+Result parse(std::string_view source) {
+    auto start = Clock::now();
+    Arena arena;
+    Lexer lexer(source);
+    Parser parser(lexer, arena);
+    std::vector<ASTNode*> nodes;
+    while (!parser.isAtEnd()) nodes.push_back(parser.parseTopLevel());
+    double seconds = secondsSince(start);
+
+    uint64_t count = 0;
+    for (auto* node : nodes) count += countNodes(node);
+    return { seconds, count };
+}
+
+// Loads the script as the driver does and times main(). With a profiler the
+// instruction count comes back too; the timed runs go without one.
+Result run(std::string_view source, Profiler* profiler, bool jit = false) {
+    DiscardSink discard;
+    Program program = Program::compile(source, 2);
+    Interpreter interp;
+    interp.setOutput(discard);
+    interp.setProfiler(profiler);
+    interp.setJit(jit);
+    interp.load(program);
+    if (!interp.hasFunction("main")) return { 0, 0 };
+
+    auto start = Clock::now();
+    interp.callFunction("main", {});
+    interp.flushOutput();
+    double seconds = secondsSince(start);
+
+    uint64_t ops = 0;
+    if (profiler) {
+        for (const auto& line : profiler->lineStats()) ops += line.instructions;
+    }
+    return { seconds, ops };
+}
+
+// fastest of repeat runs, which is the least disturbed one
+template <typename Stage>
+Result best(int repeat, Stage stage) {
+    Result result = stage();
+    for (int i = 1; i < repeat; ++i) {
+        Result next = stage();
+        if (next.seconds < result.seconds) result = next;
+    }
+    return result;
+}
+
+// Sources too big or too regular to keep in the corpus.
+std::vector<Script> generatedScripts() {
+    std::vector<Script> scripts;
+
+    // 20,000 small functions, a few megabytes: front-end throughput
+    std::string many;
+    for (int i = 0; i < 20000; ++i) {
+        std::string n = std::to_string(i);
+        many += "function f" + n + "(a: int, b: int): int {\n"
+                "    let x: int = a * " + n + " + b - 7;\n"
+                "    let y: double = 2.5 * x;\n"
+                "    for (let i: int = 0; i < 3; i++) { x = x + i * 2; }\n"
+                "    return x + f" + std::to_string(i ? i - 1 : 0) + "Stub(b);\n"
+                "}\n"
+                "function f" + n + "Stub(v: int): int { return v; }\n";
+    }
+    many += "function main(): int { return f19999(1, 2); }\n";
+    scripts.push_back({ "generated/many-functions", std::move(many), "" });
+
+    // one expression with 100,000 operators
+    std::string chain = "function main(): int {\n    let a: int = 3;\n    let s: int = a";
+    for (int i = 0; i < 100000; ++i) chain += (i % 3 == 0) ? " + a * 2" : (i % 3 == 1) ? " - a" : " + 1";
+    chain += ";\n    return s;\n}\n";
+    scripts.push_back({ "generated/long-chain", std::move(chain), "" });
+
+    // a 50,000 element array literal
+    std::string array = "function main(): int {\n    let a: int[] = [";
+    for (int i = 0; i < 50000; ++i) array += (i ? ", " : "") + std::to_string(i % 1000);
+    array += "];\n    let s: int = 0;\n    for (let x: int in a) { s = s + x; }\n    return s;\n}\n";
+    scripts.push_back({ "generated/array-literal", std::move(array), "" });
+
+    return scripts;
+}
+
+void report(const std::string& script, const char* stage, const Result& r, const char* unit) {
+    double rate = r.seconds > 0 ? r.items / r.seconds : 0;
+    std::cout << "{\"script\":\"" << script << "\",\"stage\":\"" << stage
+              << "\",\"seconds\":" << r.seconds << ",\"items\":" << r.items
+              << ",\"rate\":" << rate << ",\"unit\":\"" << unit << "\"}\n";
+    std::cerr << std::left << std::setw(32) << script << std::setw(7) << stage << std::right
+              << std::setw(12) << std::fixed << std::setprecision(2) << rate / 1e6 << " M" << unit
+              << std::setw(12) << std::setprecision(3) << r.seconds * 1e3 << " ms\n";
+}
+
+}
+
+int main(int argc, char** argv) {
+    int repeat = 5;
+    std::string corpus = "benchmarks";
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) repeat = std::max(1, std::atoi(argv[++i]));
+        else if (argv[i][0] == '-') {
+            std::cerr << "usage: benchmark [--repeat N] [corpus directory]\n";
+            return 2;
+        }
+        else corpus = argv[i];
+    }
+
+    try {
+        std::vector<Script> scripts;
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator(corpus, error)) {
+            if (entry.path().extension() == ".jspp")
+                scripts.push_back({ entry.path().filename().string(), "", entry.path().string() });
+        }
+        if (error) std::cerr << "benchmark: no corpus at " << corpus << ", running generated scripts only\n";
+        std::sort(scripts.begin(), scripts.end(), [](const Script& l, const Script& r) { return l.name < r.name; });
+        for (auto& script : generatedScripts()) scripts.push_back(std::move(script));
+
+        std::cout.precision(6);
+        for (const Script& script : scripts) {
+            std::unique_ptr<MappedFile> file;
+            if (!script.path.empty()) file = std::make_unique<MappedFile>(script.path);
+            std::string_view source = file ? file->text() : std::string_view(script.generated);
+
+            report(script.name, "lex", best(repeat, [&] { return lex(source); }), "tokens/s");
+            report(script.name, "parse", best(repeat, [&] { return parse(source); }), "nodes/s");
+
+            Profiler counter;
+            uint64_t ops = run(source, &counter).items;
+            Result timed = best(repeat, [&] { return run(source, nullptr); });
+            timed.items = ops;
+            report(script.name, "run", timed, "ops/s");
+            if (Jit::available()) {
+                Result native = best(repeat, [&] { return run(source, nullptr, true); });
+                native.items = ops;
+                report(script.name, "jit", native, "ops/s");
+            }
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,96 @@
+// bytecode.h
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "value.h"
+
+// Register machine: every frame owns a fixed window of registers and the
+// operands below name registers relative to the start of that window.
+// Parameters and locals live in the low registers of the window, temporaries above them.
+enum class OpCode : uint8_t {
+    LoadInt,        // a = bx
+    LoadConst,      // a = constants[bx]
+    LoadBool,       // a = b != 0
+    Move,           // a = b
+    Coerce,         // a = a as StaticType(b): an int widens to double, any other mismatch throws
+    GetGlobal,      // a = variables[names[b]]
+    SetGlobal,      // variables[names[b]] = a
+    Add, Sub, Mul, Div,                       // a = b op c
+    Less, LessEqual, Greater, GreaterEqual,
+    Equal, NotEqual,
+    AddInt, SubInt, MulInt, DivInt,           // the same, for b and c the TypeChecker proved ints
+    LessInt, LessEqualInt, GreaterInt, GreaterEqualInt,
+    AddDouble, SubDouble, MulDouble, DivDouble, // and doubles
+    LessDouble, LessEqualDouble, GreaterDouble, GreaterEqualDouble,
+    Jump,           // pc += bx
+    JumpIfFalse,    // if (!a) pc += bx
+    Call,           // a = names[b](a .. a + c - 1), resolved through callTargets[b]
+    TailCall,       // return names[b](a .. a + c - 1), reusing this frame
+    CallChecked,    // Call for arguments not proven to match: the callee's paramTypes are enforced
+    TailCallChecked,
+    NewArray,       // a = [b .. b + c - 1]
+    AllocArray,     // a = b zeros
+    Length,         // a = len(b)
+    GetIndex,       // a = b[c], bounds checked
+    GetIndexUnchecked, // a = b[c], where the compiler proved c in range
+    SetIndex,       // a[b] = c, copying a first if it is shared
+    SetGlobalIndex, // variables[names[b]][c] = a
+    ForIter,        // if a+1 < len(a): a+2 = a[a+1++], else pc += bx
+    ForLoop,        // a+2 += a+1; if a+2 < a (a+2 > a when a+1 < 0): pc += bx
+    ForLoopInclusive, // the same with <= and >=
+    Print,          // print a
+    Return,         // return a
+    Error           // throw names[b]
+};
+
+struct Instruction {
+    OpCode op;
+    uint16_t a;
+    uint16_t b;
+    uint16_t c;
+
+    // b and c together hold a signed 32-bit immediate (constants, jump offsets)
+    int32_t bx() const { return static_cast<int32_t>(uint32_t(b) | (uint32_t(c) << 16)); }
+
+    static Instruction abc(OpCode op, int a, int b = 0, int c = 0) {
+        return { op, uint16_t(a), uint16_t(b), uint16_t(c) };
+    }
+
+    static Instruction abx(OpCode op, int a, int32_t bx) {
+        uint32_t v = static_cast<uint32_t>(bx);
+        return { op, uint16_t(a), uint16_t(v & 0xFFFF), uint16_t(v >> 16) };
+    }
+};
+
+struct Chunk {
+    std::string name;
+    int numParams = 0;
+    int numRegisters = 0;
+    std::vector<StaticType> paramTypes; // what the body relies on its arguments holding; empty if nothing
+    std::vector<Instruction> code;
+    std::vector<int> lines;          // source line of each instruction
+    std::vector<Value> constants;    // literals that don't fit in an instruction
+    std::vector<std::string> names;  // global/function names and error messages
+    std::vector<uint32_t> callTargets; // per name: the interpreter's function slot, set when linked
+};
+
+// Points every Call in chunk at slotFor(name), so a call is an index instead
+// of a name lookup. slotFor may add slots as new names turn up.
+template <typename SlotFor>
+void linkCalls(Chunk& chunk, SlotFor&& slotFor) {
+    chunk.callTargets.assign(chunk.names.size(), UINT32_MAX);
+    for (const Instruction& ins : chunk.code) {
+        bool call = ins.op == OpCode::Call || ins.op == OpCode::TailCall ||
+            ins.op == OpCode::CallChecked || ins.op == OpCode::TailCallChecked;
+        if (call && chunk.callTargets[ins.b] == UINT32_MAX)
+            chunk.callTargets[ins.b] = slotFor(chunk.names[ins.b]);
+    }
+}
+
+// One top-level function or statement of a compiled script.
+struct CompiledUnit {
+    bool isFunction;
+    std::unique_ptr<Chunk> chunk;
+};
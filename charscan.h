@@ -0,0 +1,136 @@
+// charscan.h
+#pragma once
+#include <bit>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CHARSCAN_SSE2 1
+#endif
+
+// Run scans for the Lexer. Each returns the first position in [p, end) that
+// is not part of the run, or end. Most runs between tokens are a byte or two
+// and most names are short, so the first few bytes are tested one at a time;
+// past those, SSE2 (every x64 target) tests 16 bytes per step. The last few
+// bytes of the buffer, and other targets, take the scalar loop. Bytes >= 0x80
+// belong to no class.
+namespace charscan {
+
+inline bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+inline bool isAlpha(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; }
+inline bool isAlphaNumeric(char c) { return isAlpha(c) || isDigit(c); }
+
+#ifdef CHARSCAN_SSE2
+inline __m128i load(const char* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+inline __m128i eq(__m128i v, char c) { return _mm_cmpeq_epi8(v, _mm_set1_epi8(c)); }
+// lo <= v <= hi, for ASCII bounds; bytes >= 0x80 compare as negative and fall outside
+inline __m128i within(__m128i v, char lo, char hi) {
+    return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1)));
+}
+inline unsigned mask(__m128i v) { return static_cast<unsigned>(_mm_movemask_epi8(v)); }
+#endif
+
+// Spaces, tabs and line breaks. Adds the '\n's it passes to newlines and
+// points lineStart just after the last of them.
+inline const char* spaces(const char* p, const char* end, int& newlines, const char*& lineStart) {
+    for (int i = 0; i < 2; ++i, ++p) {
+        if (p == end || !isSpace(*p)) return p;
+        if (*p == '\n') {
+            newlines++;
+            lineStart = p + 1;
+        }
+    }
+#ifdef CHARSCAN_SSE2
+    while (end - p >= 16) {
+        __m128i v = load(p);
+        unsigned lf = mask(eq(v, '\n'));
+        unsigned space = lf | mask(_mm_or_si128(_mm_or_si128(eq(v, ' '), eq(v, '\t')), eq(v, '\r')));
+        unsigned stop = ~space & 0xFFFF;
+        unsigned run = stop ? std::countr_zero(stop) : 16;
+        lf &= (1u << run) - 1;
+        if (lf) {
+            newlines += std::popcount(lf);
+            lineStart = p + std::bit_width(lf);
+        }
+        p += run;
+        if (stop) return p;
+    }
+#endif
+    for (; p < end && isSpace(*p); ++p) {
+        if (*p == '\n') {
+            newlines++;
+            lineStart = p + 1;
+        }
+    }
+    return p;
+}
+
+// the rest of a line comment: stops at its '\n'
+inline const char* lineEnd(const char* p, const char* end) {
+#ifdef CHARSCAN_SSE2
+    for (; end - p >= 16; p += 16) {
+        unsigned lf = mask(eq(load(p), '\n'));
+        if (lf) return p + std::countr_zero(lf);
+    }
+#endif
+    while (p < end && *p != '\n') ++p;
+    return p;
+}
+
+inline const char* identifierTail(const char* p, const char* end) {
+    for (int i = 0; i < 8; ++i, ++p) {
+        if (p == end || !isAlphaNumeric(*p)) return p;
+    }
+#ifdef CHARSCAN_SSE2
+    for (; end - p >= 16; p += 16) {
+        __m128i v = load(p);
+        __m128i word = _mm_or_si128(_mm_or_si128(within(v, 'a', 'z'), within(v, 'A', 'Z')),
+            _mm_or_si128(within(v, '0', '9'), eq(v, '_')));
+        unsigned stop = ~mask(word) & 0xFFFF;
+        if (stop) return p + std::countr_zero(stop);
+    }
+#endif
+    while (p < end && isAlphaNumeric(*p)) ++p;
+    return p;
+}
+
+inline const char* digits(const char* p, const char* end) {
+    for (int i = 0; i < 8; ++i, ++p) {
+        if (p == end || !isDigit(*p)) return p;
+    }
+#ifdef CHARSCAN_SSE2
+    for (; end - p >= 16; p += 16) {
+        unsigned stop = ~mask(within(load(p), '0', '9')) & 0xFFFF;
+        if (stop) return p + std::countr_zero(stop);
+    }
+#endif
+    while (p < end && isDigit(*p)) ++p;
+    return p;
+}
+
+// the next '"' or '\\' inside a string literal, counting the '\n's passed
+inline const char* stringStop(const char* p, const char* end, int& newlines, const char*& lineStart) {
+#ifdef CHARSCAN_SSE2
+    for (; end - p >= 16; p += 16) {
+        __m128i v = load(p);
+        unsigned stop = mask(_mm_or_si128(eq(v, '"'), eq(v, '\\')));
+        unsigned run = stop ? std::countr_zero(stop) : 16;
+        unsigned lf = mask(eq(v, '\n')) & ((1u << run) - 1);
+        if (lf) {
+            newlines += std::popcount(lf);
+            lineStart = p + std::bit_width(lf);
+        }
+        if (stop) return p + run;
+    }
+#endif
+    for (; p < end && *p != '"' && *p != '\\'; ++p) {
+        if (*p == '\n') {
+            newlines++;
+            lineStart = p + 1;
+        }
+    }
+    return p;
+}
+
+}
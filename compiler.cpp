@@ -0,0 +1,787 @@
+// compiler.cpp
+#include "compiler.h"
+#include "typechecker.h"
+#include <bit>
+
+std::unique_ptr<Chunk> Compiler::compileFunction(const FunctionDecl& func) {
+    begin(symbolName(func.name));
+    chunk->numParams = static_cast<int>(func.params.size());
+    // arguments arrive in the first registers of the frame
+    scopeDepth = 1;
+    typed = func.typed;
+    for (auto& param : func.params) {
+        declareLocal(param.name, reserve(), false, param.type);
+        if (func.typed) chunk->paramTypes.push_back(declaredType(param.type));
+    }
+    block(func.body);
+    return finish(func.line, func.typed ? declaredType(func.returnType) : StaticType::Unknown);
+}
+
+std::unique_ptr<Chunk> Compiler::compileStatement(const ASTNode* stmt) {
+    begin("<top level>");
+    statement(stmt);
+    return finish(stmt ? stmt->line : 0);
+}
+
+std::unique_ptr<Chunk> Compiler::compileExpression(const ASTNode* expr) {
+    begin("<expression>");
+    int reg = reserve();
+    expression(expr, reg);
+    emit(Instruction::abc(OpCode::Return, reg), expr ? expr->line : 0);
+    return std::move(chunk);
+}
+
+void Compiler::begin(const std::string& name) {
+    chunk = std::make_unique<Chunk>();
+    chunk->name = name;
+    freeReg = 0;
+    localTop = 0;
+    scopeDepth = 0;
+    locals.clear();
+    loops.clear();
+    provenIndexes.clear();
+    nameSlots.clear();
+    constantSlots.clear();
+    stringSlots.clear();
+}
+
+std::unique_ptr<Chunk> Compiler::finish(int line, StaticType result) {
+    // falling off the end of a body returns 0, as whatever the function declares
+    int reg = reserve();
+    emit(Instruction::abx(OpCode::LoadInt, reg, 0), line);
+    if (result != StaticType::Unknown && result != StaticType::Int)
+        emit(Instruction::abc(OpCode::Coerce, reg, static_cast<int>(result)), line);
+    emit(Instruction::abc(OpCode::Return, reg), line);
+    return std::move(chunk);
+}
+
+void Compiler::beginScope() {
+    scopeDepth++;
+}
+
+void Compiler::endScope() {
+    while (!locals.empty() && locals.back().depth == scopeDepth) locals.pop_back();
+    scopeDepth--;
+    localTop = locals.empty() ? 0 : locals.back().slot + 1;
+    freeReg = localTop;
+}
+
+void Compiler::declareLocal(Symbol name, int slot, bool isConst, Symbol type) {
+    locals.push_back({ name, slot, scopeDepth, isConst, typed && type ? declaredType(type) : StaticType::Unknown });
+    localTop = slot + 1;
+}
+
+int Compiler::resolveLocal(Symbol name) const {
+    for (auto it = locals.rbegin(); it != locals.rend(); ++it) {
+        if (it->name == name) return it->slot;
+    }
+    return -1;
+}
+
+// Unknown for a global, or wherever the declaration went unchecked
+StaticType Compiler::localType(Symbol name) const {
+    for (auto it = locals.rbegin(); it != locals.rend(); ++it) {
+        if (it->name == name) return it->type;
+    }
+    return StaticType::Unknown;
+}
+
+// indexed by BinaryOp
+static const OpCode binaryOpcodes[] = {
+    OpCode::Add, OpCode::Sub, OpCode::Mul, OpCode::Div,
+    OpCode::Less, OpCode::LessEqual, OpCode::Greater, OpCode::GreaterEqual,
+    OpCode::Equal, OpCode::NotEqual
+};
+
+// the same, for operands the TypeChecker proved to be two ints or two
+// doubles; equality has no variants, it tests for two ints first anyway
+static const OpCode intOpcodes[] = {
+    OpCode::AddInt, OpCode::SubInt, OpCode::MulInt, OpCode::DivInt,
+    OpCode::LessInt, OpCode::LessEqualInt, OpCode::GreaterInt, OpCode::GreaterEqualInt
+};
+
+static const OpCode doubleOpcodes[] = {
+    OpCode::AddDouble, OpCode::SubDouble, OpCode::MulDouble, OpCode::DivDouble,
+    OpCode::LessDouble, OpCode::LessEqualDouble, OpCode::GreaterDouble, OpCode::GreaterEqualDouble
+};
+
+static OpCode binaryOpcode(const BinaryExpr& bin) {
+    size_t op = static_cast<size_t>(bin.op);
+    if (bin.op == BinaryOp::Equal || bin.op == BinaryOp::NotEqual) return binaryOpcodes[op];
+    StaticType l = bin.left->type, r = bin.right->type;
+    if (l == StaticType::Int && r == StaticType::Int) return intOpcodes[op];
+    if (l == StaticType::Double && r == StaticType::Double) return doubleOpcodes[op];
+    return binaryOpcodes[op];
+}
+
+void Compiler::checkAssignable(Symbol name, int line) const {
+    for (auto it = locals.rbegin(); it != locals.rend(); ++it) {
+        if (it->name != name) continue;
+        if (it->isConst)
+            throw std::runtime_error("Cannot assign to const variable: " + symbolName(name) + " at line " + std::to_string(line));
+        return;
+    }
+}
+
+static bool hasAssignment(const ASTNode* node) {
+    if (!node) return false;
+    switch (node->kind) {
+    case NodeKind::AssignStmt:
+    case NodeKind::IndexAssignStmt: // stores into a local's array, which may be the left operand
+        return true;
+    case NodeKind::BinaryExpr: {
+        // iterative down the left spine, which is as long as the operator chain
+        while (auto bin = as<BinaryExpr>(node)) {
+            if (hasAssignment(bin->right)) return true;
+            node = bin->left;
+        }
+        return hasAssignment(node);
+    }
+    case NodeKind::CallExpr:
+        for (auto* arg : static_cast<const CallExpr*>(node)->args) {
+            if (hasAssignment(arg)) return true;
+        }
+        return false;
+    case NodeKind::CoerceExpr:
+        return hasAssignment(static_cast<const CoerceExpr*>(node)->expr);
+    case NodeKind::ArrayLiteral:
+        for (auto* element : static_cast<const ArrayLiteral*>(node)->elements) {
+            if (hasAssignment(element)) return true;
+        }
+        return false;
+    case NodeKind::IndexExpr: {
+        auto index = static_cast<const IndexExpr*>(node);
+        return hasAssignment(index->array) || hasAssignment(index->index);
+    }
+    default:
+        return false;
+    }
+}
+
+// true if anything in node could rebind name: an assignment, or a declaration shadowing it
+static bool mayRebind(const ASTNode* node, Symbol name) {
+    if (!node) return false;
+    auto anyOf = [name](const NodeList& list) {
+        for (auto* item : list) {
+            if (mayRebind(item, name)) return true;
+        }
+        return false;
+    };
+    switch (node->kind) {
+    case NodeKind::AssignStmt: {
+        auto assign = static_cast<const AssignStmt*>(node);
+        return assign->name == name || mayRebind(assign->value, name);
+    }
+    case NodeKind::VarDecl: {
+        auto var = static_cast<const VarDecl*>(node);
+        return var->name == name || mayRebind(var->initializer, name);
+    }
+    case NodeKind::IndexAssignStmt: {
+        auto assign = static_cast<const IndexAssignStmt*>(node);
+        return mayRebind(assign->index, name) || mayRebind(assign->value, name);
+    }
+    case NodeKind::ExpressionStmt:
+        return mayRebind(static_cast<const ExpressionStmt*>(node)->expr, name);
+    case NodeKind::PrintStmt:
+        return mayRebind(static_cast<const PrintStmt*>(node)->expression, name);
+    case NodeKind::ReturnStmt:
+        return mayRebind(static_cast<const ReturnStmt*>(node)->expression, name);
+    case NodeKind::BinaryExpr: {
+        while (auto bin = as<BinaryExpr>(node)) {
+            if (mayRebind(bin->right, name)) return true;
+            node = bin->left;
+        }
+        return mayRebind(node, name);
+    }
+    case NodeKind::CallExpr:
+        return anyOf(static_cast<const CallExpr*>(node)->args);
+    case NodeKind::ArrayLiteral:
+        return anyOf(static_cast<const ArrayLiteral*>(node)->elements);
+    case NodeKind::CoerceExpr:
+        return mayRebind(static_cast<const CoerceExpr*>(node)->expr, name);
+    case NodeKind::IndexExpr: {
+        auto index = static_cast<const IndexExpr*>(node);
+        return mayRebind(index->array, name) || mayRebind(index->index, name);
+    }
+    case NodeKind::WhileStmt: {
+        auto whileStmt = static_cast<const WhileStmt*>(node);
+        return mayRebind(whileStmt->condition, name) || anyOf(whileStmt->body);
+    }
+    case NodeKind::ForStmt: {
+        auto forStmt = static_cast<const ForStmt*>(node);
+        return mayRebind(forStmt->init, name) || mayRebind(forStmt->condition, name) ||
+            mayRebind(forStmt->increment, name) || anyOf(forStmt->body);
+    }
+    case NodeKind::ForEachStmt: {
+        auto forEach = static_cast<const ForEachStmt*>(node);
+        return forEach->varName == name || mayRebind(forEach->iterable, name) || anyOf(forEach->body);
+    }
+    default:
+        return false;
+    }
+}
+
+// Matches `for (let i: int = k; i < len(a); i++)` with k >= 0, a checked int[]
+// local and neither name rebound in the body. Every a[i] in that body is in
+// range, because only element stores touch a and they never change its
+// length. len() also takes strings, so an unchecked a proves nothing.
+bool Compiler::provesIndex(const ForStmt& loop) const {
+    auto init = as<VarDecl>(loop.init);
+    auto start = init ? as<NumberLiteral>(init->initializer) : nullptr;
+    if (!start || start->value < 0) return false;
+
+    auto cond = as<BinaryExpr>(loop.condition);
+    if (!cond || cond->op != BinaryOp::Less) return false;
+    auto index = as<Identifier>(cond->left);
+    auto bound = as<CallExpr>(cond->right);
+    if (!index || index->name != init->name || !bound || symbolName(bound->funcName) != "len" || bound->args.size() != 1)
+        return false;
+    auto array = as<Identifier>(bound->args[0]);
+    if (!array || array->name == init->name || localType(array->name) != StaticType::Array) return false;
+
+    auto step = as<AssignStmt>(loop.increment);
+    auto next = step ? as<BinaryExpr>(step->value) : nullptr;
+    auto nextIndex = next ? as<Identifier>(next->left) : nullptr;
+    auto one = next ? as<NumberLiteral>(next->right) : nullptr;
+    if (!step || step->name != init->name || !next || next->op != BinaryOp::Add ||
+        !nextIndex || nextIndex->name != init->name || !one || one->value != 1)
+        return false;
+
+    for (auto* stmt : loop.body) {
+        if (mayRebind(stmt, init->name) || mayRebind(stmt, array->name)) return false;
+    }
+    return true;
+}
+
+// A literal, or a local (or len() of a local array) that nothing in the loop
+// rebinds, so the value seen by the first test is the one seen by every test.
+bool Compiler::invariant(const ASTNode* node, const ForStmt& loop, Symbol index) const {
+    if (node->kind == NodeKind::NumberLiteral || node->kind == NodeKind::DoubleLiteral) return true;
+    auto call = as<CallExpr>(node);
+    if (call && symbolName(call->funcName) == "len" && call->args.size() == 1) node = call->args[0];
+    else if (call) return false;
+    auto name = as<Identifier>(node);
+    if (!name || name->name == index || resolveLocal(name->name) < 0) return false;
+    for (auto* stmt : loop.body) {
+        if (mayRebind(stmt, name->name)) return false;
+    }
+    return true;
+}
+
+// Matches `for (let i = start; i < bound; i = i + k)` with a constant k, and
+// `<=`, or `>` and `>=` with `i - k`, where the bound is invariant and the body
+// never rebinds i. Those run as countedFor loops.
+bool Compiler::countedLoop(const ForStmt& loop, CountedLoop& counted) const {
+    auto init = as<VarDecl>(loop.init);
+    if (!init || !init->initializer || init->isConst) return false;
+
+    auto step = as<AssignStmt>(loop.increment);
+    auto next = step ? as<BinaryExpr>(step->value) : nullptr;
+    auto nextIndex = next ? as<Identifier>(next->left) : nullptr;
+    auto amount = next ? as<NumberLiteral>(next->right) : nullptr;
+    if (!step || step->name != init->name || !nextIndex || nextIndex->name != init->name || !amount ||
+        amount->value <= 0 || (next->op != BinaryOp::Add && next->op != BinaryOp::Sub))
+        return false;
+    bool up = next->op == BinaryOp::Add;
+
+    auto cond = as<BinaryExpr>(loop.condition);
+    auto index = cond ? as<Identifier>(cond->left) : nullptr;
+    if (!index || index->name != init->name) return false;
+    switch (cond->op) {
+    case BinaryOp::Less: case BinaryOp::LessEqual:
+        if (!up) return false;
+        break;
+    case BinaryOp::Greater: case BinaryOp::GreaterEqual:
+        if (up) return false;
+        break;
+    default:
+        return false;
+    }
+    if (!invariant(cond->right, loop, init->name)) return false;
+
+    for (auto* stmt : loop.body) {
+        if (mayRebind(stmt, init->name)) return false;
+    }
+    counted.bound = cond->right;
+    counted.step = up ? amount->value : -amount->value;
+    counted.inclusive = cond->op == BinaryOp::LessEqual || cond->op == BinaryOp::GreaterEqual;
+    return true;
+}
+
+// The bound and step are loaded once into the two registers below i, the
+// header test runs once on entry, and from then on a single ForLoop at the
+// bottom steps i, tests it and jumps back.
+void Compiler::countedFor(const ForStmt& loop, const CountedLoop& counted) {
+    auto init = static_cast<const VarDecl*>(loop.init);
+    beginScope();
+    int limit = reserve();
+    int step = reserve();
+    int index = reserve();
+    expression(init->initializer, index);
+    declareLocal(init->name, index);
+    expression(counted.bound, limit);
+    emit(Instruction::abx(OpCode::LoadInt, step, counted.step), loop.line);
+
+    int test = reserve();
+    OpCode compare = counted.step > 0 ? (counted.inclusive ? OpCode::LessEqual : OpCode::Less)
+                                      : (counted.inclusive ? OpCode::GreaterEqual : OpCode::Greater);
+    emit(Instruction::abc(compare, test, index, limit), loop.line);
+    size_t exitJump = emitJump(OpCode::JumpIfFalse, test, loop.line);
+    freeReg = localTop;
+
+    bool proven = provesIndex(loop);
+    if (proven) {
+        auto bound = static_cast<const CallExpr*>(counted.bound);
+        provenIndexes.push_back({ static_cast<const Identifier*>(bound->args[0])->name, init->name });
+    }
+    size_t bodyStart = chunk->code.size();
+    beginLoop(SIZE_MAX);
+    beginScope();
+    block(loop.body);
+    endScope();
+    if (proven) provenIndexes.pop_back();
+    for (size_t jump : loops.back().continues) patchJump(jump);
+    int32_t offset = static_cast<int32_t>(bodyStart) - static_cast<int32_t>(chunk->code.size() + 1);
+    emit(Instruction::abx(counted.inclusive ? OpCode::ForLoopInclusive : OpCode::ForLoop, limit, offset), loop.line);
+    patchJump(exitJump);
+    endLoop();
+    endScope();
+}
+
+void Compiler::block(const NodeList& body) {
+    for (auto* stmt : body) statement(stmt);
+}
+
+void Compiler::statement(const ASTNode* node) {
+    if (!node) return;
+
+    switch (node->kind) {
+    case NodeKind::ForStmt: {
+        auto forStmt = static_cast<const ForStmt*>(node);
+        CountedLoop counted;
+        if (countedLoop(*forStmt, counted)) {
+            countedFor(*forStmt, counted);
+            break;
+        }
+        beginScope();
+        statement(forStmt->init);
+        size_t loopStart = chunk->code.size();
+        size_t exitJump = SIZE_MAX;
+        if (forStmt->condition) {
+            int cond = operand(forStmt->condition);
+            exitJump = emitJump(OpCode::JumpIfFalse, cond, forStmt->line);
+            freeReg = localTop;
+        }
+        bool proven = provesIndex(*forStmt);
+        if (proven) {
+            auto index = static_cast<const VarDecl*>(forStmt->init);
+            auto bound = static_cast<const CallExpr*>(static_cast<const BinaryExpr*>(forStmt->condition)->right);
+            provenIndexes.push_back({ static_cast<const Identifier*>(bound->args[0])->name, index->name });
+        }
+        beginLoop(SIZE_MAX);
+        beginScope();
+        block(forStmt->body);
+        endScope();
+        if (proven) provenIndexes.pop_back();
+        for (size_t jump : loops.back().continues) patchJump(jump);
+        statement(forStmt->increment);
+        emitLoop(loopStart, forStmt->line);
+        if (exitJump != SIZE_MAX) patchJump(exitJump);
+        endLoop();
+        endScope();
+        break;
+    }
+    case NodeKind::WhileStmt: {
+        auto whileStmt = static_cast<const WhileStmt*>(node);
+        size_t loopStart = chunk->code.size();
+        size_t exitJump = SIZE_MAX;
+        bool truth;
+        if (!literalTruth(whileStmt->condition, truth) || !truth) {
+            int cond = operand(whileStmt->condition);
+            exitJump = emitJump(OpCode::JumpIfFalse, cond, whileStmt->line);
+            freeReg = localTop;
+        }
+        beginLoop(loopStart);
+        beginScope();
+        block(whileStmt->body);
+        endScope();
+        emitLoop(loopStart, whileStmt->line);
+        if (exitJump != SIZE_MAX) patchJump(exitJump);
+        endLoop();
+        break;
+    }
+    case NodeKind::ForEachStmt: {
+        // the array and the next index sit in hidden registers just below the loop variable
+        auto forEach = static_cast<const ForEachStmt*>(node);
+        beginScope();
+        int iter = reserve();
+        reserve();
+        int var = reserve();
+        expression(forEach->iterable, iter);
+        emit(Instruction::abx(OpCode::LoadInt, iter + 1, 0), forEach->line);
+        declareLocal(forEach->varName, var);
+        size_t loopStart = chunk->code.size();
+        size_t exitJump = emitJump(OpCode::ForIter, iter, forEach->line);
+        beginLoop(loopStart);
+        beginScope();
+        block(forEach->body);
+        endScope();
+        emitLoop(loopStart, forEach->line);
+        patchJump(exitJump);
+        endLoop();
+        endScope();
+        break;
+    }
+    case NodeKind::BreakStmt:
+        if (loops.empty()) throw std::runtime_error("'break' outside of a loop at line " + std::to_string(node->line));
+        loops.back().breaks.push_back(emitJump(OpCode::Jump, 0, node->line));
+        break;
+    case NodeKind::ContinueStmt: {
+        if (loops.empty()) throw std::runtime_error("'continue' outside of a loop at line " + std::to_string(node->line));
+        Loop& loop = loops.back();
+        if (loop.continueTarget != SIZE_MAX) emitLoop(loop.continueTarget, node->line);
+        else loop.continues.push_back(emitJump(OpCode::Jump, 0, node->line));
+        break;
+    }
+    case NodeKind::CallExpr:
+        call(*static_cast<const CallExpr*>(node), freeReg);
+        break;
+    case NodeKind::PrintStmt: {
+        auto print = static_cast<const PrintStmt*>(node);
+        int reg = operand(print->expression);
+        emit(Instruction::abc(OpCode::Print, reg), print->line);
+        break;
+    }
+    case NodeKind::VarDecl: {
+        auto var = static_cast<const VarDecl*>(node);
+        bool redeclared = false;
+        for (auto it = locals.rbegin(); it != locals.rend() && it->depth == scopeDepth; ++it) {
+            if (it->name == var->name) redeclared = true;
+        }
+        if (scopeDepth == 0 || redeclared) {
+            assign(var->name, var->initializer, var->line);
+        }
+        else {
+            // the new slot is only visible after its initializer
+            int slot = reserve();
+            expression(var->initializer, slot);
+            declareLocal(var->name, slot, var->isConst, var->type);
+        }
+        break;
+    }
+    case NodeKind::AssignStmt: {
+        auto assignStmt = static_cast<const AssignStmt*>(node);
+        assign(assignStmt->name, assignStmt->value, assignStmt->line);
+        break;
+    }
+    case NodeKind::IndexAssignStmt:
+        expression(node, reserve());
+        break;
+    case NodeKind::ExpressionStmt:
+        operand(static_cast<const ExpressionStmt*>(node)->expr);
+        break;
+    case NodeKind::ReturnStmt: {
+        auto ret = static_cast<const ReturnStmt*>(node);
+        auto callExpr = as<CallExpr>(ret->expression);
+        if (callExpr && tailCall(*callExpr)) break;
+        int reg = operand(ret->expression);
+        emit(Instruction::abc(OpCode::Return, reg), ret->line);
+        break;
+    }
+    default:
+        emit(Instruction::abc(OpCode::Error, 0, nameIndex("Unsupported statement at top level")), node->line);
+        break;
+    }
+    freeReg = localTop;
+}
+
+void Compiler::assign(Symbol name, const ASTNode* value, int line) {
+    checkAssignable(name, line);
+    int slot = resolveLocal(name);
+    int reg = reserve();
+    size_t start = chunk->code.size();
+    expression(value, reg);
+
+    if (slot < 0) {
+        emit(Instruction::abc(OpCode::SetGlobal, reg, nameIndex(symbolName(name))), line);
+        return;
+    }
+
+    // retarget the instruction that produced the value straight into the slot;
+    // its operands are all read before the write, so `x = y - x` stays correct
+    if (chunk->code.size() > start && chunk->code.back().a == reg) {
+        Instruction& last = chunk->code.back();
+        switch (last.op) {
+        case OpCode::LoadInt: case OpCode::LoadConst: case OpCode::LoadBool:
+        case OpCode::Move: case OpCode::GetGlobal:
+        case OpCode::Add: case OpCode::Sub: case OpCode::Mul: case OpCode::Div:
+        case OpCode::Less: case OpCode::LessEqual: case OpCode::Greater: case OpCode::GreaterEqual:
+        case OpCode::Equal: case OpCode::NotEqual:
+        case OpCode::AddInt: case OpCode::SubInt: case OpCode::MulInt: case OpCode::DivInt:
+        case OpCode::LessInt: case OpCode::LessEqualInt: case OpCode::GreaterInt: case OpCode::GreaterEqualInt:
+        case OpCode::AddDouble: case OpCode::SubDouble: case OpCode::MulDouble: case OpCode::DivDouble:
+        case OpCode::LessDouble: case OpCode::LessEqualDouble: case OpCode::GreaterDouble: case OpCode::GreaterEqualDouble:
+        case OpCode::NewArray: case OpCode::AllocArray: case OpCode::Length:
+        case OpCode::GetIndex: case OpCode::GetIndexUnchecked:
+            last.a = static_cast<uint16_t>(slot);
+            return;
+        default:
+            break;
+        }
+    }
+    emitMove(slot, reg, line);
+}
+
+void Compiler::expression(const ASTNode* node, int dst) {
+    if (!node) {
+        emit(Instruction::abc(OpCode::Error, 0, nameIndex("Unknown expression type")), 0);
+        return;
+    }
+
+    switch (node->kind) {
+    case NodeKind::Identifier: {
+        auto ident = static_cast<const Identifier*>(node);
+        int slot = resolveLocal(ident->name);
+        if (slot >= 0) emitMove(dst, slot, ident->line);
+        else emit(Instruction::abc(OpCode::GetGlobal, dst, nameIndex(symbolName(ident->name))), ident->line);
+        break;
+    }
+    case NodeKind::NumberLiteral: {
+        auto num = static_cast<const NumberLiteral*>(node);
+        emit(Instruction::abx(OpCode::LoadInt, dst, num->value), num->line);
+        break;
+    }
+    case NodeKind::DoubleLiteral: {
+        auto num = static_cast<const DoubleLiteral*>(node);
+        emit(Instruction::abx(OpCode::LoadConst, dst, constantIndex(num->value)), num->line);
+        break;
+    }
+    case NodeKind::BoolLiteral: {
+        auto boolean = static_cast<const BoolLiteral*>(node);
+        emit(Instruction::abc(OpCode::LoadBool, dst, boolean->value ? 1 : 0), boolean->line);
+        break;
+    }
+    case NodeKind::StringLiteral: {
+        auto string = static_cast<const StringLiteral*>(node);
+        emit(Instruction::abx(OpCode::LoadConst, dst, stringIndex(string->text)), string->line);
+        break;
+    }
+    case NodeKind::BinaryExpr: {
+        // a - b - c nests to the left, so walk that spine with a loop and
+        // emit from the innermost operator out; only right operands recurse
+        std::vector<const BinaryExpr*> chain;
+        const ASTNode* leftmost = node;
+        while (auto bin = as<BinaryExpr>(leftmost)) {
+            chain.push_back(bin);
+            leftmost = bin->left;
+        }
+        // dst is never a visible local, so the left side can be built in it
+        int mark = freeReg;
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+            auto bin = *it;
+            OpCode op = binaryOpcode(*bin);
+            int lhs = dst;
+            if (it == chain.rbegin()) {
+                auto leftIdent = as<Identifier>(leftmost);
+                int leftSlot = leftIdent ? resolveLocal(leftIdent->name) : -1;
+                if (leftSlot >= 0 && !hasAssignment(bin->right)) lhs = leftSlot;
+                else expression(leftmost, dst);
+            }
+            int rhs = operand(bin->right);
+            emit(Instruction::abc(op, dst, lhs, rhs), bin->line);
+            freeReg = mark;
+        }
+        break;
+    }
+    case NodeKind::CallExpr:
+        call(*static_cast<const CallExpr*>(node), dst);
+        break;
+    case NodeKind::CoerceExpr: {
+        auto coerce = static_cast<const CoerceExpr*>(node);
+        expression(coerce->expr, dst);
+        emit(Instruction::abc(OpCode::Coerce, dst, static_cast<int>(coerce->type)), coerce->line);
+        break;
+    }
+    case NodeKind::AssignStmt: {
+        auto assignExpr = static_cast<const AssignStmt*>(node);
+        checkAssignable(assignExpr->name, assignExpr->line);
+        expression(assignExpr->value, dst);
+        int slot = resolveLocal(assignExpr->name);
+        if (slot >= 0) emitMove(slot, dst, assignExpr->line);
+        else emit(Instruction::abc(OpCode::SetGlobal, dst, nameIndex(symbolName(assignExpr->name))), assignExpr->line);
+        break;
+    }
+    case NodeKind::ArrayLiteral: {
+        auto array = static_cast<const ArrayLiteral*>(node);
+        int mark = freeReg;
+        int base = freeReg;
+        for (auto* element : array->elements) expression(element, reserve());
+        emit(Instruction::abc(OpCode::NewArray, dst, base, static_cast<int>(array->elements.size())), array->line);
+        freeReg = mark;
+        break;
+    }
+    case NodeKind::IndexExpr: {
+        auto index = static_cast<const IndexExpr*>(node);
+        int mark = freeReg;
+        OpCode op = OpCode::GetIndex;
+        auto arrayIdent = as<Identifier>(index->array);
+        auto indexIdent = as<Identifier>(index->index);
+        if (arrayIdent && indexIdent) {
+            for (auto& p : provenIndexes) {
+                if (p.array == arrayIdent->name && p.index == indexIdent->name) op = OpCode::GetIndexUnchecked;
+            }
+        }
+        int array = operand(index->array);
+        int at = operand(index->index);
+        emit(Instruction::abc(op, dst, array, at), index->line);
+        freeReg = mark;
+        break;
+    }
+    case NodeKind::IndexAssignStmt: {
+        auto assignExpr = static_cast<const IndexAssignStmt*>(node);
+        checkAssignable(assignExpr->name, assignExpr->line);
+        int mark = freeReg;
+        int at = operand(assignExpr->index);
+        expression(assignExpr->value, dst);
+        int slot = resolveLocal(assignExpr->name);
+        if (slot >= 0) emit(Instruction::abc(OpCode::SetIndex, slot, at, dst), assignExpr->line);
+        else emit(Instruction::abc(OpCode::SetGlobalIndex, dst, nameIndex(symbolName(assignExpr->name)), at), assignExpr->line);
+        freeReg = mark;
+        break;
+    }
+    default:
+        emit(Instruction::abc(OpCode::Error, 0, nameIndex("Unknown expression type")), node->line);
+        break;
+    }
+}
+
+// Returns a register holding the value of node: a local's own slot, or a new temporary.
+int Compiler::operand(const ASTNode* node) {
+    if (auto ident = as<Identifier>(node)) {
+        int slot = resolveLocal(ident->name);
+        if (slot >= 0) return slot;
+    }
+    int reg = reserve();
+    expression(node, reg);
+    return reg;
+}
+
+void Compiler::call(const CallExpr& callExpr, int dst) {
+    if (builtin(callExpr, dst)) return;
+    // arguments go into consecutive registers, which become the callee's frame
+    int mark = freeReg;
+    int base = freeReg;
+    for (auto* arg : callExpr.args) {
+        expression(arg, reserve());
+    }
+    if (callExpr.args.empty()) reserve();
+    OpCode op = callExpr.checked ? OpCode::Call : OpCode::CallChecked;
+    emit(Instruction::abc(op, base, nameIndex(symbolName(callExpr.funcName)), static_cast<int>(callExpr.args.size())), callExpr.line);
+    emitMove(dst, base, callExpr.line);
+    freeReg = mark;
+}
+
+// `return f(...)`: the callee takes over this frame, so tail recursion runs in
+// constant space. False for builtins, which are not calls.
+bool Compiler::tailCall(const CallExpr& callExpr) {
+    const std::string& name = symbolName(callExpr.funcName);
+    if (name == "len" || name == "array") return false;
+    int mark = freeReg;
+    int base = freeReg;
+    for (auto* arg : callExpr.args) {
+        expression(arg, reserve());
+    }
+    OpCode op = callExpr.checked ? OpCode::TailCall : OpCode::TailCallChecked;
+    emit(Instruction::abc(op, base, nameIndex(name), static_cast<int>(callExpr.args.size())), callExpr.line);
+    freeReg = mark;
+    return true;
+}
+
+// len(a) and array(n) compile to single instructions rather than calls
+bool Compiler::builtin(const CallExpr& callExpr, int dst) {
+    OpCode op;
+    const std::string& name = symbolName(callExpr.funcName);
+    if (name == "len") op = OpCode::Length;
+    else if (name == "array") op = OpCode::AllocArray;
+    else return false;
+    if (callExpr.args.size() != 1)
+        throw std::runtime_error(name + "() takes one argument at line " + std::to_string(callExpr.line));
+    int mark = freeReg;
+    int arg = operand(callExpr.args[0]);
+    emit(Instruction::abc(op, dst, arg), callExpr.line);
+    freeReg = mark;
+    return true;
+}
+
+int Compiler::reserve() {
+    if (freeReg >= UINT16_MAX)
+        throw std::runtime_error("Too many registers needed in " + chunk->name);
+    int reg = freeReg++;
+    if (freeReg > chunk->numRegisters) chunk->numRegisters = freeReg;
+    return reg;
+}
+
+uint16_t Compiler::nameIndex(const std::string& name) {
+    auto it = nameSlots.find(name);
+    if (it != nameSlots.end()) return it->second;
+    if (chunk->names.size() >= UINT16_MAX)
+        throw std::runtime_error("Too many names in " + chunk->name);
+    uint16_t index = static_cast<uint16_t>(chunk->names.size());
+    chunk->names.push_back(name);
+    nameSlots.emplace(name, index);
+    return index;
+}
+
+int32_t Compiler::constantIndex(double value) {
+    uint64_t bits = std::bit_cast<uint64_t>(value);
+    auto it = constantSlots.find(bits);
+    if (it != constantSlots.end()) return it->second;
+    int32_t index = static_cast<int32_t>(chunk->constants.size());
+    chunk->constants.push_back(value);
+    constantSlots.emplace(bits, index);
+    return index;
+}
+
+// the constant views the interned text, which lives as long as the process
+int32_t Compiler::stringIndex(Symbol text) {
+    auto it = stringSlots.find(text);
+    if (it != stringSlots.end()) return it->second;
+    int32_t index = static_cast<int32_t>(chunk->constants.size());
+    chunk->constants.push_back(Value::literal(symbolName(text)));
+    stringSlots.emplace(text, index);
+    return index;
+}
+
+size_t Compiler::emit(Instruction ins, int line) {
+    chunk->code.push_back(ins);
+    chunk->lines.push_back(line);
+    return chunk->code.size() - 1;
+}
+
+void Compiler::emitMove(int dst, int src, int line) {
+    if (dst != src) emit(Instruction::abc(OpCode::Move, dst, src), line);
+}
+
+size_t Compiler::emitJump(OpCode op, int reg, int line) {
+    return emit(Instruction::abx(op, reg, 0), line);
+}
+
+void Compiler::patchJump(size_t at) {
+    int32_t offset = static_cast<int32_t>(chunk->code.size() - at - 1);
+    chunk->code[at] = Instruction::abx(chunk->code[at].op, chunk->code[at].a, offset);
+}
+
+void Compiler::emitLoop(size_t loopStart, int line) {
+    int32_t offset = static_cast<int32_t>(loopStart) - static_cast<int32_t>(chunk->code.size() + 1);
+    emit(Instruction::abx(OpCode::Jump, 0, offset), line);
+}
+
+void Compiler::beginLoop(size_t continueTarget) {
+    loops.push_back({ continueTarget, {}, {} });
+}
+
+// breaks land on whatever comes after the loop
+void Compiler::endLoop() {
+    for (size_t jump : loops.back().breaks) patchJump(jump);
+    loops.pop_back();
+}
@@ -0,0 +1,92 @@
+// compiler.h
+#pragma once
+#include "parser.h"
+#include "bytecode.h"
+#include <memory>
+#include <unordered_map>
+
+// Lowers parsed function bodies and top-level statements into register bytecode.
+// Parameters, `let` declarations and loop variables are resolved to fixed frame
+// slots while lowering; any other name is a global in Interpreter::variables.
+class Compiler {
+public:
+    std::unique_ptr<Chunk> compileFunction(const FunctionDecl& func);
+    std::unique_ptr<Chunk> compileStatement(const ASTNode* stmt);
+    std::unique_ptr<Chunk> compileExpression(const ASTNode* expr);
+
+private:
+    struct Local {
+        Symbol name;
+        int slot;
+        int depth;
+        bool isConst;
+        StaticType type; // Unknown unless the TypeChecker holds it to its declaration
+    };
+
+    // jumps out of the innermost loop, patched once their targets are known
+    struct Loop {
+        size_t continueTarget; // SIZE_MAX until the for increment is emitted
+        std::vector<size_t> breaks;
+        std::vector<size_t> continues;
+    };
+
+    // what countedLoop found in a for header
+    struct CountedLoop {
+        const ASTNode* bound;
+        int32_t step;
+        bool inclusive; // <= or >= rather than < or >
+    };
+
+    // a[i] pairs known to be in bounds inside the loop being compiled
+    struct ProvenIndex {
+        Symbol array;
+        Symbol index;
+    };
+
+    std::unique_ptr<Chunk> chunk;
+    int freeReg = 0;
+    int localTop = 0;    // first register above the live locals
+    int scopeDepth = 0;  // 0 is global scope
+    bool typed = false;  // the function's declared types were checked
+    std::vector<Local> locals;
+    std::vector<Loop> loops;
+    std::vector<ProvenIndex> provenIndexes;
+    std::unordered_map<std::string, uint16_t> nameSlots;
+    std::unordered_map<uint64_t, int32_t> constantSlots; // keyed by bits, so 0.0 and -0.0 stay apart
+    std::unordered_map<Symbol, int32_t> stringSlots;
+
+    void begin(const std::string& name);
+    std::unique_ptr<Chunk> finish(int line, StaticType result = StaticType::Unknown);
+
+    void beginScope();
+    void endScope();
+    void declareLocal(Symbol name, int slot, bool isConst = false, Symbol type = 0);
+    int resolveLocal(Symbol name) const;
+    StaticType localType(Symbol name) const;
+    void checkAssignable(Symbol name, int line) const;
+
+    void statement(const ASTNode* stmt);
+    void block(const NodeList& body);
+    void assign(Symbol name, const ASTNode* value, int line);
+    void expression(const ASTNode* node, int dst);
+    int operand(const ASTNode* node);
+    void call(const CallExpr& call, int dst);
+    bool tailCall(const CallExpr& call);
+    bool builtin(const CallExpr& call, int dst);
+    bool provesIndex(const ForStmt& loop) const;
+    bool countedLoop(const ForStmt& loop, CountedLoop& counted) const;
+    bool invariant(const ASTNode* node, const ForStmt& loop, Symbol index) const;
+    void countedFor(const ForStmt& loop, const CountedLoop& counted);
+
+    int reserve();
+    uint16_t nameIndex(const std::string& name);
+    int32_t constantIndex(double value);
+    int32_t stringIndex(Symbol text);
+    size_t emit(Instruction ins, int line);
+    void emitMove(int dst, int src, int line);
+    size_t emitJump(OpCode op, int reg, int line);
+    void patchJump(size_t at);
+    void emitLoop(size_t loopStart, int line);
+    void beginLoop(size_t continueTarget);
+    void endLoop();
+};
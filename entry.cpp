@@ -1,58 +1,316 @@
 #include <Windows.h>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <string>
+#include <thread>
 
 #include "lexer.h"
 #include "parser.h"
 #include "interpreter.h"
+#include "mappedfile.h"
+#include "optimizer.h"
+#include "program.h"
+#include "programcache.h"
+#include "runner.h"
+#include "session.h"
+#include "stats.h"
 
-//To start coding in JS++, you need to identify the main function. 
+//To start coding in JS++, you need to identify the main function.
 //This is so the interpreter can identify the entry point of where the code will start to execute.You can do an example like this        function main() : int { return 0; }
 //You can see how 'int' is the return type and 'main' is the function name. Follows the same syntax as C++, but uses identifiers like function, return, and print from Javascript.
+//Save that to a file and run it with:  compiler.exe script.jspp
 
-int main() //As we can see, the code executes perfectly to how JS++ sees.
-{
-    try {
-        std::string code = R"(
+struct Options {
+    std::string path;
+    int optimize = 2; //0 turns the optimizer off
+    bool stats = false; //timings and sizes on stderr
+    bool pause = false; //wait for Enter before exiting, for double-clicked consoles
+    bool cache = true; //reuse or write <script>.jsc
+    bool profile = false; //per-function and per-line report on stderr
+    std::string foldedPath; //where to write folded stacks for a flame graph
+    int runs = 1; //how many times to run main, in parallel
+    unsigned threads = 0; //0 means one per core
+    bool repl = false; //read statements from stdin and print what expressions evaluate to
+    bool watch = false; //rerun main whenever the script is saved
+    bool jit = false; //compile hot functions to machine code
+    size_t memo = 0; //results cached per pure function; 0 caches none
+    ExecutionLimits limits; //all off unless asked for
+};
 
-        function main(): int 
-        {
-            for (let i: int = 0; i < 10; i++) {
-                print(i);
-            } //Our for loop
+static void usage() {
+    std::cerr << "usage: compiler [-O0|-O1|-O2] [--stats] [--pause] [--no-cache] script.jspp\n"
+                 "       compiler --repl [script.jspp]\n"
+                 "       compiler --watch script.jspp\n"
+                 "  -O<n>        optimization level, default 2\n"
+                 "  --stats      print timings and sizes to stderr, then the counters as one JSON line\n"
+                 "  --pause      wait for Enter before exiting\n"
+                 "  --no-cache   always parse, and don't write script.jspp.jsc\n"
+                 "  --profile    report time per function and hits per line to stderr\n"
+                 "  --profile-folded=<file>  also write folded stacks for flamegraph.pl\n"
+                 "  --runs=<n>   run main n times in parallel, each in a fresh context\n"
+                 "  --threads=<n>  worker threads for --runs, default one per core\n"
+                 "  --max-ops=<n>     stop a call or statement after about n instructions\n"
+                 "  --timeout=<ms>    stop a call or statement after ms milliseconds\n"
+                 "  --max-depth=<n>   limit nested calls\n"
+                 "  --max-memory=<mb> limit arrays, registers and globals\n"
+                 "  --jit        compile hot int functions to x86-64 machine code\n"
+                 "  --memo[=<n>] cache up to n results (default 65536) of each pure function\n"
+                 "  --repl       read statements from stdin, after loading the script if given\n"
+                 "  --watch      rerun main each time the script changes, reparsing only what changed\n";
+}
 
-			return 0; //Our function return
+static bool parseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (std::strcmp(arg, "--stats") == 0) options.stats = true;
+        else if (std::strcmp(arg, "--pause") == 0) options.pause = true;
+        else if (std::strcmp(arg, "--no-cache") == 0) options.cache = false;
+        else if (std::strcmp(arg, "--profile") == 0) options.profile = true;
+        else if (std::strncmp(arg, "--profile-folded=", 17) == 0 && arg[17]) {
+            options.profile = true;
+            options.foldedPath = arg + 17;
         }
+        else if (arg[0] == '-' && arg[1] == 'O' && arg[2] >= '0' && arg[2] <= '2' && arg[3] == '\0') options.optimize = arg[2] - '0';
+        else if (std::strncmp(arg, "--runs=", 7) == 0 && std::atoi(arg + 7) > 0) options.runs = std::atoi(arg + 7);
+        else if (std::strncmp(arg, "--threads=", 10) == 0 && std::atoi(arg + 10) > 0) options.threads = std::atoi(arg + 10);
+        else if (std::strncmp(arg, "--max-ops=", 10) == 0 && std::atoll(arg + 10) > 0) options.limits.maxOperations = std::atoll(arg + 10);
+        else if (std::strncmp(arg, "--timeout=", 10) == 0 && std::atoi(arg + 10) > 0) options.limits.timeout = std::chrono::milliseconds(std::atoi(arg + 10));
+        else if (std::strncmp(arg, "--max-depth=", 12) == 0 && std::atoi(arg + 12) > 0) options.limits.maxCallDepth = std::atoi(arg + 12);
+        else if (std::strncmp(arg, "--max-memory=", 13) == 0 && std::atoi(arg + 13) > 0) options.limits.maxMemory = static_cast<size_t>(std::atoi(arg + 13)) << 20;
+        else if (std::strcmp(arg, "--repl") == 0) options.repl = true;
+        else if (std::strcmp(arg, "--jit") == 0) options.jit = true;
+        else if (std::strcmp(arg, "--memo") == 0) options.memo = 65536;
+        else if (std::strncmp(arg, "--memo=", 7) == 0 && std::atoll(arg + 7) > 0) options.memo = static_cast<size_t>(std::atoll(arg + 7));
+        else if (std::strcmp(arg, "--watch") == 0) options.watch = true;
+        else if (arg[0] == '-') return false;
+        else if (options.path.empty()) options.path = arg;
+        else return false; //only one script at a time
+    }
+    if (options.repl && options.watch) return false;
+    return !options.path.empty() || options.repl;
+}
 
-)"; 
+static double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
 
+//Compiles the script, or rebuilds it from <script>.jsc when that was made from the same source.
+static Program loadProgram(const Options& options, std::string_view source, const char*& cacheResult) {
+    if (!options.cache) {
+        cacheResult = "off";
+        return Program::compile(source, options.optimize);
+    }
 
-        Lexer lexer(code); //Our lexer
-        Parser parser(lexer); //Code Parser
-        Interpreter interp; //Code interpreter
+    uint64_t key = programCacheKey(source, options.optimize);
+    std::string cachePath = programCachePath(options.path);
+    std::vector<CompiledUnit> units;
+    if (loadProgramCache(cachePath, key, units)) {
+        cacheResult = "hit";
+        return Program::fromUnits(std::move(units));
+    }
 
-        while (!parser.isAtEnd()) {
-            auto node = parser.parseTopLevel();
-            if (auto func = std::dynamic_pointer_cast<FunctionDecl>(node)) {
-                interp.addFunction(func->name, func);
+    Program program = Program::compile(source, options.optimize);
+    ProgramCacheWriter writer(key);
+    for (const auto& unit : program.units()) {
+        if (unit.isFunction) writer.addFunction(*unit.chunk);
+        else writer.addStatement(*unit.chunk);
+    }
+    cacheResult = writer.save(cachePath) ? "written" : "not written";
+    return program;
+}
+
+//--stats: every thread's counters, as the last line on stderr.
+static void printCounters() {
+    collectStats().writeJson(std::cerr);
+    std::cerr << std::endl;
+}
+
+//--runs N: main() N times in parallel, each with its own globals and output, printed in order.
+static int runMany(const Options& options, const Program& program) {
+    std::vector<std::vector<Value>> invocations(options.runs); //main takes no arguments
+    auto start = std::chrono::steady_clock::now();
+    std::vector<RunResult> results = runParallel(program, "main", invocations, options.threads, options.limits);
+    double runTime = millisecondsSince(start);
+
+    int exitCode = 0;
+    for (size_t i = 0; i < results.size(); ++i) {
+        std::cout << results[i].output;
+        if (!results[i].error.empty()) {
+            std::cout.flush();
+            std::cerr << "Error (run " << i << "): " << results[i].error << std::endl;
+            exitCode = 1;
+        }
+        else if (i == 0 && results[i].value.isInt()) {
+            exitCode = results[i].value.asInt();
+        }
+    }
+    std::cout.flush();
+    if (options.stats) {
+        std::cerr << "runs:    " << options.runs << " in " << runTime << " ms ("
+                  << options.runs / (runTime / 1000) << " runs/s)\n";
+        printCounters(); //the workers' interpreters flushed theirs when they were destroyed
+    }
+    return exitCode;
+}
+
+//A session keeps its own copy of the source, so the file can change underneath it.
+static std::string readSource(const std::string& path) {
+    MappedFile file(path);
+    return std::string(file.text());
+}
+
+//Whether a REPL entry can be run yet: every brace closed.
+static bool complete(const std::string& entry) {
+    int depth = 0;
+    for (char c : entry) depth += (c == '{') - (c == '}');
+    return depth <= 0;
+}
+
+//--repl: statements and functions accumulate into one session; bare expressions print their value.
+static int repl(const Options& options) {
+    Session session(options.optimize);
+    session.interpreter().setLimits(options.limits);
+    session.interpreter().setJit(options.jit);
+    session.interpreter().setMemoize(options.memo);
+    if (!options.path.empty()) session.reload(readSource(options.path));
+    session.interpreter().flushOutput();
+
+    std::string entry, line;
+    std::cout << "> " << std::flush;
+    while (std::getline(std::cin, line)) {
+        entry += line;
+        entry += '\n';
+        if (!complete(entry)) {
+            std::cout << ". " << std::flush;
+            continue;
+        }
+        size_t lastChar = entry.find_last_not_of(" \t\r\n");
+        if (lastChar != std::string::npos) {
+            if (entry[lastChar] != ';' && entry[lastChar] != '}') entry.insert(lastChar + 1, ";"); //the ';' is optional at the prompt
+            try {
+                std::optional<Value> value = session.eval(entry);
+                session.interpreter().flushOutput();
+                if (value) std::cout << *value << "\n";
             }
-            else {
-                interp.execStatement(node);
+            catch (const std::exception& e) {
+                session.interpreter().flushOutput();
+                std::cout << "Error: " << e.what() << "\n";
             }
         }
-        
-        if (interp.functions.count("main")) {  //Checks if the code contains the 'main' function
-            int result = interp.callFunction("main", {}); //Call our main function here!
-            std::cout << "main() returned: " << result << std::endl;
+        entry.clear();
+        std::cout << "> " << std::flush;
+    }
+    std::cout << std::endl;
+    return 0;
+}
+
+//--watch: polls the script's modification time; each save reloads it and reruns main.
+static int watch(const Options& options) {
+    Session session(options.optimize);
+    session.interpreter().setLimits(options.limits);
+    session.interpreter().setJit(options.jit);
+    session.interpreter().setMemoize(options.memo);
+    std::filesystem::file_time_type seen{};
+    for (;;) {
+        std::error_code error;
+        auto stamp = std::filesystem::last_write_time(options.path, error);
+        if (!error && stamp != seen) {
+            seen = stamp;
+            auto start = std::chrono::steady_clock::now();
+            try {
+                session.reload(readSource(options.path)); //a syntax error keeps the previous version loaded
+                double loadTime = millisecondsSince(start);
+                if (options.stats) {
+                    std::cerr << "reload:  parsed " << session.lastParsedBytes() << " of " << session.source().size()
+                              << " bytes in " << loadTime << " ms\n";
+                }
+                if (session.interpreter().hasFunction("main")) session.interpreter().callFunction("main", {});
+                session.interpreter().flushOutput();
+                if (options.stats) {
+                    session.interpreter().flushStats();
+                    printCounters(); //totals since the watch started
+                }
+            }
+            catch (const std::exception& e) {
+                session.interpreter().flushOutput();
+                std::cerr << "Error: " << e.what() << std::endl;
+            }
         }
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
     }
-    catch (const std::exception& e) {
-            std::cerr << "Error: " << e.what() << std::endl;
-            std::cin.get();
-            return 1;
+}
+
+static int run(const Options& options) {
+    if (options.repl) return repl(options);
+    if (options.watch) return watch(options);
+
+    auto start = std::chrono::steady_clock::now();
+    MappedFile file(options.path); //the lexer reads straight out of the mapping, no copy
+
+    const char* cacheResult;
+    Program program = loadProgram(options, file.text(), cacheResult);
+    if (options.runs > 1) return runMany(options, program);
+
+    Interpreter interp; //Code interpreter
+    interp.setLimits(options.limits);
+    interp.setJit(options.jit); //off under --profile and the limits, which need every instruction seen
+    interp.setMemoize(options.memo); //pure functions answer repeated calls from a cache
+    Profiler profiler;
+    if (options.profile) interp.setProfiler(&profiler); //otherwise the interpreter runs without any hooks
+    interp.load(program); //defines the functions and runs the top-level statements
+    double loadTime = millisecondsSince(start);
+
+    int exitCode = 0;
+    auto runStart = std::chrono::steady_clock::now();
+    if (interp.hasFunction("main")) {  //Checks if the code contains the 'main' function
+        Value result = interp.callFunction("main", {}); //Call our main function here!
+        if (result.isInt()) exitCode = result.asInt(); //main's return value becomes the exit code
+    }
+    interp.flushOutput(); //print() is buffered, so let it out before anything else is written
+    double runTime = millisecondsSince(runStart);
+
+    if (options.stats) {
+        std::cerr << "source:  " << file.text().size() << " bytes\n"
+                  << "code:    " << program.units().size() << " units, " << program.functionNames().size() << " function names\n"
+                  << "cache:   " << cacheResult << "\n"
+                  << "load:    " << loadTime << " ms (parse or cache, top-level statements)\n"
+                  << "run:     " << runTime << " ms\n";
+        interp.flushStats();
+        printCounters();
     }
+    if (options.profile) {
+        profiler.report(std::cerr);
+        if (!options.foldedPath.empty()) {
+            std::ofstream folded(options.foldedPath);
+            profiler.writeFolded(folded);
+            if (!folded) throw std::runtime_error("Cannot write " + options.foldedPath);
+        }
+    }
+    return exitCode;
+}
 
-    std::cin.get();
+int main(int argc, char** argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        usage();
+        return 2;
+    }
 
-    return 0;
-}
\ No newline at end of file
+    int exitCode;
+    try {
+        exitCode = run(options);
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        exitCode = 1;
+    }
+
+    if (options.pause) std::cin.get();
+    return exitCode;
+}
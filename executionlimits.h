@@ -0,0 +1,29 @@
+// executionlimits.h
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Caps for running untrusted scripts; zero means no limit. Each applies per
+// callFunction or top-level statement, and a script that runs over one stops
+// with a runtime error, like any other.
+//
+// Checks happen at loop back-edges, calls and array allocations only, so a
+// limit is enforced to within one loop iteration or call, and an unlimited
+// interpreter pays one predictable branch at each of those.
+struct ExecutionLimits {
+    // bytecode instructions, charged a loop body or a function body at a time
+    uint64_t maxOperations = 0;
+    std::chrono::milliseconds timeout{ 0 };
+    size_t maxCallDepth = 0;
+    // array elements and string buffers alive on this thread, plus registers
+    // and globals
+    size_t maxMemory = 0;
+    // the host sets it, from any thread, to stop the script at its next check
+    const std::atomic<bool>* cancel = nullptr;
+
+    bool any() const {
+        return maxOperations || timeout.count() || maxCallDepth || maxMemory || cancel;
+    }
+};
@@ -0,0 +1,823 @@
+// interpreter.cpp
+#include "interpreter.h"
+
+uint32_t Interpreter::slotFor(const std::string& name) {
+    auto it = slotIds.find(name);
+    if (it != slotIds.end()) return it->second;
+    uint32_t id = static_cast<uint32_t>(slots.size());
+    slots.push_back({ name });
+    slotIds.emplace(name, id);
+    return id;
+}
+
+void Interpreter::link(Chunk& chunk) {
+    linkCalls(chunk, [this](const std::string& name) { return slotFor(name); });
+}
+
+const Chunk& Interpreter::chunkFor(uint32_t id) {
+    if (slots[id].chunk) return *slots[id].chunk;
+    if (!slots[id].decl) throw std::runtime_error("Function not found: " + slots[id].name);
+    auto chunk = Compiler().compileFunction(*slots[id].decl);
+    link(*chunk); // may add slots, so index again below
+    slots[id].owned = std::move(chunk);
+    slots[id].chunk = slots[id].owned.get();
+    memoStale = true; // callers may turn out pure now
+    return *slots[id].chunk;
+}
+
+void Interpreter::load(const Program& program) {
+    if (!slots.empty()) throw std::runtime_error("A program can only be loaded into a fresh interpreter");
+    for (const auto& name : program.functionNames()) slotFor(name);
+    for (const auto& unit : program.units()) {
+        if (unit.isFunction) {
+            slots[slotIds.at(unit.chunk->name)].chunk = unit.chunk.get();
+            memoStale = true;
+        }
+        else {
+            run(*unit.chunk, {});
+        }
+    }
+}
+
+// makes v hold type, widening an int to double; false if it can't
+static inline bool coerce(Value& v, StaticType type) {
+    switch (type) {
+    case StaticType::Unknown: return true;
+    case StaticType::Int: return v.isInt();
+    case StaticType::Double:
+        if (v.isInt()) v.setDouble(v.asInt());
+        return v.isDouble();
+    case StaticType::Bool: return v.isBool();
+    case StaticType::Array: return v.isArray();
+    case StaticType::String: return v.isString();
+    }
+    return false;
+}
+
+// for callers that didn't prove their arguments match what the callee's body relies on
+static void coerceArguments(const Chunk& callee, Value* args) {
+    for (size_t i = 0; i < callee.paramTypes.size(); ++i) {
+        if (!coerce(args[i], callee.paramTypes[i])) {
+            throw std::runtime_error("Argument " + std::to_string(i + 1) + " of " + callee.name + " must be " +
+                staticTypeName(callee.paramTypes[i]) + ", got " + valueTypeName(args[i].kind()));
+        }
+    }
+}
+
+Value Interpreter::run(const Chunk& chunk, std::span<const Value> args, uint32_t slot) {
+    if (args.size() != static_cast<size_t>(chunk.numParams)) {
+        throw std::runtime_error("Wrong number of arguments to " + chunk.name + ": expected " +
+            std::to_string(chunk.numParams) + ", got " + std::to_string(args.size()));
+    }
+
+    size_t entryDepth = frames.size();
+    if (limited && entryDepth == 0) {
+        operations = 0;
+        nextPoll = 0;
+        deadline = std::chrono::steady_clock::now() + limits.timeout;
+    }
+    size_t base = frames.empty() ? 0 : frames.back().base + frames.back().chunk->numRegisters;
+    if (registers.size() < base + chunk.numRegisters) registers.resize(base + chunk.numRegisters);
+    for (size_t i = 0; i < args.size(); ++i) {
+        registers[base + i] = args[i];
+        if (args[i].isArray() || args[i].isString()) holdsArrays = true;
+    }
+    coerceArguments(chunk, &registers[base]);
+    if (slot != UINT32_MAX) countCall(slot, entryDepth + 1);
+    if (memoCapacity && slot != UINT32_MAX) {
+        if (const Value* hit = memoLookup(slot, &registers[base], args.size(), entryDepth + 1)) return *hit;
+    }
+
+    if (jit && slot != UINT32_MAX && !profiler && !limited) {
+        JitCode native = jit->hotCall(slot, chunk);
+        if (native && runNative(native, base, 0)) return std::move(registers[base]);
+    }
+
+    frames.push_back({ &chunk, 0, base });
+
+    if (!profiler) {
+        try {
+            if (jit && !limited) return dispatch<false, true>(entryDepth);
+            return dispatch<false>(entryDepth);
+        }
+        catch (...) {
+            frames.resize(entryDepth);
+            dropPendingMemos(entryDepth);
+            throw;
+        }
+    }
+
+    size_t profileDepth = profiler->depth();
+    profiler->enter(chunk);
+    try {
+        return dispatch<true>(entryDepth);
+    }
+    catch (...) {
+        profiler->unwind(profileDepth);
+        frames.resize(entryDepth);
+        dropPendingMemos(entryDepth);
+        throw;
+    }
+}
+
+void Interpreter::flushStats() {
+    if constexpr (!statsEnabled) return;
+    ThreadStats& stats = threadStats();
+    uint64_t calls = 0;
+    for (size_t slot = 0; slot < counts.callsBySlot.size(); ++slot) {
+        uint64_t n = std::exchange(counts.callsBySlot[slot], 0);
+        if (!n) continue;
+        calls += n;
+        stats.addCalls(slots[slot].name, n);
+    }
+    ThreadStats::add(stats.instructions, std::exchange(counts.instructions, 0));
+    ThreadStats::add(stats.calls, calls);
+    ThreadStats::raise(stats.peakFrameDepth, std::exchange(counts.peakFrameDepth, 0));
+    ThreadStats::add(stats.memoHits, std::exchange(counts.memoHits, 0));
+    ThreadStats::add(stats.memoMisses, std::exchange(counts.memoMisses, 0));
+    ThreadStats::raise(stats.peakRegisters, registers.size());
+    ThreadStats::raise(stats.peakGlobals, variables.size());
+}
+
+void Interpreter::callBatch(FunctionHandle function, std::span<const Value> args, std::span<Value> results) {
+    const Chunk& chunk = chunkFor(checkedSlot(function));
+    size_t arity = static_cast<size_t>(chunk.numParams);
+    if (args.size() != results.size() * arity) {
+        throw std::runtime_error("Batch of " + std::to_string(results.size()) + " calls to " + chunk.name +
+            " needs " + std::to_string(results.size() * arity) + " arguments, got " + std::to_string(args.size()));
+    }
+    for (size_t i = 0; i < results.size(); ++i)
+        results[i] = run(chunk, args.subspan(i * arity, arity), function.slot);
+}
+
+// cancel and the deadline are looked at once per this many operations,
+// well under a millisecond of running
+static const uint64_t pollInterval = 1 << 16;
+
+void Interpreter::charge(uint64_t cost) {
+    operations += cost;
+    if (limits.maxOperations && operations > limits.maxOperations)
+        throw std::runtime_error("Operation limit of " + std::to_string(limits.maxOperations) + " exceeded");
+    if (operations < nextPoll) return;
+    nextPoll = operations + pollInterval;
+    if (limits.cancel && limits.cancel->load(std::memory_order_relaxed))
+        throw std::runtime_error("Script cancelled");
+    if (limits.timeout.count() && std::chrono::steady_clock::now() >= deadline)
+        throw std::runtime_error("Time limit of " + std::to_string(limits.timeout.count()) + " ms exceeded");
+}
+
+// a call is charged its callee's length, like one pass over a loop body
+void Interpreter::enterCall(const Chunk& callee) {
+    if (limits.maxCallDepth && frames.size() >= limits.maxCallDepth)
+        throw std::runtime_error("Call depth limit of " + std::to_string(limits.maxCallDepth) + " exceeded in " + callee.name);
+    charge(callee.code.size());
+    checkMemory(callee.numRegisters * sizeof(Value));
+}
+
+void Interpreter::checkMemory(size_t adding) {
+    if (!limits.maxMemory) return;
+    size_t used = liveArrayBytes + liveStringBytes + registers.size() * sizeof(Value) + variables.size() * sizeof(Value);
+    if (used + adding > limits.maxMemory)
+        throw std::runtime_error("Memory limit of " + std::to_string(limits.maxMemory) + " bytes exceeded");
+}
+
+[[noreturn]] static void argumentCountError(const Chunk& callee, int given) {
+    throw std::runtime_error("Wrong number of arguments to " + callee.name + ": expected " +
+        std::to_string(callee.numParams) + ", got " + std::to_string(given));
+}
+
+[[noreturn]] static void typeError(const char* what, const Value& v) {
+    throw std::runtime_error(std::string(what) + ", got " + valueTypeName(v.kind()));
+}
+
+// + when l and r aren't both numbers, so one of them has to be a string
+void Interpreter::concatenate(Value& dst, const Value& l, const Value& r) {
+    if (!l.isString() && !r.isString()) typeError("Expected number operands", l.isNumber() ? r : l);
+    dst = Value::concat(l, r); // l or r may be dst, so the result is built first
+    holdsArrays = true;
+    if (limited) checkMemory(0);
+}
+
+// int op int and double op double are tested first; an int mixed with a
+// double is widened. Int arithmetic wraps, as it does when folded. Operands
+// that aren't two numbers go to otherwise, which for + concatenates.
+template <typename Op, typename Otherwise>
+static inline void arithmetic(Value& dst, const Value& l, const Value& r, Op op, Otherwise otherwise) {
+    if (Value::bothInts(l, r))
+        dst.setInt(static_cast<int>(op(static_cast<unsigned>(l.asInt()), static_cast<unsigned>(r.asInt()))));
+    else if (Value::bothDoubles(l, r))
+        dst.setDouble(op(l.asDouble(), r.asDouble()));
+    else if (l.isNumber() && r.isNumber())
+        dst.setDouble(op(l.toDouble(), r.toDouble()));
+    else
+        otherwise();
+}
+
+template <typename Op>
+static inline void arithmetic(Value& dst, const Value& l, const Value& r, Op op) {
+    arithmetic(dst, l, r, op, [&] { typeError("Expected number operands", l.isNumber() ? r : l); });
+}
+
+template <typename Op>
+static inline void compare(Value& dst, const Value& l, const Value& r, Op op) {
+    if (Value::bothInts(l, r))
+        dst.setBool(op(l.asInt(), r.asInt()));
+    else if (Value::bothDoubles(l, r))
+        dst.setBool(op(l.asDouble(), r.asDouble()));
+    else if (l.isNumber() && r.isNumber())
+        dst.setBool(op(l.toDouble(), r.toDouble()));
+    else
+        typeError("Expected number operands", l.isNumber() ? r : l);
+}
+
+// numbers compare by value, strings by text, arrays by contents; different
+// kinds are never equal
+static inline bool equal(const Value& l, const Value& r) {
+    if (Value::bothInts(l, r)) return l.asInt() == r.asInt();
+    if (l.isNumber() && r.isNumber()) return l.toDouble() == r.toDouble();
+    if (l.kind() != r.kind()) return false;
+    if (l.isBool()) return l.asBool() == r.asBool();
+    if (l.isString()) return l.text() == r.text();
+    return l.items() == r.items();
+}
+
+// l op r on two Values proven to be ints, wrapping as arithmetic does
+template <typename Op>
+static inline int wrapping(const Value& l, const Value& r, Op op) {
+    return static_cast<int>(op(static_cast<unsigned>(l.asInt()), static_cast<unsigned>(r.asInt())));
+}
+
+static void divideSlow(Value& dst, const Value& l, const Value& r) {
+    if (!l.isNumber() || !r.isNumber()) typeError("Expected number operands", l.isNumber() ? r : l);
+    if (!Value::bothInts(l, r)) {
+        dst.setDouble(l.toDouble() / r.toDouble());
+        return;
+    }
+    if (r.asInt() == 0) throw std::runtime_error("Division by zero");
+    // INT_MIN / -1 traps in hardware; wrap it like the other int ops
+    dst.setInt(static_cast<int>(0u - static_cast<unsigned>(l.asInt())));
+}
+
+static inline void divide(Value& dst, const Value& l, const Value& r) {
+    // unsigned(divisor + 1) <= 1 catches both 0 and -1 in one compare
+    if (Value::bothInts(l, r) && static_cast<unsigned>(r.asInt()) + 1 > 1u)
+        dst.setInt(l.asInt() / r.asInt());
+    else
+        divideSlow(dst, l, r);
+}
+
+static size_t checkedIndex(const Value& array, const Value& index) {
+    if (!array.isArray()) typeError("Only arrays can be indexed", array);
+    if (!index.isInt()) typeError("Array index must be an int", index);
+    size_t length = array.items().size();
+    // negative indexes wrap to huge ones, so one compare covers both ends
+    size_t i = static_cast<size_t>(static_cast<unsigned>(index.asInt()));
+    if (i >= length) {
+        throw std::runtime_error("Array index " + std::to_string(index.asInt()) +
+            " out of bounds for length " + std::to_string(length));
+    }
+    return i;
+}
+
+// ForLoop when the index or the bound isn't an int: i = i + step, then the
+// header's comparison, exactly as the loop would have run them
+static bool countedStepSlow(Value& index, const Value& limit, const Value& step, bool inclusive) {
+    arithmetic(index, index, step, [](auto l, auto r) { return l + r; });
+    Value test;
+    if (step.asInt() > 0) {
+        if (inclusive) compare(test, index, limit, [](auto l, auto r) { return l <= r; });
+        else compare(test, index, limit, [](auto l, auto r) { return l < r; });
+    }
+    else {
+        if (inclusive) compare(test, index, limit, [](auto l, auto r) { return l >= r; });
+        else compare(test, index, limit, [](auto l, auto r) { return l > r; });
+    }
+    return test.asBool();
+}
+
+// Counts the instructions one dispatch loop runs into the interpreter's
+// total, however the loop is left. Empty when statsEnabled is off.
+template <bool Enabled>
+struct InstructionCount {
+    explicit InstructionCount(uint64_t&) {}
+    void tick() {}
+};
+
+template <>
+struct InstructionCount<true> {
+    uint64_t executed = 0;
+    uint64_t& total;
+    explicit InstructionCount(uint64_t& total) : total(total) {}
+    ~InstructionCount() { total += executed; }
+    void tick() { ++executed; }
+};
+
+// back edges between looks at whether the running function should be compiled
+static const uint32_t loopCheckInterval = 1024;
+
+// what a frame finishes with once compiled code has run it to its return,
+// which left the result in its first register
+static const Instruction nativeReturn[] = { { OpCode::Return, 0, 0, 0 } };
+
+template <bool Profiling, bool Tiering>
+Value Interpreter::dispatch(size_t entryDepth) {
+    const Chunk* chunk = frames.back().chunk;
+    const Instruction* code = chunk->code.data();
+    size_t pc = frames.back().pc;
+    Value* regs = registers.data() + frames.back().base;
+    const bool budgeted = limited; // a local, so stores through regs can't make the compiler reload it
+    const bool memoizing = memoCapacity != 0;
+    uint32_t backEdges = loopCheckInterval;
+    InstructionCount<statsEnabled> executed(counts.instructions);
+
+    for (;;) {
+        if constexpr (Profiling) profiler->instruction(*chunk, pc);
+        executed.tick();
+        const Instruction& ins = code[pc++];
+        switch (ins.op) {
+        case OpCode::LoadInt:
+            regs[ins.a].setInt(ins.bx());
+            break;
+        case OpCode::LoadConst:
+            regs[ins.a] = chunk->constants[ins.bx()];
+            break;
+        case OpCode::LoadBool:
+            regs[ins.a].setBool(ins.b != 0);
+            break;
+        case OpCode::Move:
+            regs[ins.a] = regs[ins.b];
+            break;
+        case OpCode::Coerce:
+            if (!coerce(regs[ins.a], static_cast<StaticType>(ins.b))) [[unlikely]] {
+                std::string expected = std::string("Expected ") + staticTypeName(static_cast<StaticType>(ins.b));
+                typeError(expected.c_str(), regs[ins.a]);
+            }
+            break;
+        case OpCode::GetGlobal: {
+            auto it = variables.find(chunk->names[ins.b]);
+            if (it == variables.end())
+                throw std::runtime_error("Undefined variable: " + chunk->names[ins.b]);
+            regs[ins.a] = it->second;
+            break;
+        }
+        case OpCode::SetGlobal:
+            variables[chunk->names[ins.b]] = regs[ins.a];
+            break;
+        case OpCode::Add:
+            arithmetic(regs[ins.a], regs[ins.b], regs[ins.c], [](auto l, auto r) { return l + r; },
+                [&] { concatenate(regs[ins.a], regs[ins.b], regs[ins.c]); });
+            break;
+        case OpCode::Sub: arithmetic(regs[ins.a], regs[ins.b], regs[ins.c], [](auto l, auto r) { return l - r; }); break;
+        case OpCode::Mul: arithmetic(regs[ins.a], regs[ins.b], regs[ins.c], [](auto l, auto r) { return l * r; }); break;
+        case OpCode::Div: divide(regs[ins.a], regs[ins.b], regs[ins.c]); break;
+        case OpCode::Less: compare(regs[ins.a], regs[ins.b], regs[ins.c], [](auto l, auto r) { return l < r; }); break;
+        case OpCode::LessEqual: compare(regs[ins.a], regs[ins.b], regs[ins.c], [](auto l, auto r) { return l <= r; }); break;
+        case OpCode::Greater: compare(regs[ins.a], regs[ins.b], regs[ins.c], [](auto l, auto r) { return l > r; }); break;
+        case OpCode::GreaterEqual: compare(regs[ins.a], regs[ins.b], regs[ins.c], [](auto l, auto r) { return l >= r; }); break;
+        case OpCode::Equal: regs[ins.a].setBool(equal(regs[ins.b], regs[ins.c])); break;
+        case OpCode::NotEqual: regs[ins.a].setBool(!equal(regs[ins.b], regs[ins.c])); break;
+        // the checker proved the operand tags, so only the payloads are read
+        case OpCode::AddInt: regs[ins.a].setInt(wrapping(regs[ins.b], regs[ins.c], [](unsigned l, unsigned r) { return l + r; })); break;
+        case OpCode::SubInt: regs[ins.a].setInt(wrapping(regs[ins.b], regs[ins.c], [](unsigned l, unsigned r) { return l - r; })); break;
+        case OpCode::MulInt: regs[ins.a].setInt(wrapping(regs[ins.b], regs[ins.c], [](unsigned l, unsigned r) { return l * r; })); break;
+        case OpCode::DivInt:
+            if (static_cast<unsigned>(regs[ins.c].asInt()) + 1 > 1u) regs[ins.a].setInt(regs[ins.b].asInt() / regs[ins.c].asInt());
+            else divideSlow(regs[ins.a], regs[ins.b], regs[ins.c]);
+            break;
+        case OpCode::LessInt: regs[ins.a].setBool(regs[ins.b].asInt() < regs[ins.c].asInt()); break;
+        case OpCode::LessEqualInt: regs[ins.a].setBool(regs[ins.b].asInt() <= regs[ins.c].asInt()); break;
+        case OpCode::GreaterInt: regs[ins.a].setBool(regs[ins.b].asInt() > regs[ins.c].asInt()); break;
+        case OpCode::GreaterEqualInt: regs[ins.a].setBool(regs[ins.b].asInt() >= regs[ins.c].asInt()); break;
+        case OpCode::AddDouble: regs[ins.a].setDouble(regs[ins.b].asDouble() + regs[ins.c].asDouble()); break;
+        case OpCode::SubDouble: regs[ins.a].setDouble(regs[ins.b].asDouble() - regs[ins.c].asDouble()); break;
+        case OpCode::MulDouble: regs[ins.a].setDouble(regs[ins.b].asDouble() * regs[ins.c].asDouble()); break;
+        case OpCode::DivDouble: regs[ins.a].setDouble(regs[ins.b].asDouble() / regs[ins.c].asDouble()); break;
+        case OpCode::LessDouble: regs[ins.a].setBool(regs[ins.b].asDouble() < regs[ins.c].asDouble()); break;
+        case OpCode::LessEqualDouble: regs[ins.a].setBool(regs[ins.b].asDouble() <= regs[ins.c].asDouble()); break;
+        case OpCode::GreaterDouble: regs[ins.a].setBool(regs[ins.b].asDouble() > regs[ins.c].asDouble()); break;
+        case OpCode::GreaterEqualDouble: regs[ins.a].setBool(regs[ins.b].asDouble() >= regs[ins.c].asDouble()); break;
+        case OpCode::Jump:
+            // jumping back closes a loop iteration, charged the loop's length
+            if (budgeted && ins.bx() < 0) charge(static_cast<uint64_t>(-static_cast<int64_t>(ins.bx())));
+            pc += ins.bx();
+            if (Tiering && ins.bx() < 0 && --backEdges == 0) [[unlikely]] {
+                backEdges = loopCheckInterval;
+                if (enterLoop(*chunk, pc)) {
+                    code = nativeReturn;
+                    pc = 0;
+                }
+                regs = registers.data() + frames.back().base;
+            }
+            break;
+        case OpCode::JumpIfFalse:
+            if (!regs[ins.a].truthy()) pc += ins.bx();
+            break;
+        case OpCode::Call:
+        case OpCode::CallChecked: {
+            uint32_t target = chunk->callTargets[ins.b];
+            const Chunk* cached = slots[target].chunk;
+            const Chunk& callee = cached ? *cached : chunkFor(target);
+            if (ins.c != callee.numParams) argumentCountError(callee, ins.c);
+            if (ins.op == OpCode::CallChecked) coerceArguments(callee, regs + ins.a);
+            if (budgeted) enterCall(callee);
+
+            // the callee's frame starts at the argument registers
+            frames.back().pc = pc;
+            size_t base = frames.back().base + ins.a;
+            if (registers.size() < base + callee.numRegisters) registers.resize(base + callee.numRegisters);
+            countCall(target, frames.size() + 1);
+            if (memoizing) [[unlikely]] {
+                if (const Value* hit = memoLookup(target, &registers[base], ins.c, frames.size() + 1)) {
+                    regs = registers.data() + frames.back().base; // the resize may have moved them
+                    regs[ins.a] = *hit;
+                    break;
+                }
+            }
+            if constexpr (Tiering) {
+                JitCode native = jit->hotCall(target, callee);
+                if (native && runNative(native, base, 0)) {
+                    regs = registers.data() + frames.back().base;
+                    break;
+                }
+            }
+            frames.push_back({ &callee, 0, base });
+            if constexpr (Profiling) profiler->enter(callee);
+
+            chunk = &callee;
+            code = chunk->code.data();
+            pc = 0;
+            regs = registers.data() + base;
+            break;
+        }
+        case OpCode::TailCall:
+        case OpCode::TailCallChecked: {
+            uint32_t target = chunk->callTargets[ins.b];
+            const Chunk* cached = slots[target].chunk;
+            const Chunk& callee = cached ? *cached : chunkFor(target);
+            if (ins.c != callee.numParams) argumentCountError(callee, ins.c);
+            if (ins.op == OpCode::TailCallChecked) coerceArguments(callee, regs + ins.a);
+            if (budgeted) charge(callee.code.size()); // the frame is reused, so no deeper
+            countCall(target, frames.size());
+
+            // the arguments become this frame's first registers, and the
+            // callee returns straight to our caller
+            for (uint16_t i = 0; i < ins.c; ++i) regs[i] = std::move(regs[ins.a + i]);
+            if (holdsArrays) {
+                for (int i = ins.c; i < chunk->numRegisters; ++i) regs[i].clear();
+            }
+            CallFrame& frame = frames.back();
+            if (registers.size() < frame.base + callee.numRegisters) {
+                registers.resize(frame.base + callee.numRegisters);
+                regs = registers.data() + frame.base;
+            }
+            frame.chunk = &callee;
+            if constexpr (Profiling) {
+                profiler->leave();
+                profiler->enter(callee);
+            }
+
+            chunk = &callee;
+            code = chunk->code.data();
+            pc = 0;
+            // a tail call is a loop back to the callee's start
+            if (Tiering && --backEdges == 0) [[unlikely]] {
+                backEdges = loopCheckInterval;
+                if (enterLoop(*chunk, pc)) code = nativeReturn;
+                regs = registers.data() + frame.base;
+            }
+            break;
+        }
+        case OpCode::NewArray: {
+            if (budgeted) checkMemory(ins.c * sizeof(int));
+            std::vector<int> items(ins.c);
+            for (uint16_t i = 0; i < ins.c; ++i) {
+                const Value& element = regs[ins.b + i];
+                if (!element.isInt()) typeError("Array elements must be ints", element);
+                items[i] = element.asInt();
+            }
+            regs[ins.a] = Value::array(std::move(items));
+            holdsArrays = true;
+            break;
+        }
+        case OpCode::AllocArray: {
+            const Value& size = regs[ins.b];
+            if (!size.isInt()) typeError("array() takes an int size", size);
+            if (size.asInt() < 0) throw std::runtime_error("array() size must not be negative");
+            if (budgeted) checkMemory(static_cast<size_t>(size.asInt()) * sizeof(int));
+            regs[ins.a] = Value::array(std::vector<int>(static_cast<size_t>(size.asInt())));
+            holdsArrays = true;
+            break;
+        }
+        case OpCode::Length: {
+            const Value& value = regs[ins.b];
+            if (value.isArray()) regs[ins.a].setInt(static_cast<int>(value.items().size()));
+            else if (value.isString()) regs[ins.a].setInt(static_cast<int>(value.text().size()));
+            else typeError("len() takes an array or a string", value);
+            break;
+        }
+        case OpCode::GetIndex: {
+            size_t i = checkedIndex(regs[ins.b], regs[ins.c]);
+            regs[ins.a].setInt(regs[ins.b].items()[i]);
+            break;
+        }
+        case OpCode::GetIndexUnchecked:
+            regs[ins.a].setInt(regs[ins.b].items()[static_cast<size_t>(regs[ins.c].asInt())]);
+            break;
+        case OpCode::SetIndex: {
+            size_t i = checkedIndex(regs[ins.a], regs[ins.b]);
+            if (!regs[ins.c].isInt()) typeError("Array elements must be ints", regs[ins.c]);
+            regs[ins.a].mutableItems()[i] = regs[ins.c].asInt();
+            break;
+        }
+        case OpCode::SetGlobalIndex: {
+            auto it = variables.find(chunk->names[ins.b]);
+            if (it == variables.end())
+                throw std::runtime_error("Undefined variable: " + chunk->names[ins.b]);
+            size_t i = checkedIndex(it->second, regs[ins.c]);
+            if (!regs[ins.a].isInt()) typeError("Array elements must be ints", regs[ins.a]);
+            it->second.mutableItems()[i] = regs[ins.a].asInt();
+            break;
+        }
+        case OpCode::ForIter: {
+            const Value& array = regs[ins.a];
+            if (!array.isArray()) typeError("for-in needs an array", array);
+            int next = regs[ins.a + 1].asInt();
+            if (static_cast<size_t>(next) < array.items().size()) {
+                regs[ins.a + 2].setInt(array.items()[next]);
+                regs[ins.a + 1].setInt(next + 1);
+            }
+            else {
+                pc += ins.bx();
+            }
+            break;
+        }
+        case OpCode::ForLoop:
+        case OpCode::ForLoopInclusive: {
+            const Value& limit = regs[ins.a];
+            int step = regs[ins.a + 1].asInt();
+            Value& index = regs[ins.a + 2];
+            bool inclusive = ins.op == OpCode::ForLoopInclusive;
+            bool again;
+            if (Value::bothInts(index, limit)) [[likely]] {
+                // wraps like the Add it stands for
+                int next = static_cast<int>(static_cast<unsigned>(index.asInt()) + static_cast<unsigned>(step));
+                index.setInt(next);
+                if (step > 0) again = inclusive ? next <= limit.asInt() : next < limit.asInt();
+                else again = inclusive ? next >= limit.asInt() : next > limit.asInt();
+            }
+            else {
+                again = countedStepSlow(index, limit, regs[ins.a + 1], inclusive);
+            }
+            if (again) {
+                if (budgeted) charge(static_cast<uint64_t>(-static_cast<int64_t>(ins.bx())));
+                pc += ins.bx();
+                if (Tiering && ins.bx() < 0 && --backEdges == 0) [[unlikely]] {
+                    backEdges = loopCheckInterval;
+                    if (enterLoop(*chunk, pc)) {
+                        code = nativeReturn;
+                        pc = 0;
+                    }
+                    regs = registers.data() + frames.back().base;
+                }
+            }
+            break;
+        }
+        case OpCode::Print:
+            output.writeValue(regs[ins.a]);
+            output.put('\n');
+            break;
+        case OpCode::Return: {
+            // a frame starts at the caller's argument registers, so the
+            // caller finds the result in this frame's first register
+            if (ins.a != 0) regs[0] = std::move(regs[ins.a]);
+            // dead registers would otherwise keep arrays shared and force copies on write
+            if (holdsArrays) {
+                for (int i = 1; i < chunk->numRegisters; ++i) regs[i].clear();
+            }
+            if (memoizing && !pendingMemos.empty() && pendingMemos.back().depth == frames.size()) [[unlikely]]
+                memoReturn(regs[0]);
+            frames.pop_back();
+            if constexpr (Profiling) profiler->leave();
+            if (frames.size() == entryDepth) return std::move(regs[0]);
+
+            CallFrame& caller = frames.back();
+            chunk = caller.chunk;
+            code = chunk->code.data();
+            pc = caller.pc;
+            regs = registers.data() + caller.base;
+            break;
+        }
+        case OpCode::Error:
+            throw std::runtime_error(chunk->names[ins.b]);
+        }
+    }
+}
+
+// Everything compiled code can't do inline. Generated frames have no unwind
+// information, so nothing may throw through them: each helper catches and
+// hands the error back in ctx->error for runNative to rethrow.
+struct NativeHelpers {
+    template <typename Body>
+    static int guarded(JitContext* ctx, Body body) {
+        try {
+            return body();
+        }
+        catch (...) {
+            ctx->error = std::current_exception();
+            return jitThrew;
+        }
+    }
+
+    static int release(JitContext* ctx, size_t base, uint32_t x, uint32_t) {
+        ctx->registers[base + x].clear();
+        return 0;
+    }
+
+    static int move(JitContext* ctx, size_t base, uint32_t x, uint32_t y) {
+        ctx->registers[base + x] = ctx->registers[base + y];
+        return 0;
+    }
+
+    static int binary(JitContext* ctx, size_t base, uint32_t x, uint32_t y) {
+        return guarded(ctx, [&] {
+            Value* regs = ctx->registers + base;
+            Value& dst = regs[x & 0xFFFF];
+            const Value& left = regs[y & 0xFFFF];
+            const Value& right = regs[y >> 16];
+            switch (static_cast<OpCode>(x >> 16)) {
+            case OpCode::Add:
+                arithmetic(dst, left, right, [](auto l, auto r) { return l + r; },
+                    [&] { ctx->owner->concatenate(dst, left, right); });
+                break;
+            case OpCode::Sub: arithmetic(dst, left, right, [](auto l, auto r) { return l - r; }); break;
+            case OpCode::Mul: arithmetic(dst, left, right, [](auto l, auto r) { return l * r; }); break;
+            case OpCode::Div: divide(dst, left, right); break;
+            case OpCode::DivInt: divideSlow(dst, left, right); break;
+            case OpCode::Less: compare(dst, left, right, [](auto l, auto r) { return l < r; }); break;
+            case OpCode::LessEqual: compare(dst, left, right, [](auto l, auto r) { return l <= r; }); break;
+            case OpCode::Greater: compare(dst, left, right, [](auto l, auto r) { return l > r; }); break;
+            case OpCode::GreaterEqual: compare(dst, left, right, [](auto l, auto r) { return l >= r; }); break;
+            case OpCode::Equal: dst.setBool(equal(left, right)); break;
+            case OpCode::NotEqual: dst.setBool(!equal(left, right)); break;
+            default: throw std::runtime_error("Compiled code reached an unexpected instruction");
+            }
+            return 0;
+        });
+    }
+
+    static int truthy(JitContext* ctx, size_t base, uint32_t x, uint32_t) {
+        return ctx->registers[base + x].truthy() ? 1 : 0;
+    }
+
+    static int forLoop(JitContext* ctx, size_t base, uint32_t x, uint32_t y) {
+        return guarded(ctx, [&] {
+            Value* regs = ctx->registers + base + x;
+            return countedStepSlow(regs[2], regs[0], regs[1], y != 0) ? 1 : 0;
+        });
+    }
+
+    static int coerce(JitContext* ctx, size_t base, uint32_t x, uint32_t y) {
+        return guarded(ctx, [&] {
+            Value& v = ctx->registers[base + x];
+            if (!::coerce(v, static_cast<StaticType>(y))) {
+                std::string expected = std::string("Expected ") + staticTypeName(static_cast<StaticType>(y));
+                typeError(expected.c_str(), v);
+            }
+            return 0;
+        });
+    }
+
+    static int call(JitContext* ctx, size_t base, uint32_t x, uint32_t y) {
+        return guarded(ctx, [&] {
+            ctx->owner->callFromNative(base + (x & 0xFFFF), static_cast<uint16_t>(x >> 16), y & 0x7FFFFFFF, (y >> 31) != 0);
+            return 0;
+        });
+    }
+
+    static int clear(JitContext* ctx, size_t base, uint32_t x, uint32_t y) {
+        for (uint32_t i = x; i < y; ++i) ctx->registers[base + i].clear();
+        return 0;
+    }
+
+    static int print(JitContext* ctx, size_t base, uint32_t x, uint32_t) {
+        return guarded(ctx, [&] {
+            ctx->owner->output.writeValue(ctx->registers[base + x]);
+            ctx->owner->output.put('\n');
+            return 0;
+        });
+    }
+};
+
+void Interpreter::setJit(bool on) {
+    if (!on || !Jit::available()) {
+        jit.reset();
+        return;
+    }
+    if (jit) return;
+    JitHelpers helpers{ NativeHelpers::release, NativeHelpers::move, NativeHelpers::binary, NativeHelpers::truthy,
+        NativeHelpers::forLoop, NativeHelpers::coerce, NativeHelpers::call, NativeHelpers::clear, NativeHelpers::print };
+    jit = std::make_unique<Jit>(*this, holdsArrays, helpers);
+    memoStale = true; // so memoized functions are kept out of it
+}
+
+void Interpreter::setMemoize(size_t capacity) {
+    memoCapacity = capacity;
+    memos.clear();
+    memoStale = true;
+}
+
+Interpreter::MemoCounts Interpreter::memoCounts(FunctionHandle function) const {
+    uint32_t slot = checkedSlot(function);
+    if (slot >= memos.size() || !memos[slot]) return {};
+    return { memos[slot]->hits, memos[slot]->misses };
+}
+
+// A cache for every pure function, in place of any from before: a changed
+// function may have changed what its callers return.
+void Interpreter::makeMemos() {
+    memoStale = false;
+    std::vector<const Chunk*> chunks(slots.size());
+    for (size_t slot = 0; slot < slots.size(); ++slot) chunks[slot] = slots[slot].chunk; // uncompiled counts as missing
+    std::vector<bool> pure = pureFunctions(chunks);
+    memos.clear();
+    memos.resize(slots.size());
+    for (uint32_t slot = 0; slot < slots.size(); ++slot) {
+        if (!pure[slot]) continue;
+        memos[slot] = std::make_unique<MemoTable>(memoCapacity);
+        if (jit) jit->exclude(slot);
+    }
+}
+
+const Value* Interpreter::memoLookup(uint32_t slot, const Value* args, size_t count, size_t depth) {
+    if (memoStale) makeMemos();
+    MemoTable* table = slot < memos.size() ? memos[slot].get() : nullptr;
+    if (!table) return nullptr;
+    std::span<const Value> key(args, count);
+    const Value* hit = table->find(key);
+    if constexpr (statsEnabled) ++(hit ? counts.memoHits : counts.memoMisses);
+    if (!hit) pendingMemos.push_back({ depth, slot, std::vector<Value>(key.begin(), key.end()) });
+    return hit;
+}
+
+// the frame of pendingMemos.back() returns result
+void Interpreter::memoReturn(const Value& result) {
+    PendingMemo& pending = pendingMemos.back();
+    if (pending.slot < memos.size() && memos[pending.slot]) memos[pending.slot]->insert(std::move(pending.args), result);
+    pendingMemos.pop_back();
+}
+
+// Runs the frame at base in compiled code, from pc to its return, leaving
+// the result in registers[base]. False if it didn't start: the machine stack
+// is as deep as it may go, or pc isn't where a loop starts.
+bool Interpreter::runNative(JitCode native, size_t base, uint32_t pc) {
+    JitContext& ctx = jit->context();
+    if (ctx.depth >= ctx.maxDepth) return false;
+    ctx.registers = registers.data();
+    ctx.registerCount = registers.size();
+    ctx.depth++;
+    int status = native(&ctx, base, pc);
+    ctx.depth--;
+    if (status == jitThrew) std::rethrow_exception(std::exchange(ctx.error, nullptr));
+    return status == 0;
+}
+
+// a loop of chunk, the function in the top frame, has run a while
+bool Interpreter::enterLoop(const Chunk& chunk, size_t pc) {
+    auto it = slotIds.find(chunk.name);
+    if (it == slotIds.end() || slots[it->second].chunk != &chunk) return false; // a top-level statement
+    JitCode native = jit->hotLoop(it->second, chunk);
+    return native && runNative(native, frames.back().base, static_cast<uint32_t>(pc));
+}
+
+// A call compiled code couldn't make itself, with the arguments at base:
+// the callee isn't compiled, takes other types, or needs more registers.
+void Interpreter::callFromNative(size_t base, uint16_t argc, uint32_t target, bool checked) {
+    const Chunk* cached = slots[target].chunk;
+    const Chunk& callee = cached ? *cached : chunkFor(target);
+    if (argc != callee.numParams) argumentCountError(callee, argc);
+    if (checked) coerceArguments(callee, &registers[base]);
+    if (registers.size() < base + callee.numRegisters) registers.resize(base + callee.numRegisters);
+    countCall(target, frames.size() + 1);
+
+    const Value* hit = memoCapacity ? memoLookup(target, &registers[base], argc, frames.size() + 1) : nullptr;
+    JitCode native = hit ? nullptr : jit->hotCall(target, callee);
+    if (hit) {
+        registers[base] = *hit;
+    }
+    else if (!native || !runNative(native, base, 0)) {
+        size_t entryDepth = frames.size();
+        frames.push_back({ &callee, 0, base });
+        try {
+            Value result = dispatch<false, true>(entryDepth);
+            registers[base] = std::move(result);
+        }
+        catch (...) {
+            frames.resize(entryDepth);
+            dropPendingMemos(entryDepth);
+            throw;
+        }
+    }
+    JitContext& ctx = jit->context();
+    ctx.registers = registers.data();
+    ctx.registerCount = registers.size();
+}
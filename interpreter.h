@@ -1,157 +1,253 @@
+#pragma once
+#include <chrono>
 #include <unordered_map>
 #include <string>
 #include <memory>
+#include <span>
 #include <vector>
 #include <stdexcept>
-#include <iostream>
 
+#include "parser.h"
+#include "compiler.h"
+#include "executionlimits.h"
+#include "jit.h"
+#include "memo.h"
+#include "value.h"
+#include "output.h"
+#include "profiler.h"
+#include "program.h"
+#include "stats.h"
+
+// One execution context: globals, registers, frames and output. Not shared
+// between threads; run one per thread over a shared Program instead.
 class Interpreter {
 public:
-    std::unordered_map<std::string, int> variables;
-    std::unordered_map<std::string, std::shared_ptr<FunctionDecl>> functions;
+    Interpreter() = default;
+    ~Interpreter() { flushStats(); }
+    Interpreter(const Interpreter&) = delete;
+    Interpreter& operator=(const Interpreter&) = delete;
+
+    // declarations are owned by the parser's arena, which must outlive the interpreter's use of them
+    void addFunction(const std::string& name, const FunctionDecl* func) {
+        // call sites hold the slot, so emptying it is enough to reach every caller
+        uint32_t id = slotFor(name);
+        FunctionSlot& slot = slots[id];
+        slot.decl = func;
+        slot.chunk = nullptr;
+        slot.owned.reset();
+        if (jit) jit->forget(id);
+        memoStale = true;
+    }
+
+    // Installs a compiled body the caller owns and keeps alive while it is
+    // installed. Links it, then swaps it in with one store, so every call
+    // site reaches the new body on its next call.
+    void addFunction(Chunk& chunk) {
+        link(chunk);
+        uint32_t id = slotFor(chunk.name);
+        FunctionSlot& slot = slots[id];
+        slot.decl = nullptr;
+        slot.chunk = &chunk;
+        slot.owned.reset();
+        if (jit) jit->forget(id);
+        memoStale = true;
+    }
+
+    // callers get "Function not found" until it is defined again
+    void removeFunction(const std::string& name) {
+        auto it = slotIds.find(name);
+        if (it == slotIds.end()) return;
+        FunctionSlot& slot = slots[it->second];
+        slot.decl = nullptr;
+        slot.chunk = nullptr;
+        slot.owned.reset();
+        if (jit) jit->forget(it->second);
+        memoStale = true;
+    }
+
+    // Defines the program's functions and runs its top-level statements, in
+    // source order. Only for a fresh interpreter, whose function numbering
+    // then matches the program's; the program must outlive it.
+    void load(const Program& program);
 
-    void addFunction(const std::string& name, const std::shared_ptr<FunctionDecl>& func) {
-        functions[name] = func;
+    bool hasFunction(const std::string& name) const {
+        auto it = slotIds.find(name);
+        return it != slotIds.end() && (slots[it->second].decl || slots[it->second].chunk);
     }
 
-    int callFunction(const std::string& name, const std::vector<int>& args) {
-        if (functions.count(name) == 0)
+    // null if the global was never assigned
+    const Value* global(const std::string& name) const {
+        auto it = variables.find(name);
+        return it == variables.end() ? nullptr : &it->second;
+    }
+    void setGlobal(const std::string& name, Value value) { variables[name] = std::move(value); }
+
+    // print() output is buffered; it reaches the sink when the buffer fills,
+    // on flushOutput(), or when the interpreter is destroyed
+    void setOutput(OutputSink& sink) { output.setSink(sink); }
+    void flushOutput() { output.flush(); }
+
+    // null detaches; takes effect from the next callFunction or statement
+    void setProfiler(Profiler* next) { profiler = next; }
+
+    // takes effect from the next callFunction or statement
+    void setLimits(const ExecutionLimits& next) {
+        limits = next;
+        limited = next.any();
+    }
+
+    // Adds what this interpreter has counted since the last flush to its
+    // thread's ThreadStats, where collectStats finds it. The destructor
+    // flushes too; counting itself stays in plain members until then.
+    void flushStats();
+
+    // On: hot functions are compiled to machine code, where Jit::available().
+    // Takes effect from the next callFunction or statement; runs with a
+    // profiler or limits stay interpreted, as compiled code has no hooks for them.
+    void setJit(bool on);
+
+    // capacity > 0: a call of a pure function (see pureFunctions) is answered
+    // from that function's cache when the same arguments were seen before,
+    // so a recursion that repeats subproblems solves each once. Each cache
+    // keeps up to capacity results. 0 turns memoizing off and drops the
+    // caches, as does redefining any function, since callers may depend on
+    // it. A tail call isn't looked up, but the call it finishes is cached.
+    // Memoized functions stay interpreted, so their cache sees every call.
+    void setMemoize(size_t capacity);
+
+    struct MemoCounts {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+    };
+    // since the cache of function was made; zero if it has none
+    MemoCounts memoCounts(FunctionHandle function) const;
+
+    Value callFunction(const std::string& name, std::span<const Value> args) {
+        auto it = slotIds.find(name);
+        if (it == slotIds.end() || (!slots[it->second].decl && !slots[it->second].chunk))
             throw std::runtime_error("Function not found: " + name);
-        return execFunction(functions[name], args);
+        return run(chunkFor(it->second), args, it->second);
+    }
+
+    // the same check callFunction makes, done once
+    FunctionHandle function(const std::string& name) const {
+        if (!hasFunction(name)) throw std::runtime_error("Function not found: " + name);
+        return { slotIds.at(name) };
     }
 
-    // expects iterable to be a variable holding a std::vector<int>
-    std::vector<int> evalArray(const std::shared_ptr<ASTNode>& node) {
-        // For now, just support variable lookup for arrays
-        if (auto ident = std::dynamic_pointer_cast<Identifier>(node)) {
-            // you would need to extend your interpreter to support arrays
-            throw std::runtime_error("Array support not implemented yet for: " + ident->name);
-        }
-        throw std::runtime_error("Unsupported iterable type");
+    // Calls without a name lookup; once the interpreter's registers and
+    // frames have grown to fit, without allocating either.
+    Value call(FunctionHandle function, std::span<const Value> args) {
+        return run(chunkFor(checkedSlot(function)), args, function.slot);
     }
 
-    void execStatement(const std::shared_ptr<ASTNode>& stmt) {
-        if (auto forStmt = std::dynamic_pointer_cast<ForStmt>(stmt)) {
-            for (execStatement(forStmt->init); evalExpr(forStmt->condition); execStatement(forStmt->increment)) {
-                for (auto& s : forStmt->body) execStatement(s);
-            }
-        }
-        else if (auto whileStmt = std::dynamic_pointer_cast<WhileStmt>(stmt)) {
-            while (evalExpr(whileStmt->condition)) {
-                for (auto& s : whileStmt->body) execStatement(s);
-            }
-        }
-        else if (auto forEach = std::dynamic_pointer_cast<ForEachStmt>(stmt)) {
-            auto arr = evalArray(forEach->iterable); // Implemented above
-            for (auto val : arr) {
-                variables[forEach->varName] = val;
-                for (auto& s : forEach->body) execStatement(s);
-            }
-        }
-        else if (auto call = std::dynamic_pointer_cast<CallExpr>(stmt)) {
-            std::vector<int> argvals;
-            for (auto& arg : call->args) argvals.push_back(evalExpr(arg));
-            callFunction(call->funcName, argvals);
-        }
-        else if (auto print = std::dynamic_pointer_cast<PrintStmt>(stmt)) {
-            int val = evalExpr(print->expression);
-            std::cout << val << std::endl;
-        }
-        else if (auto var = std::dynamic_pointer_cast<VarDecl>(stmt)) {
-            variables[var->name] = evalExpr(var->initializer);
-        }
-        else if (auto assign = std::dynamic_pointer_cast<AssignStmt>(stmt)) {
-            variables[assign->name] = evalExpr(assign->value);
-        }
-        else if (auto exprStmt = std::dynamic_pointer_cast<ExpressionStmt>(stmt)) {
-            evalExpr(exprStmt->expr);
-        }
-        else if (auto ret = std::dynamic_pointer_cast<ReturnStmt>(stmt)) {
-            evalExpr(ret->expression);
-        }
-        else {
-            throw std::runtime_error("Unsupported statement at top level");
-        }
+    // Calls function once per argument tuple: args holds them back to back,
+    // each as many values as the function has parameters, and results[i]
+    // gets what call i returned. The function is resolved and its arity
+    // checked once for the whole batch. Stops at the first call that throws;
+    // results before it are filled in.
+    void callBatch(FunctionHandle function, std::span<const Value> args, std::span<Value> results);
+
+    void execStatement(const ASTNode* stmt) {
+        auto chunk = Compiler().compileStatement(stmt);
+        link(*chunk);
+        run(*chunk, {});
     }
 
-    int evalExpr(const std::shared_ptr<ASTNode>& node) {
-        if (auto ident = std::dynamic_pointer_cast<Identifier>(node)) {
-            if (variables.count(ident->name)) return variables[ident->name];
-            throw std::runtime_error("Undefined variable: " + ident->name);
-        }
-        if (auto bin = std::dynamic_pointer_cast<BinaryExpr>(node)) {
-            int left = evalExpr(bin->left);
-            int right = evalExpr(bin->right);
-            
-            if (bin->op == "+") return left + right;
-            if (bin->op == "-") return left - right;
-            if (bin->op == "*") return left * right;
-            if (bin->op == "/") return left / right;
-            if (bin->op == "<") return left < right;
-            if (bin->op == "<=") return left <= right;
-            if (bin->op == ">") return left > right;
-            if (bin->op == ">=") return left >= right;
-            throw std::runtime_error("Unsupported operator: " + bin->op);
-        }
-        if (auto num = std::dynamic_pointer_cast<NumberLiteral>(node)) {
-            return num->value;
-        }
-        if (auto call = std::dynamic_pointer_cast<CallExpr>(node)) {
-            std::vector<int> argvals;
-            for (auto& arg : call->args) argvals.push_back(evalExpr(arg));
-            return callFunction(call->funcName, argvals);
-        }
-        throw std::runtime_error("Unknown expression type");
+    Value evalExpr(const ASTNode* node) {
+        auto chunk = Compiler().compileExpression(node);
+        link(*chunk);
+        return run(*chunk, {});
     }
 
-    int execFunction(const std::shared_ptr<FunctionDecl>& func, const std::vector<int>& args) {
-        std::unordered_map<std::string, int> savedVariables = variables;
-        for (size_t i = 0; i < func->params.size(); ++i) {
-            variables[func->params[i].first] = args[i];
-        }
-        int returnValue = 0;
-        for (auto& stmt : func->body) {
-            if (auto print = std::dynamic_pointer_cast<PrintStmt>(stmt)) {
-                int val = evalExpr(print->expression);
-                std::cout << val << std::endl;
-            }
-            else if (auto ret = std::dynamic_pointer_cast<ReturnStmt>(stmt)) {
-                returnValue = evalExpr(ret->expression);
-                break;
-            }
-            else if (auto var = std::dynamic_pointer_cast<VarDecl>(stmt)) {
-                variables[var->name] = evalExpr(var->initializer);
-            }
-            else if (auto assign = std::dynamic_pointer_cast<AssignStmt>(stmt)) {
-                variables[assign->name] = evalExpr(assign->value);
-            }
-            else if (auto exprStmt = std::dynamic_pointer_cast<ExpressionStmt>(stmt)) {
-                evalExpr(exprStmt->expr);
-            }
-            else if (auto forStmt = std::dynamic_pointer_cast<ForStmt>(stmt)) {
-                for (execStatement(forStmt->init); evalExpr(forStmt->condition); execStatement(forStmt->increment)) {
-                    for (auto& s : forStmt->body) execStatement(s);
-                }
-            }
-            else if (auto whileStmt = std::dynamic_pointer_cast<WhileStmt>(stmt)) {
-                while (evalExpr(whileStmt->condition)) {
-                    for (auto& s : whileStmt->body) execStatement(s);
-                }
-            }
-            else if (auto forEach = std::dynamic_pointer_cast<ForEachStmt>(stmt)) {
-                auto arr = evalArray(forEach->iterable); // Implemented above
-                for (auto val : arr) {
-                    variables[forEach->varName] = val;
-                    for (auto& s : forEach->body) execStatement(s);
-                }
-            }
-            else if (auto call = std::dynamic_pointer_cast<CallExpr>(stmt)) {
-                std::vector<int> argvals;
-                for (auto& arg : call->args) argvals.push_back(evalExpr(arg));
-                callFunction(call->funcName, argvals);
-            }
-        }
-        variables = savedVariables;
-        return returnValue;
+private:
+    friend struct NativeHelpers; // what compiled code calls back into
+
+    struct CallFrame {
+        const Chunk* chunk;
+        size_t pc;
+        size_t base;
+    };
+
+    // a call that missed its function's cache, stored when its frame returns
+    struct PendingMemo {
+        size_t depth; // frames.size() while the callee runs
+        uint32_t slot;
+        std::vector<Value> args;
+    };
+
+    // One per function name, created by the first definition or call site that
+    // mentions it. The body is compiled on first call and dropped on redefinition;
+    // functions from a Program arrive with a body it owns and no declaration.
+    struct FunctionSlot {
+        std::string name;
+        const FunctionDecl* decl = nullptr;
+        const Chunk* chunk = nullptr;
+        std::unique_ptr<Chunk> owned; // set when compiled here from decl
+    };
+
+    std::unordered_map<std::string, Value> variables;
+    std::vector<FunctionSlot> slots;
+    std::unordered_map<std::string, uint32_t> slotIds;
+    std::vector<Value> registers;  // every frame's slots, contiguous
+    std::vector<CallFrame> frames;
+    Output output{ standardOutput() };
+    Profiler* profiler = nullptr;
+    bool holdsArrays = false;    // set once any array or string buffer exists; until then returns skip clearing
+    std::unique_ptr<Jit> jit;    // null unless setJit(true)
+    size_t memoCapacity = 0;     // 0 unless setMemoize
+    bool memoStale = true;       // functions changed since the caches were made
+    std::vector<std::unique_ptr<MemoTable>> memos; // by slot, null unless the function is pure
+    std::vector<PendingMemo> pendingMemos;
+
+    // what flushStats hands on; untouched unless statsEnabled
+    struct Counts {
+        uint64_t instructions = 0;
+        uint64_t peakFrameDepth = 0;
+        uint64_t memoHits = 0;
+        uint64_t memoMisses = 0;
+        std::vector<uint64_t> callsBySlot;
+    } counts;
+
+    ExecutionLimits limits;
+    bool limited = false;        // any limit set, so dispatch has to charge its work
+    uint64_t operations = 0;     // charged since the outermost run() began
+    uint64_t nextPoll = 0;       // when to look at the clock and the cancel flag again
+    std::chrono::steady_clock::time_point deadline;
+
+    uint32_t slotFor(const std::string& name);
+    uint32_t checkedSlot(FunctionHandle function) const {
+        if (function.slot >= slots.size()) throw std::runtime_error("Function handle from another program");
+        return function.slot;
+    }
+    void link(Chunk& chunk);
+    const Chunk& chunkFor(uint32_t slot);
+    void charge(uint64_t cost);
+    void enterCall(const Chunk& callee);
+    void checkMemory(size_t adding);
+    void concatenate(Value& dst, const Value& l, const Value& r);
+    void makeMemos();
+    // slot's cached result for args, or null after noting the call as pending at depth
+    const Value* memoLookup(uint32_t slot, const Value* args, size_t count, size_t depth);
+    void memoReturn(const Value& result);
+    // for frames above depth, which an exception unwound
+    void dropPendingMemos(size_t depth) {
+        while (!pendingMemos.empty() && pendingMemos.back().depth > depth) pendingMemos.pop_back();
+    }
+    // depth: frames with the callee's, once it is running
+    void countCall(uint32_t slot, size_t depth) {
+        if constexpr (!statsEnabled) return;
+        if (slot >= counts.callsBySlot.size()) counts.callsBySlot.resize(slots.size());
+        ++counts.callsBySlot[slot];
+        if (depth > counts.peakFrameDepth) counts.peakFrameDepth = depth;
     }
-};
\ No newline at end of file
+    // slot: where chunk is installed, if it is a function, so it can be compiled once hot
+    Value run(const Chunk& chunk, std::span<const Value> args, uint32_t slot = UINT32_MAX);
+    bool runNative(JitCode native, size_t base, uint32_t pc);
+    bool enterLoop(const Chunk& chunk, size_t pc);
+    void callFromNative(size_t base, uint16_t argc, uint32_t target, bool checked);
+    // instantiated with and without profiler hooks, so an unprofiled run pays
+    // nothing for them; and with tiering up to the Jit, for runs without limits
+    template <bool Profiling, bool Tiering = false>
+    Value dispatch(size_t entryDepth);
+};
@@ -0,0 +1,703 @@
+// jit.cpp
+#include "jit.h"
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define JIT_X64 1
+#endif
+
+#ifdef _WIN32
+
+ExecutableMemory::ExecutableMemory(const std::vector<uint8_t>& code) : size(code.size()) {
+    memory = VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!memory) throw std::runtime_error("Cannot allocate executable memory");
+    std::memcpy(memory, code.data(), size);
+    DWORD previous;
+    if (!VirtualProtect(memory, size, PAGE_EXECUTE_READ, &previous)) {
+        VirtualFree(memory, 0, MEM_RELEASE);
+        throw std::runtime_error("Cannot make memory executable");
+    }
+    FlushInstructionCache(GetCurrentProcess(), memory, size);
+}
+
+ExecutableMemory::~ExecutableMemory() {
+    VirtualFree(memory, 0, MEM_RELEASE);
+}
+
+#else
+
+ExecutableMemory::ExecutableMemory(const std::vector<uint8_t>& code) : size(code.size()) {
+    void* pages = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pages == MAP_FAILED) throw std::runtime_error("Cannot allocate executable memory");
+    std::memcpy(pages, code.data(), size);
+    if (mprotect(pages, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(pages, size);
+        throw std::runtime_error("Cannot make memory executable");
+    }
+    memory = pages;
+}
+
+ExecutableMemory::~ExecutableMemory() {
+    munmap(memory, size);
+}
+
+#endif
+
+namespace {
+
+enum Reg { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+enum Cond { Below = 2, AboveEqual = 3, Zero = 4, NonZero = 5, BelowEqual = 6, Above = 7, Sign = 8,
+    Less = 0xC, GreaterEqual = 0xD, LessEqual = 0xE, Greater = 0xF };
+
+// the first four integer arguments of a C call
+#ifdef _WIN32
+const Reg argRegs[4] = { RCX, RDX, R8, R9 };
+#else
+const Reg argRegs[4] = { RDI, RSI, RDX, RCX };
+#endif
+
+// Just the x86-64 encodings the code generator uses. Memory operands are
+// always [base + disp32]; jumps are always rel32 to a label, patched at the end.
+class Assembler {
+public:
+    std::vector<uint8_t> bytes;
+
+    int label() {
+        labels.push_back(SIZE_MAX);
+        return static_cast<int>(labels.size() - 1);
+    }
+    void bind(int l) { labels[l] = bytes.size(); }
+
+    void jmp(int l) {
+        byte(0xE9);
+        fixup(l);
+    }
+    void jcc(Cond cond, int l) {
+        byte(0x0F);
+        byte(0x80 | cond);
+        fixup(l);
+    }
+
+    // rel32 fields point past themselves
+    void patch() {
+        for (const auto& [at, l] : fixups) {
+            int32_t rel = static_cast<int32_t>(labels[l] - (at + 4));
+            std::memcpy(&bytes[at], &rel, 4);
+        }
+    }
+
+    void push(Reg r) { rex(false, 0, r); byte(0x50 | (r & 7)); }
+    void pop(Reg r) { rex(false, 0, r); byte(0x58 | (r & 7)); }
+    void ret() { byte(0xC3); }
+    void ud2() { byte(0x0F); byte(0x0B); }
+    void cdq() { byte(0x99); }
+
+    void load32(Reg dst, Reg base, int32_t disp) { memOp(false, { 0x8B }, dst, base, disp); }
+    void load64(Reg dst, Reg base, int32_t disp) { memOp(true, { 0x8B }, dst, base, disp); }
+    void loadByte(Reg dst, Reg base, int32_t disp) { memOp(false, { 0x0F, 0xB6 }, dst, base, disp); } // movzx
+    void loadWord(Reg dst, Reg base, int32_t disp) { memOp(false, { 0x0F, 0xB7 }, dst, base, disp); }
+    void store32(Reg base, int32_t disp, Reg src) { memOp(false, { 0x89 }, src, base, disp); }
+    void store64(Reg base, int32_t disp, Reg src) { memOp(true, { 0x89 }, src, base, disp); }
+    void storeByte(Reg base, int32_t disp, Reg src) { memOp(false, { 0x88 }, src, base, disp); } // al or cl only
+    void storeByteImm(Reg base, int32_t disp, uint8_t imm) { memOp(false, { 0xC6 }, RAX, base, disp); byte(imm); }
+    void store32Imm(Reg base, int32_t disp, int32_t imm) { memOp(false, { 0xC7 }, RAX, base, disp); u32(imm); }
+    void cmpByteImm(Reg base, int32_t disp, uint8_t imm) { memOp(false, { 0x80 }, RDI, base, disp); byte(imm); } // /7
+    void cmp32Imm(Reg base, int32_t disp, int32_t imm) { memOp(false, { 0x81 }, RDI, base, disp); u32(imm); }
+    void cmp32(Reg r, Reg base, int32_t disp) { memOp(false, { 0x3B }, r, base, disp); }
+    void cmp64(Reg r, Reg base, int32_t disp) { memOp(true, { 0x3B }, r, base, disp); }
+    void add32(Reg r, Reg base, int32_t disp) { memOp(false, { 0x03 }, r, base, disp); }
+    void sub32(Reg r, Reg base, int32_t disp) { memOp(false, { 0x2B }, r, base, disp); }
+    void imul32(Reg r, Reg base, int32_t disp) { memOp(false, { 0x0F, 0xAF }, r, base, disp); }
+    void orByte(Reg r, Reg base, int32_t disp) { memOp(false, { 0x0A }, r, base, disp); } // al or cl only
+    void inc32(Reg base, int32_t disp) { memOp(false, { 0xFF }, RAX, base, disp); }
+    void dec32(Reg base, int32_t disp) { memOp(false, { 0xFF }, RCX, base, disp); }
+    void lea64(Reg dst, Reg base, int32_t disp) { memOp(true, { 0x8D }, dst, base, disp); }
+    void lea32(Reg dst, Reg base, int32_t disp) { memOp(false, { 0x8D }, dst, base, disp); }
+
+    void mov64(Reg dst, Reg src) { regOp(true, 0x89, src, dst); }
+    void mov32(Reg dst, Reg src) { regOp(false, 0x89, src, dst); }
+    void add64(Reg dst, Reg src) { regOp(true, 0x01, src, dst); }
+    void test32(Reg a, Reg b) { regOp(false, 0x85, b, a); }
+    void test64(Reg a, Reg b) { regOp(true, 0x85, b, a); }
+    void xor32(Reg dst, Reg src) { regOp(false, 0x31, src, dst); }
+    void cmp32Imm(Reg r, int32_t imm) { regOp(false, 0x81, RDI, r); u32(imm); }
+    void shl64(Reg r, uint8_t n) { regOp(true, 0xC1, RSP, r); byte(n); } // /4
+    void idiv32(Reg r) { regOp(false, 0xF7, RDI, r); }                  // /7
+    void call(Reg r) { regOp(false, 0xFF, RDX, r); }                    // /2
+    void setcc(Cond cond) { byte(0x0F); byte(0x90 | cond); byte(0xC0); } // into al
+
+    void mov32Imm(Reg r, uint32_t imm) {
+        rex(false, 0, r);
+        byte(0xB8 | (r & 7));
+        u32(imm);
+    }
+    void mov64Imm(Reg r, uint64_t imm) {
+        rex(true, 0, r);
+        byte(0xB8 | (r & 7));
+        for (int i = 0; i < 8; ++i) byte(static_cast<uint8_t>(imm >> (8 * i)));
+    }
+
+private:
+    std::vector<size_t> labels;
+    std::vector<std::pair<size_t, int>> fixups;
+
+    void byte(uint8_t b) { bytes.push_back(b); }
+    void u32(uint32_t v) {
+        for (int i = 0; i < 4; ++i) byte(static_cast<uint8_t>(v >> (8 * i)));
+    }
+    void fixup(int l) {
+        fixups.push_back({ bytes.size(), l });
+        u32(0);
+    }
+
+    void rex(bool w, int reg, int rm) {
+        uint8_t prefix = 0x40 | (w ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((rm & 8) ? 1 : 0);
+        if (prefix != 0x40) byte(prefix);
+    }
+
+    void memOp(bool w, std::initializer_list<uint8_t> op, int reg, Reg base, int32_t disp) {
+        rex(w, reg, base);
+        for (uint8_t b : op) byte(b);
+        byte(0x80 | ((reg & 7) << 3) | (base & 7));
+        if ((base & 7) == RSP) byte(0x24); // rsp and r12 need a SIB byte
+        u32(static_cast<uint32_t>(disp));
+    }
+
+    void regOp(bool w, uint8_t op, int reg, int rm) {
+        rex(w, reg, rm);
+        byte(op);
+        byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+    }
+};
+
+constexpr int32_t slotSize = sizeof(Value);
+static_assert(sizeof(Value) == 16, "the generated code scales slot numbers by 16");
+
+// Registers held across the whole function: r12 the JitContext, r13 the
+// frame's base slot, rbx the frame's first Value. Everything is kept in the
+// slots themselves, so between two instructions nothing else is live.
+class CodeGen {
+public:
+    CodeGen(const Chunk& chunk, uint32_t slot, const JitHelpers& helpers) : chunk(chunk), slot(slot), helpers(helpers) {}
+
+    // false if the chunk uses anything outside the subset
+    bool generate(std::vector<uint8_t>& out);
+
+private:
+    const Chunk& chunk;
+    uint32_t slot;
+    const JitHelpers& helpers;
+    Assembler as;
+    std::vector<int> pcLabels;
+    int errorExit = 0;
+    int epilogue = 0;
+    std::vector<std::function<void()>> stubs; // slow paths, placed after the body
+
+    static int32_t tag(int r) { return r * slotSize + static_cast<int32_t>(Value::tagOffset()); }
+    static int32_t payload(int r) { return r * slotSize + static_cast<int32_t>(Value::payloadOffset()); }
+    static int32_t context(size_t offset) { return static_cast<int32_t>(offset); }
+    static uint8_t kind(ValueType type) { return static_cast<uint8_t>(type); }
+
+    bool supported(const Instruction& ins, size_t pc) const;
+    void emit(const Instruction& ins, size_t pc);
+
+    void reloadRegisters();
+    void callHelper(JitHelper helper, uint32_t x, uint32_t y);
+    // jumps to a slow path when cond holds after the caller's test; it then comes back here
+    void slowPath(Cond cond, std::function<void()> body);
+    void releaseIfCounted(int r);
+    void storeInt(int r);
+    void storeBool(int r);
+    void move(int dst, int src);
+    void binary(const Instruction& ins);
+    void jumpIfFalse(int r, int target);
+    void forLoop(const Instruction& ins, int target);
+    void call(int a, int argc, uint32_t target, bool checked);
+    bool selfTailCall(int a, int argc, bool checked);
+    void ret(int r);
+};
+
+void CodeGen::reloadRegisters() {
+    as.load64(RBX, R12, context(offsetof(JitContext, registers)));
+    as.mov64(RCX, R13);
+    as.shl64(RCX, 4);
+    as.add64(RBX, RCX);
+}
+
+void CodeGen::callHelper(JitHelper helper, uint32_t x, uint32_t y) {
+    as.mov64(argRegs[0], R12);
+    as.mov64(argRegs[1], R13);
+    as.mov32Imm(argRegs[2], x);
+    as.mov32Imm(argRegs[3], y);
+    as.mov64Imm(RAX, reinterpret_cast<uint64_t>(helper));
+    as.call(RAX);
+    as.test32(RAX, RAX);
+    as.jcc(Sign, errorExit);
+    reloadRegisters(); // leaves eax alone
+}
+
+void CodeGen::slowPath(Cond cond, std::function<void()> body) {
+    int stub = as.label(), back = as.label();
+    as.jcc(cond, stub);
+    as.bind(back);
+    stubs.push_back([this, stub, back, body] {
+        as.bind(stub);
+        body();
+        as.jmp(back);
+    });
+}
+
+// a store over an array or string has to drop the reference first, as
+// Value's setters do; those tags are String and up
+void CodeGen::releaseIfCounted(int r) {
+    as.cmpByteImm(RBX, tag(r), kind(ValueType::String));
+    slowPath(AboveEqual, [this, r] { callHelper(helpers.release, r, 0); });
+}
+
+void CodeGen::storeInt(int r) {
+    as.storeByteImm(RBX, tag(r), kind(ValueType::Int));
+    as.store32(RBX, payload(r), RAX);
+}
+
+void CodeGen::storeBool(int r) {
+    as.storeByteImm(RBX, tag(r), kind(ValueType::Bool));
+    as.storeByte(RBX, payload(r), RAX);
+}
+
+void CodeGen::move(int dst, int src) {
+    if (dst == src) return;
+    int stub = as.label(), done = as.label();
+    as.cmpByteImm(RBX, tag(src), kind(ValueType::String));
+    as.jcc(AboveEqual, stub);
+    as.cmpByteImm(RBX, tag(dst), kind(ValueType::String));
+    as.jcc(AboveEqual, stub);
+    as.load64(RAX, RBX, tag(src));
+    as.load64(RCX, RBX, payload(src));
+    as.store64(RBX, tag(dst), RAX);
+    as.store64(RBX, payload(dst), RCX);
+    as.bind(done);
+    stubs.push_back([this, stub, done, dst, src] {
+        as.bind(stub);
+        callHelper(helpers.move, dst, src);
+        as.jmp(done);
+    });
+}
+
+// The typed ops read payloads straight away; the others first check both
+// tags are ints and hand anything else to the helper.
+void CodeGen::binary(const Instruction& ins) {
+    OpCode op = ins.op;
+    bool generic = op <= OpCode::NotEqual;
+    int slow = as.label(), done = as.label();
+    if (generic) {
+        as.loadByte(RAX, RBX, tag(ins.b));
+        as.orByte(RAX, RBX, tag(ins.c));
+        as.jcc(NonZero, slow);
+    }
+    releaseIfCounted(ins.a);
+
+    Cond cond = Zero;
+    bool comparison = true;
+    switch (op) {
+    case OpCode::Less: case OpCode::LessInt: cond = Less; break;
+    case OpCode::LessEqual: case OpCode::LessEqualInt: cond = LessEqual; break;
+    case OpCode::Greater: case OpCode::GreaterInt: cond = Greater; break;
+    case OpCode::GreaterEqual: case OpCode::GreaterEqualInt: cond = GreaterEqual; break;
+    case OpCode::Equal: cond = Zero; break;
+    case OpCode::NotEqual: cond = NonZero; break;
+    default: comparison = false; break;
+    }
+
+    if (comparison) {
+        as.load32(RAX, RBX, payload(ins.b));
+        as.cmp32(RAX, RBX, payload(ins.c));
+        as.setcc(cond);
+        storeBool(ins.a);
+    }
+    else if (op == OpCode::Div || op == OpCode::DivInt) {
+        // unsigned(divisor + 1) <= 1 catches 0 and -1, as the interpreter does
+        as.load32(RCX, RBX, payload(ins.c));
+        as.lea32(RDX, RCX, 1);
+        as.cmp32Imm(RDX, 1);
+        as.jcc(BelowEqual, slow);
+        as.load32(RAX, RBX, payload(ins.b));
+        as.cdq();
+        as.idiv32(RCX);
+        storeInt(ins.a);
+    }
+    else {
+        as.load32(RAX, RBX, payload(ins.b));
+        if (op == OpCode::Add || op == OpCode::AddInt) as.add32(RAX, RBX, payload(ins.c));
+        else if (op == OpCode::Sub || op == OpCode::SubInt) as.sub32(RAX, RBX, payload(ins.c));
+        else as.imul32(RAX, RBX, payload(ins.c));
+        storeInt(ins.a);
+    }
+    as.bind(done);
+    if (!generic && op != OpCode::DivInt) return;
+
+    uint32_t x = ins.a | (static_cast<uint32_t>(op) << 16);
+    uint32_t y = ins.b | (static_cast<uint32_t>(ins.c) << 16);
+    stubs.push_back([this, slow, done, x, y] {
+        as.bind(slow);
+        callHelper(helpers.binary, x, y);
+        as.jmp(done);
+    });
+}
+
+void CodeGen::jumpIfFalse(int r, int target) {
+    int notBool = as.label(), slow = as.label(), done = as.label();
+    as.loadByte(RAX, RBX, tag(r));
+    as.cmp32Imm(RAX, kind(ValueType::Bool));
+    as.jcc(NonZero, notBool);
+    as.cmpByteImm(RBX, payload(r), 0);
+    as.jcc(Zero, pcLabels[target]);
+    as.jmp(done);
+    as.bind(notBool);
+    as.test32(RAX, RAX); // ValueType::Int
+    as.jcc(NonZero, slow);
+    as.cmp32Imm(RBX, payload(r), 0);
+    as.jcc(Zero, pcLabels[target]);
+    as.bind(done);
+    stubs.push_back([this, slow, done, r, target] {
+        as.bind(slow);
+        callHelper(helpers.truthy, r, 0);
+        as.test32(RAX, RAX);
+        as.jcc(Zero, pcLabels[target]);
+        as.jmp(done);
+    });
+}
+
+// slots a, a+1, a+2: limit, step and index
+void CodeGen::forLoop(const Instruction& ins, int target) {
+    bool inclusive = ins.op == OpCode::ForLoopInclusive;
+    int limit = ins.a, step = ins.a + 1, index = ins.a + 2;
+    int slow = as.label(), down = as.label(), done = as.label();
+    as.loadByte(RAX, RBX, tag(index));
+    as.orByte(RAX, RBX, tag(limit));
+    as.jcc(NonZero, slow);
+    as.load32(RAX, RBX, payload(index));
+    as.load32(RCX, RBX, payload(step));
+    as.add32(RAX, RBX, payload(step));
+    as.store32(RBX, payload(index), RAX);
+    as.test32(RCX, RCX);
+    as.jcc(LessEqual, down);
+    as.cmp32(RAX, RBX, payload(limit));
+    as.jcc(inclusive ? LessEqual : Less, pcLabels[target]);
+    as.jmp(done);
+    as.bind(down);
+    as.cmp32(RAX, RBX, payload(limit));
+    as.jcc(inclusive ? GreaterEqual : Greater, pcLabels[target]);
+    as.bind(done);
+    stubs.push_back([this, slow, done, limit, inclusive, target] {
+        as.bind(slow);
+        callHelper(helpers.forLoop, limit, inclusive);
+        as.test32(RAX, RAX);
+        as.jcc(NonZero, pcLabels[target]);
+        as.jmp(done);
+    });
+}
+
+// Straight into the callee's code when it has been compiled, takes these
+// arguments and there is room; otherwise through the interpreter.
+void CodeGen::call(int a, int argc, uint32_t target, bool checked) {
+    int slow = as.label(), done = as.label();
+    int32_t entry = static_cast<int32_t>(target * sizeof(JitTarget));
+    as.load64(RAX, R12, context(offsetof(JitContext, targets)));
+    as.load64(R10, RAX, entry + static_cast<int32_t>(offsetof(JitTarget, code)));
+    as.test64(R10, R10);
+    as.jcc(Zero, slow);
+    as.loadWord(RCX, RAX, entry + static_cast<int32_t>(offsetof(JitTarget, numParams)));
+    as.cmp32Imm(RCX, argc);
+    as.jcc(NonZero, slow);
+    if (checked) {
+        as.cmp32Imm(RAX, entry + static_cast<int32_t>(offsetof(JitTarget, intsOnly)), 0);
+        as.jcc(Zero, slow);
+        for (int i = 0; i < argc; ++i) {
+            as.cmpByteImm(RBX, tag(a + i), kind(ValueType::Int));
+            as.jcc(NonZero, slow);
+        }
+    }
+    as.loadWord(RCX, RAX, entry + static_cast<int32_t>(offsetof(JitTarget, numRegisters)));
+    as.add64(RCX, R13);
+    as.lea64(RCX, RCX, a);
+    as.cmp64(RCX, R12, context(offsetof(JitContext, registerCount)));
+    as.jcc(Above, slow);
+    as.load32(RCX, R12, context(offsetof(JitContext, depth)));
+    as.cmp32(RCX, R12, context(offsetof(JitContext, maxDepth)));
+    as.jcc(AboveEqual, slow);
+
+    as.inc32(R12, context(offsetof(JitContext, depth)));
+    as.mov64(argRegs[0], R12);
+    as.lea64(argRegs[1], R13, a);
+    as.xor32(argRegs[2], argRegs[2]);
+    as.call(R10);
+    as.dec32(R12, context(offsetof(JitContext, depth)));
+    as.test32(RAX, RAX);
+    as.jcc(NonZero, errorExit);
+    reloadRegisters();
+    as.bind(done);
+
+    uint32_t x = static_cast<uint32_t>(a) | (static_cast<uint32_t>(argc) << 16);
+    uint32_t y = target | (checked ? 0x80000000u : 0);
+    stubs.push_back([this, slow, done, x, y] {
+        as.bind(slow);
+        callHelper(helpers.call, x, y);
+        as.jmp(done);
+    });
+}
+
+// A tail call of this function becomes a jump back to its start, once the
+// arguments are where its parameters are. False if it can't be one.
+bool CodeGen::selfTailCall(int a, int argc, bool checked) {
+    if (argc != chunk.numParams) return false;
+    if (checked) {
+        for (int i = 0; i < static_cast<int>(chunk.paramTypes.size()); ++i) {
+            if (chunk.paramTypes[i] != StaticType::Int) return false;
+        }
+    }
+    bool checks = checked && !chunk.paramTypes.empty();
+    int general = as.label();
+    if (checks) {
+        for (int i = 0; i < argc; ++i) {
+            as.cmpByteImm(RBX, tag(a + i), kind(ValueType::Int));
+            as.jcc(NonZero, general);
+        }
+    }
+    for (int i = 0; i < argc; ++i) move(i, a + i);
+    as.load64(RAX, R12, context(offsetof(JitContext, holdsArrays)));
+    as.cmpByteImm(RAX, 0, 0);
+    uint32_t from = static_cast<uint32_t>(argc), to = static_cast<uint32_t>(chunk.numRegisters);
+    slowPath(NonZero, [this, from, to] { callHelper(helpers.clear, from, to); });
+    as.jmp(pcLabels[0]);
+
+    if (checks) {
+        // arguments of other types: the interpreter coerces them, or throws
+        as.bind(general);
+        call(a, argc, slot, checked);
+        ret(a);
+    }
+    return true;
+}
+
+void CodeGen::ret(int r) {
+    move(0, r);
+    as.load64(RAX, R12, context(offsetof(JitContext, holdsArrays)));
+    as.cmpByteImm(RAX, 0, 0);
+    uint32_t to = static_cast<uint32_t>(chunk.numRegisters);
+    slowPath(NonZero, [this, to] { callHelper(helpers.clear, 1, to); });
+    as.xor32(RAX, RAX);
+    as.jmp(epilogue);
+}
+
+bool CodeGen::supported(const Instruction& ins, size_t pc) const {
+    auto inRange = [&](int64_t target) { return target >= 0 && target < static_cast<int64_t>(chunk.code.size()); };
+    switch (ins.op) {
+    case OpCode::LoadInt: case OpCode::LoadBool: case OpCode::Move: case OpCode::Coerce:
+    case OpCode::Add: case OpCode::Sub: case OpCode::Mul: case OpCode::Div:
+    case OpCode::Less: case OpCode::LessEqual: case OpCode::Greater: case OpCode::GreaterEqual:
+    case OpCode::Equal: case OpCode::NotEqual:
+    case OpCode::AddInt: case OpCode::SubInt: case OpCode::MulInt: case OpCode::DivInt:
+    case OpCode::LessInt: case OpCode::LessEqualInt: case OpCode::GreaterInt: case OpCode::GreaterEqualInt:
+    case OpCode::Print: case OpCode::Return:
+        return true;
+    case OpCode::Jump: case OpCode::JumpIfFalse: case OpCode::ForLoop: case OpCode::ForLoopInclusive:
+        return inRange(static_cast<int64_t>(pc) + 1 + ins.bx());
+    case OpCode::Call: case OpCode::TailCall: case OpCode::CallChecked: case OpCode::TailCallChecked:
+        return ins.b < chunk.callTargets.size() && chunk.callTargets[ins.b] != UINT32_MAX;
+    default:
+        return false; // doubles, globals, arrays and errors stay interpreted
+    }
+}
+
+void CodeGen::emit(const Instruction& ins, size_t pc) {
+    int target = static_cast<int>(static_cast<int64_t>(pc) + 1 + ins.bx());
+    switch (ins.op) {
+    case OpCode::LoadInt:
+        releaseIfCounted(ins.a);
+        as.storeByteImm(RBX, tag(ins.a), kind(ValueType::Int));
+        as.store32Imm(RBX, payload(ins.a), ins.bx());
+        break;
+    case OpCode::LoadBool:
+        releaseIfCounted(ins.a);
+        as.storeByteImm(RBX, tag(ins.a), kind(ValueType::Bool));
+        as.storeByteImm(RBX, payload(ins.a), ins.b != 0);
+        break;
+    case OpCode::Move:
+        move(ins.a, ins.b);
+        break;
+    case OpCode::Coerce: {
+        ValueType wanted;
+        switch (static_cast<StaticType>(ins.b)) {
+        case StaticType::Int: wanted = ValueType::Int; break;
+        case StaticType::Double: wanted = ValueType::Double; break;
+        case StaticType::Bool: wanted = ValueType::Bool; break;
+        case StaticType::Array: wanted = ValueType::Array; break;
+        case StaticType::String: wanted = ValueType::String; break;
+        default: return;
+        }
+        as.cmpByteImm(RBX, tag(ins.a), kind(wanted));
+        uint32_t r = ins.a, type = ins.b;
+        slowPath(NonZero, [this, r, type] { callHelper(helpers.coerce, r, type); });
+        break;
+    }
+    case OpCode::Jump:
+        as.jmp(pcLabels[target]);
+        break;
+    case OpCode::JumpIfFalse:
+        jumpIfFalse(ins.a, target);
+        break;
+    case OpCode::ForLoop:
+    case OpCode::ForLoopInclusive:
+        forLoop(ins, target);
+        break;
+    case OpCode::Call:
+    case OpCode::CallChecked:
+        call(ins.a, ins.c, chunk.callTargets[ins.b], ins.op == OpCode::CallChecked);
+        break;
+    case OpCode::TailCall:
+    case OpCode::TailCallChecked: {
+        bool checked = ins.op == OpCode::TailCallChecked;
+        uint32_t callee = chunk.callTargets[ins.b];
+        if (callee == slot && selfTailCall(ins.a, ins.c, checked)) break;
+        // to another function: a call and a return, so the machine stack
+        // grows where the interpreter's wouldn't, up to ctx->maxDepth
+        call(ins.a, ins.c, callee, checked);
+        ret(ins.a);
+        break;
+    }
+    case OpCode::Print:
+        callHelper(helpers.print, ins.a, 0);
+        break;
+    case OpCode::Return:
+        ret(ins.a);
+        break;
+    default:
+        binary(ins);
+        break;
+    }
+}
+
+bool CodeGen::generate(std::vector<uint8_t>& out) {
+    if (chunk.numRegisters > UINT16_MAX) return false;
+    std::vector<size_t> loopStarts;
+    for (size_t pc = 0; pc < chunk.code.size(); ++pc) {
+        const Instruction& ins = chunk.code[pc];
+        if (!supported(ins, pc)) return false;
+        bool backward = ins.bx() < 0 && (ins.op == OpCode::Jump || ins.op == OpCode::ForLoop || ins.op == OpCode::ForLoopInclusive);
+        if (backward) loopStarts.push_back(pc + 1 + ins.bx());
+    }
+    if (chunk.code.empty()) return false;
+
+    for (size_t i = 0; i < chunk.code.size(); ++i) pcLabels.push_back(as.label());
+    errorExit = as.label();
+    epilogue = as.label();
+
+    // three pushes and the 32 bytes Windows wants below a call keep rsp 16-byte aligned
+    as.push(RBX);
+    as.push(R12);
+    as.push(R13);
+    as.lea64(RSP, RSP, -32);
+    as.mov64(R12, argRegs[0]);
+    as.mov64(R13, argRegs[1]);
+    as.mov32(RAX, argRegs[2]);
+    reloadRegisters();
+    as.test32(RAX, RAX);
+    as.jcc(Zero, pcLabels[0]);
+    for (size_t start : loopStarts) {
+        as.cmp32Imm(RAX, static_cast<int32_t>(start));
+        as.jcc(Zero, pcLabels[start]);
+    }
+    as.mov32Imm(RAX, jitNotEntered);
+    as.jmp(epilogue);
+
+    for (size_t pc = 0; pc < chunk.code.size(); ++pc) {
+        as.bind(pcLabels[pc]);
+        emit(chunk.code[pc], pc);
+    }
+    as.ud2(); // the compiler always ends a chunk with a Return
+
+    // stubs can add stubs of their own
+    for (size_t i = 0; i < stubs.size(); ++i) {
+        auto stub = std::move(stubs[i]);
+        stub();
+    }
+
+    as.bind(errorExit);
+    as.mov32Imm(RAX, static_cast<uint32_t>(jitThrew));
+    as.bind(epilogue);
+    as.lea64(RSP, RSP, 32);
+    as.pop(R13);
+    as.pop(R12);
+    as.pop(RBX);
+    as.ret();
+    as.patch();
+    out = std::move(as.bytes);
+    return true;
+}
+
+} // namespace
+
+Jit::Jit(Interpreter& owner, const bool& holdsArrays, const JitHelpers& helpers) : helpers(helpers) {
+    ctx.owner = &owner;
+    ctx.holdsArrays = &holdsArrays;
+}
+
+bool Jit::available() {
+#ifdef JIT_X64
+    return true;
+#else
+    return false;
+#endif
+}
+
+void Jit::grow(size_t slots) {
+    if (slots <= targets.size()) return;
+    targets.resize(slots);
+    tiers.resize(slots);
+    ctx.targets = targets.data(); // generated code reloads it on every call
+}
+
+void Jit::forget(uint32_t slot) {
+    if (slot >= tiers.size()) return;
+    targets[slot] = {};
+    tiers[slot] = {};
+}
+
+JitCode Jit::compile(uint32_t slot, const Chunk& chunk) {
+    // every call target needs an entry before the code refers to it
+    size_t needed = slot + 1;
+    for (uint32_t target : chunk.callTargets) {
+        if (target != UINT32_MAX && target + 1 > needed) needed = target + 1;
+    }
+    grow(needed);
+
+    std::vector<uint8_t> bytes;
+    if (!available() || !CodeGen(chunk, slot, helpers).generate(bytes)) {
+        tiers[slot].failed = true;
+        return nullptr;
+    }
+    try {
+        tiers[slot].memory = std::make_unique<ExecutableMemory>(bytes);
+    }
+    catch (const std::runtime_error&) {
+        tiers[slot].failed = true; // no executable memory: go on interpreting
+        return nullptr;
+    }
+
+    JitTarget& target = targets[slot];
+    target.code = reinterpret_cast<JitCode>(const_cast<void*>(tiers[slot].memory->data()));
+    target.numParams = static_cast<uint16_t>(chunk.numParams);
+    target.numRegisters = static_cast<uint16_t>(chunk.numRegisters);
+    target.intsOnly = 1;
+    for (StaticType type : chunk.paramTypes) {
+        if (type != StaticType::Int) target.intsOnly = 0;
+    }
+    return target.code;
+}
@@ -0,0 +1,133 @@
+// jit.h
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <vector>
+#include "bytecode.h"
+
+class Interpreter;
+struct JitContext;
+
+// Generated code for one chunk. Runs the frame at registers[base] from pc,
+// which is 0 or the start of a loop, until the chunk returns. Returns 0 with
+// the result in registers[base]; jitThrew when something it called threw,
+// which is then in ctx->error; or jitNotEntered if pc isn't a loop start.
+using JitCode = int (*)(JitContext* ctx, size_t base, uint32_t pc);
+constexpr int jitThrew = -1;
+constexpr int jitNotEntered = 1;
+
+// What generated code calls for everything past its int fast paths, with two
+// packed operands. Returns a result >= 0, or jitThrew after storing the error.
+using JitHelper = int (*)(JitContext* ctx, size_t base, uint32_t x, uint32_t y);
+
+struct JitHelpers {
+    JitHelper release;    // x: clear register x
+    JitHelper move;       // x = y, for arrays
+    JitHelper binary;     // x & 0xFFFF = (y & 0xFFFF) OpCode(x >> 16) (y >> 16), for any operands
+    JitHelper truthy;     // returns register x's truth
+    JitHelper forLoop;    // ForLoop at x (ForLoopInclusive if y) on non-ints; returns whether to go round again
+    JitHelper coerce;     // Coerce x to StaticType(y)
+    JitHelper call;       // Call at x & 0xFFFF with x >> 16 arguments of slot y & 0x7FFFFFFF, checked if y >> 31
+    JitHelper clear;      // clears registers x .. y - 1
+    JitHelper print;      // prints register x
+};
+
+// A function slot as generated calls see it: code is null until its chunk is
+// compiled, and then calls jump straight to it.
+struct JitTarget {
+    JitCode code = nullptr;
+    uint16_t numParams = 0;
+    uint16_t numRegisters = 0;
+    uint32_t intsOnly = 0; // every parameter is an int, or unchecked
+};
+
+// State generated code reads through its first argument.
+struct JitContext {
+    Value* registers = nullptr; // the interpreter's; reloaded after every helper, which may grow them
+    size_t registerCount = 0;
+    const JitTarget* targets = nullptr; // by function slot
+    uint32_t depth = 0;                 // native frames on the machine stack
+    uint32_t maxDepth = 1000;           // past this, calls go back to the interpreter
+    const bool* holdsArrays = nullptr;  // the interpreter's flag, so returns know to clear
+    Interpreter* owner = nullptr;
+    std::exception_ptr error;
+};
+
+// Pages holding generated code: written once, then made executable and read-only.
+class ExecutableMemory {
+public:
+    explicit ExecutableMemory(const std::vector<uint8_t>& code);
+    ~ExecutableMemory();
+    ExecutableMemory(const ExecutableMemory&) = delete;
+    ExecutableMemory& operator=(const ExecutableMemory&) = delete;
+
+    const void* data() const { return memory; }
+
+private:
+    void* memory = nullptr;
+    size_t size = 0;
+};
+
+// Baseline compiler to x86-64 for one Interpreter's hot functions. A function
+// is compiled once it has been called callThreshold times or has run a loop
+// long enough, and only if every instruction is in the int subset:
+// arithmetic and comparisons, jumps and counted loops, calls, print and
+// return. Compiled code keeps every value in its register slot, so the
+// interpreter can switch to it at any loop start, and it handles only ints
+// inline: any other operand goes to a helper that does exactly what the
+// interpreter would. Anything else stays interpreted.
+class Jit {
+public:
+    static constexpr uint32_t callThreshold = 1000;
+
+    Jit(Interpreter& owner, const bool& holdsArrays, const JitHelpers& helpers);
+
+    // false where there is no code generator; compile then never succeeds
+    static bool available();
+
+    JitContext& context() { return ctx; }
+
+    // Counts a call of slot's chunk; its code once it is compiled, else null.
+    JitCode hotCall(uint32_t slot, const Chunk& chunk) {
+        if (slot >= tiers.size()) grow(slot + 1);
+        if (targets[slot].code) return targets[slot].code;
+        Tier& tier = tiers[slot];
+        if (tier.failed || ++tier.calls < callThreshold) return nullptr;
+        return compile(slot, chunk);
+    }
+
+    // slot's chunk is looping; compiles it now if it can be
+    JitCode hotLoop(uint32_t slot, const Chunk& chunk) {
+        if (slot >= tiers.size()) grow(slot + 1);
+        if (targets[slot].code) return targets[slot].code;
+        return tiers[slot].failed ? nullptr : compile(slot, chunk);
+    }
+
+    // slot's body is being replaced; its code goes with it
+    void forget(uint32_t slot);
+
+    // Calls of slot stay interpreted until it is forgotten. Code it already
+    // has is kept, as a frame may still be running it, but not entered again.
+    void exclude(uint32_t slot) {
+        if (slot >= tiers.size()) grow(slot + 1);
+        targets[slot].code = nullptr;
+        tiers[slot].failed = true;
+    }
+
+private:
+    struct Tier {
+        uint32_t calls = 0;
+        bool failed = false; // has an instruction outside the subset
+        std::unique_ptr<ExecutableMemory> memory;
+    };
+
+    JitContext ctx;
+    JitHelpers helpers;
+    std::vector<JitTarget> targets;
+    std::vector<Tier> tiers;
+
+    void grow(size_t slots);
+    JitCode compile(uint32_t slot, const Chunk& chunk);
+};
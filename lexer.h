@@ -1,15 +1,17 @@
 #pragma once
 #include <Windows.h>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <unordered_map>
 #include <stdexcept>
+#include "charscan.h"
 
 enum class token_type
 {
     Identifier, Number, String,
     Let, Const, Class, Function,
-    Int, Double, Bool, Return,
+    Int, Double, Bool, Return, Break, Continue, True, False,
     Plus, Minus, Star, Slash,
     Equal, EqualEqual, PlusPlus,
     LParen, RParen, LBrace, RBrace,
@@ -32,6 +34,10 @@ inline const std::unordered_map<token_type, std::string> tokenToString = {
     {token_type::Double, "Double"},
     {token_type::Bool, "Bool"},
     {token_type::Return, "Return"},
+    {token_type::Break, "Break"},
+    {token_type::Continue, "Continue"},
+    {token_type::True, "True"},
+    {token_type::False, "False"},
     {token_type::Less, "Less"},
     {token_type::Greater, "Greater"},
     {token_type::GreaterEqual, "GreaterEqual"},
@@ -61,9 +67,11 @@ inline const std::unordered_map<token_type, std::string> tokenToString = {
     {token_type::Unexpected, "Unexpected"}
 };
 
+// lexeme points into the source buffer handed to the Lexer (or at a static
+// message for Unexpected tokens), so the buffer must outlive the tokens.
 struct Token {
     token_type type;
-    std::string lexeme;
+    std::string_view lexeme;
     int line;
     int column;
 
@@ -74,21 +82,23 @@ struct Token {
 
 class Lexer {
 public:
-    Lexer(const std::string& source)
-        : source(source), current(0), line(1), column(1) {}
+    // the caller owns the source buffer; the lexer only keeps a view of it.
+    // A buffer cut out of a larger file can start at that file's line and column.
+    Lexer(std::string_view source, int firstLine = 1, int firstColumn = 1)
+        : source(source), current(0), line(firstLine), columnBias(firstColumn - 1) {}
 
     Token nextToken() {
         skipWhitespace();
         start = current;
         line_start = line;
-        column_start = column;
+        column_start = static_cast<int>(current - lineStart) + 1 + columnBias;
 
         if (isAtEnd()) return makeToken(token_type::End);
 
-        char c = advance();
+        char c = source[current++];
 
-        if (isAlpha(c)) return identifier();
-        if (isdigit(c)) return number();
+        if (charscan::isAlpha(c)) return identifier();
+        if (charscan::isDigit(c)) return number();
         if (c == '"') return stringLiteral();
 
         switch (c) {
@@ -96,13 +106,12 @@ public:
         case ')': return makeToken(token_type::RParen);
         case '{': return makeToken(token_type::LBrace);
         case '[': return makeToken(token_type::LBracket);
-        case '<': return makeToken(token_type::Less);
-        case '<=': return makeToken(token_type::LessEqual);
-        case '>': return makeToken(token_type::Greater);
-        case '>=': return makeToken(token_type::GreaterEqual);
+        case '<': return match('=') ? makeToken(token_type::LessEqual) : makeToken(token_type::Less);
+        case '>': return match('=') ? makeToken(token_type::GreaterEqual) : makeToken(token_type::Greater);
+        case '!': return match('=') ? makeToken(token_type::BangEqual) : errorToken("Unexpected character");
         case ']': return makeToken(token_type::RBracket);
         case '}': return makeToken(token_type::RBrace);
-        case ';': return handleSemicolon();
+        case ';': return makeToken(token_type::Semicolon);
         case ':': return makeToken(token_type::Colon);
         case ',': return makeToken(token_type::Comma);
         case '=': return match('=') ? makeToken(token_type::EqualEqual) : makeToken(token_type::Equal);
@@ -115,39 +124,31 @@ public:
         return errorToken("Unexpected character");
     }
 
+    // offset in the source of the token nextToken() returned last
+    size_t tokenStart() const { return start; }
+    std::string_view text() const { return source; }
+
 private:
-    const std::string source;
+    std::string_view source;
     size_t current;
     size_t start = 0;
     int line;
-    int column;
+    // Columns are offsets from the start of the line, so only line breaks,
+    // which the run scans count in bulk, cost anything to track.
+    size_t lineStart = 0;
+    int columnBias;     // firstColumn - 1 until the first line break
     int line_start = 1;
     int column_start = 1;
 
-    static const std::unordered_map<std::string, token_type> keywords;
-
     bool isAtEnd() const { return current >= source.size(); }
 
-    char advance() {
-        if (isAtEnd()) return '\0';
-        char c = source[current++];
-        if (c == '\n') {
-            line++;
-            column = 1;
-        }
-        else {
-            column++;
-        }
-        return c;
-    }
-
     char peek() const { return isAtEnd() ? '\0' : source[current]; }
     char peekNext() const { return (current + 1 >= source.size()) ? '\0' : source[current + 1]; }
 
     bool match(char expected) {
         if (isAtEnd()) return false;
         if (source[current] != expected) return false;
-        advance();
+        current++;
         return true;
     }
 
@@ -155,98 +156,100 @@ private:
         return { type, source.substr(start, current - start), line_start, column_start };
     }
 
-    Token errorToken(const std::string& message) {
+    Token errorToken(const char* message) {
         return { token_type::Unexpected, message, line_start, column_start };
     }
 
+    const char* at(size_t offset) const { return source.data() + offset; }
+    const char* end() const { return source.data() + source.size(); }
+
+    // moves to p, taking in the line breaks a scan counted on the way
+    void skipTo(const char* p, int newlines, const char* newLineStart) {
+        current = static_cast<size_t>(p - source.data());
+        if (newlines) {
+            line += newlines;
+            lineStart = static_cast<size_t>(newLineStart - source.data());
+            columnBias = 0;
+        }
+    }
+
     void skipWhitespace() {
-        while (true) {
-            switch (peek()) {
-            case ' ':
-            case '\r':
-            case '\t':
-                advance();
-                break;
-            case '\n':
-                advance();
-                break;
-            case '/':
-                if (peekNext() == '/') {
-                    while (peek() != '\n' && !isAtEnd()) advance();
-                }
-                else {
-                    return;
-                }
-                break;
-            default:
-                return;
-            }
+        for (;;) {
+            int newlines = 0;
+            const char* newLineStart = nullptr;
+            const char* p = charscan::spaces(at(current), end(), newlines, newLineStart);
+            skipTo(p, newlines, newLineStart);
+            if (peek() != '/' || peekNext() != '/') return;
+            current = static_cast<size_t>(charscan::lineEnd(at(current), end()) - source.data());
         }
     }
 
     Token identifier() {
-        while (isAlphaNumeric(peek())) advance();
-
-        std::string text = source.substr(start, current - start);
-        auto it = keywords.find(text);
-        if (it != keywords.end()) {
-            return { it->second, text, line_start, column_start };
-        }
-        return makeToken(token_type::Identifier);
+        current = static_cast<size_t>(charscan::identifierTail(at(current), end()) - source.data());
+        return makeToken(keywordType(source.substr(start, current - start)));
     }
 
     Token number() {
-        while (isdigit(peek())) advance();
+        current = static_cast<size_t>(charscan::digits(at(current), end()) - source.data());
 
-        if (peek() == '.' && isdigit(peekNext())) {
-            advance();
-            while (isdigit(peek())) advance();
+        if (peek() == '.' && charscan::isDigit(peekNext())) {
+            current = static_cast<size_t>(charscan::digits(at(current + 1), end()) - source.data());
         }
 
         return makeToken(token_type::Number);
     }
 
     Token stringLiteral() {
-        while (peek() != '"' && !isAtEnd()) {
-            if (peek() == '\\') advance(); // handle escape sequences
-            advance();
+        for (;;) {
+            int newlines = 0;
+            const char* newLineStart = nullptr;
+            const char* p = charscan::stringStop(at(current), end(), newlines, newLineStart);
+            skipTo(p, newlines, newLineStart);
+            if (isAtEnd()) return errorToken("Unterminated string");
+            if (source[current] == '"') break;
+            current++; // a backslash escapes whatever follows it, a line break included
+            if (isAtEnd()) return errorToken("Unterminated string");
+            if (source[current] == '\n') skipTo(at(current + 1), 1, at(current + 1));
+            else current++;
         }
-
-        if (isAtEnd()) return errorToken("Unterminated string");
-        advance(); // Closing "
+        current++; // Closing "
         return makeToken(token_type::String);
     }
 
-    Token handleSemicolon() {
-        if (current > 1 && source[current - 2] == '\n') {
-            current--;
-            return nextToken();
+    // switch on length first so most identifiers are rejected after one compare
+    static token_type keywordType(std::string_view text) {
+        switch (text.size()) {
+        case 2:
+            if (text == "in") return token_type::In;
+            break;
+        case 3:
+            if (text == "let") return token_type::Let;
+            if (text == "int") return token_type::Int;
+            if (text == "for") return token_type::For;
+            break;
+        case 4:
+            if (text == "bool") return token_type::Bool;
+            if (text == "true") return token_type::True;
+            break;
+        case 5:
+            if (text == "const") return token_type::Const;
+            if (text == "class") return token_type::Class;
+            if (text == "while") return token_type::While;
+            if (text == "print") return token_type::Print;
+            if (text == "break") return token_type::Break;
+            if (text == "false") return token_type::False;
+            break;
+        case 6:
+            if (text == "double") return token_type::Double;
+            if (text == "return") return token_type::Return;
+            break;
+        case 8:
+            if (text == "function") return token_type::Function;
+            if (text == "continue") return token_type::Continue;
+            break;
         }
-        return makeToken(token_type::Semicolon);
+        return token_type::Identifier;
     }
-
-    static bool isAlpha(char c) {
-        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
-    }
-
-    static bool isAlphaNumeric(char c) {
-        return isAlpha(c) || isdigit(c);
-    }
-};
-
-inline const std::unordered_map<std::string, token_type> Lexer::keywords = {
-    {"let", token_type::Let},
-    {"const", token_type::Const},
-    {"class", token_type::Class},
-    {"function", token_type::Function},
-    {"int", token_type::Int},
-    {"double", token_type::Double},
-    {"bool", token_type::Bool},
-    {"for", token_type::For},
-    {"while", token_type::While},
-    {"in", token_type::In},
-    {"print", token_type::Print},
-    {"return", token_type::Return}
 };
 
 inline std::string tokenTypeToString(token_type type) {
@@ -0,0 +1,99 @@
+// memo.cpp
+#include "memo.h"
+#include <bit>
+#include <functional>
+#include <string_view>
+
+std::vector<bool> pureFunctions(std::span<const Chunk* const> chunks) {
+    std::vector<bool> pure(chunks.size());
+    for (size_t slot = 0; slot < chunks.size(); ++slot) {
+        const Chunk* chunk = chunks[slot];
+        if (!chunk) continue;
+        pure[slot] = true;
+        for (const Instruction& ins : chunk->code) {
+            switch (ins.op) {
+            case OpCode::Print: case OpCode::GetGlobal: case OpCode::SetGlobal: case OpCode::SetGlobalIndex:
+                pure[slot] = false;
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    // assume every call is to a pure function until one that isn't turns up;
+    // recursion then stays pure, and impurity spreads to every caller
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t slot = 0; slot < chunks.size(); ++slot) {
+            if (!pure[slot]) continue;
+            for (const Instruction& ins : chunks[slot]->code) {
+                bool call = ins.op == OpCode::Call || ins.op == OpCode::TailCall ||
+                    ins.op == OpCode::CallChecked || ins.op == OpCode::TailCallChecked;
+                if (!call) continue;
+                uint32_t target = chunks[slot]->callTargets[ins.b];
+                if (target < chunks.size() && pure[target]) continue;
+                pure[slot] = false;
+                changed = true;
+                break;
+            }
+        }
+    }
+    return pure;
+}
+
+static size_t hashValue(const Value& v) {
+    size_t h = static_cast<size_t>(v.kind());
+    auto mix = [&h](size_t x) { h ^= x + 0x9E3779B97F4A7C15ull + (h << 6) + (h >> 2); };
+    switch (v.kind()) {
+    case ValueType::Int: mix(static_cast<uint32_t>(v.asInt())); break;
+    case ValueType::Double: mix(std::bit_cast<uint64_t>(v.asDouble())); break;
+    case ValueType::Bool: mix(v.asBool()); break;
+    case ValueType::String: mix(std::hash<std::string_view>()(v.text())); break;
+    case ValueType::Array:
+        for (int item : v.items()) mix(static_cast<uint32_t>(item));
+        break;
+    }
+    return h;
+}
+
+static bool sameValue(const Value& l, const Value& r) {
+    if (l.kind() != r.kind()) return false;
+    switch (l.kind()) {
+    case ValueType::Int: return l.asInt() == r.asInt();
+    case ValueType::Double: return std::bit_cast<uint64_t>(l.asDouble()) == std::bit_cast<uint64_t>(r.asDouble());
+    case ValueType::Bool: return l.asBool() == r.asBool();
+    case ValueType::String: return l.text() == r.text();
+    case ValueType::Array: return l.items() == r.items();
+    }
+    return false;
+}
+
+size_t MemoTable::Hash::operator()(std::span<const Value> args) const {
+    size_t h = args.size();
+    for (const Value& v : args) h = h * 31 + hashValue(v);
+    return h;
+}
+
+bool MemoTable::Same::operator()(std::span<const Value> l, std::span<const Value> r) const {
+    if (l.size() != r.size()) return false;
+    for (size_t i = 0; i < l.size(); ++i) {
+        if (!sameValue(l[i], r[i])) return false;
+    }
+    return true;
+}
+
+const Value* MemoTable::find(std::span<const Value> args) {
+    auto it = results.find(args);
+    if (it == results.end()) {
+        misses++;
+        return nullptr;
+    }
+    hits++;
+    return &it->second;
+}
+
+void MemoTable::insert(std::vector<Value> args, Value result) {
+    if (results.size() >= capacity) results.clear();
+    results.insert_or_assign(std::move(args), std::move(result));
+}
@@ -0,0 +1,48 @@
+// memo.h
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <unordered_map>
+#include <vector>
+#include "bytecode.h"
+
+// Which functions can be memoized, by slot; chunks[slot] is null where no
+// function is defined. A function is pure when its result depends on its
+// arguments alone and returning it is all a call does: it has no print,
+// reads or writes no global, and calls only pure functions. A function
+// that throws throws every time it gets the same arguments, so that is
+// allowed; nothing is cached for it.
+std::vector<bool> pureFunctions(std::span<const Chunk* const> chunks);
+
+// Results of one pure function, keyed on its argument tuple. Arguments match
+// when they have the same type and the same bits, or the same text or
+// elements, so 1 and 1.0 are different keys. Holds up to capacity results;
+// adding one more starts it over empty.
+class MemoTable {
+public:
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+
+    explicit MemoTable(size_t capacity) : capacity(capacity) {}
+
+    // the cached result, or null, counting a hit or a miss
+    const Value* find(std::span<const Value> args);
+    void insert(std::vector<Value> args, Value result);
+    size_t size() const { return results.size(); }
+
+private:
+    // lets find look up a span without building a vector first
+    struct Hash {
+        using is_transparent = void;
+        size_t operator()(std::span<const Value> args) const;
+        size_t operator()(const std::vector<Value>& args) const { return (*this)(std::span<const Value>(args)); }
+    };
+    struct Same {
+        using is_transparent = void;
+        bool operator()(std::span<const Value> l, std::span<const Value> r) const;
+    };
+
+    size_t capacity;
+    std::unordered_map<std::vector<Value>, Value, Hash, Same> results;
+};
@@ -0,0 +1,327 @@
+// optimizer.cpp
+#include "optimizer.h"
+
+ASTNode* Optimizer::optimize(ASTNode* node) {
+    if (!node || level <= 0) return node;
+    bindings.clear();
+    scopes.clear();
+    assigned.clear();
+
+    if (auto func = as<FunctionDecl>(node)) {
+        function(func);
+        return func;
+    }
+    collectAssignments(node);
+    // a bare expression at the top level is what the REPL prints, so it
+    // stays even once it folds to a literal
+    if (auto exprStmt = as<ExpressionStmt>(node)) {
+        exprStmt->expr = expression(exprStmt->expr);
+        return exprStmt;
+    }
+    return statement(node);
+}
+
+void Optimizer::function(FunctionDecl* func) {
+    collectAssignments(func->body);
+    // parameters and the top of the body share one scope, as in the compiler
+    scopes.push_back(bindings.size());
+    for (auto& param : func->params) bindings.push_back({ param.name, nullptr });
+    func->body = statements(func->body);
+    bindings.resize(scopes.back());
+    scopes.pop_back();
+}
+
+NodeList Optimizer::statements(NodeList list) {
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < list.count; ++i) {
+        ASTNode* stmt = statement(list.items[i]);
+        if (!stmt) continue;
+        list.items[kept++] = stmt;
+        // nothing after a jump out of the block can run
+        if (stmt->kind == NodeKind::ReturnStmt || stmt->kind == NodeKind::BreakStmt ||
+            stmt->kind == NodeKind::ContinueStmt) break;
+    }
+    list.count = kept;
+    return list;
+}
+
+NodeList Optimizer::block(NodeList list) {
+    scopes.push_back(bindings.size());
+    list = statements(list);
+    bindings.resize(scopes.back());
+    scopes.pop_back();
+    return list;
+}
+
+static bool hasSideEffects(const ASTNode* node) {
+    if (!node) return false;
+    switch (node->kind) {
+    case NodeKind::CallExpr:
+    case NodeKind::AssignStmt:
+        return true;
+    case NodeKind::BinaryExpr: {
+        while (auto bin = as<BinaryExpr>(node)) {
+            if (hasSideEffects(bin->right)) return true;
+            node = bin->left;
+        }
+        return hasSideEffects(node);
+    }
+    case NodeKind::Identifier:
+        return false;
+    case NodeKind::NumberLiteral:
+    case NodeKind::DoubleLiteral:
+    case NodeKind::BoolLiteral:
+    case NodeKind::StringLiteral:
+        return false;
+    default:
+        return true;
+    }
+}
+
+ASTNode* Optimizer::statement(ASTNode* node) {
+    if (!node) return node;
+
+    switch (node->kind) {
+    case NodeKind::VarDecl: {
+        auto var = static_cast<VarDecl*>(node);
+        var->initializer = expression(var->initializer);
+        bind(var->name, var->initializer);
+        return var;
+    }
+    case NodeKind::AssignStmt: {
+        auto assign = static_cast<AssignStmt*>(node);
+        assign->value = expression(assign->value);
+        return assign;
+    }
+    case NodeKind::IndexAssignStmt:
+        return expression(node);
+    case NodeKind::ExpressionStmt: {
+        auto exprStmt = static_cast<ExpressionStmt*>(node);
+        exprStmt->expr = expression(exprStmt->expr);
+        if (isLiteral(exprStmt->expr)) return nullptr;
+        return exprStmt;
+    }
+    case NodeKind::PrintStmt: {
+        auto print = static_cast<PrintStmt*>(node);
+        print->expression = expression(print->expression);
+        return print;
+    }
+    case NodeKind::ReturnStmt: {
+        auto ret = static_cast<ReturnStmt*>(node);
+        ret->expression = expression(ret->expression);
+        return ret;
+    }
+    case NodeKind::CallExpr:
+        return expression(node);
+    case NodeKind::WhileStmt: {
+        auto whileStmt = static_cast<WhileStmt*>(node);
+        whileStmt->condition = expression(whileStmt->condition);
+        bool truth;
+        if (literalTruth(whileStmt->condition, truth) && !truth) return nullptr;
+        whileStmt->body = block(whileStmt->body);
+        return whileStmt;
+    }
+    case NodeKind::ForStmt: {
+        auto forStmt = static_cast<ForStmt*>(node);
+        scopes.push_back(bindings.size());
+        forStmt->init = statement(forStmt->init);
+        forStmt->condition = expression(forStmt->condition);
+        bool truth;
+        bool known = literalTruth(forStmt->condition, truth);
+        ASTNode* result = forStmt;
+        if (known && !truth) {
+            // only the initializer runs; keep it if it does anything observable
+            result = nullptr;
+            if (auto var = as<VarDecl>(forStmt->init)) {
+                if (hasSideEffects(var->initializer)) {
+                    auto exprStmt = arena.make<ExpressionStmt>(var->line, var->column);
+                    exprStmt->expr = var->initializer;
+                    result = exprStmt;
+                }
+            }
+            else if (forStmt->init) {
+                result = forStmt->init;
+            }
+        }
+        else {
+            if (known) forStmt->condition = nullptr; // always true
+            forStmt->body = block(forStmt->body);
+            forStmt->increment = statement(forStmt->increment);
+        }
+        bindings.resize(scopes.back());
+        scopes.pop_back();
+        return result;
+    }
+    case NodeKind::ForEachStmt: {
+        auto forEach = static_cast<ForEachStmt*>(node);
+        forEach->iterable = expression(forEach->iterable);
+        scopes.push_back(bindings.size());
+        bindings.push_back({ forEach->varName, nullptr });
+        forEach->body = block(forEach->body);
+        bindings.resize(scopes.back());
+        scopes.pop_back();
+        return forEach;
+    }
+    default:
+        return node;
+    }
+}
+
+ASTNode* Optimizer::expression(ASTNode* node) {
+    if (!node) return node;
+
+    switch (node->kind) {
+    case NodeKind::Identifier: {
+        auto ident = static_cast<Identifier*>(node);
+        for (auto it = bindings.rbegin(); it != bindings.rend(); ++it) {
+            if (it->name != ident->name) continue;
+            if (it->literal) return copyLiteral(arena, it->literal, ident->line, ident->column);
+            break;
+        }
+        return ident;
+    }
+    case NodeKind::BinaryExpr: {
+        // left chains are as deep as they are long, so rebuild them bottom up
+        std::vector<BinaryExpr*> chain;
+        ASTNode* result = node;
+        while (auto bin = as<BinaryExpr>(result)) {
+            chain.push_back(bin);
+            result = bin->left;
+        }
+        result = expression(result);
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+            auto bin = *it;
+            bin->left = result;
+            bin->right = expression(bin->right);
+            result = foldLiterals(arena, bin->line, bin->column, bin->op, bin->left, bin->right);
+            if (!result) result = bin;
+        }
+        return result;
+    }
+    case NodeKind::CallExpr: {
+        auto call = static_cast<CallExpr*>(node);
+        for (auto& arg : call->args) arg = expression(arg);
+        return call;
+    }
+    case NodeKind::AssignStmt: {
+        auto assign = static_cast<AssignStmt*>(node);
+        assign->value = expression(assign->value);
+        return assign;
+    }
+    case NodeKind::IndexAssignStmt: {
+        auto assign = static_cast<IndexAssignStmt*>(node);
+        assign->index = expression(assign->index);
+        assign->value = expression(assign->value);
+        return assign;
+    }
+    case NodeKind::IndexExpr: {
+        auto index = static_cast<IndexExpr*>(node);
+        index->array = expression(index->array);
+        index->index = expression(index->index);
+        return index;
+    }
+    case NodeKind::ArrayLiteral: {
+        auto array = static_cast<ArrayLiteral*>(node);
+        for (auto& element : array->elements) element = expression(element);
+        return array;
+    }
+    case NodeKind::CoerceExpr: {
+        // a propagated constant may already be of the type, or widen now
+        auto coerce = static_cast<CoerceExpr*>(node);
+        coerce->expr = expression(coerce->expr);
+        if (coerce->expr->type == coerce->type) return coerce->expr;
+        auto num = as<NumberLiteral>(coerce->expr);
+        if (num && coerce->type == StaticType::Double) return arena.make<DoubleLiteral>(num->line, num->column, num->value);
+        return coerce;
+    }
+    default:
+        return node;
+    }
+}
+
+void Optimizer::bind(Symbol name, const ASTNode* value) {
+    if (scopes.empty()) return; // globals can be changed by any function
+    bool constant = level >= 2 && isLiteral(value) && !assigned.count(name);
+    bindings.push_back({ name, constant ? value : nullptr });
+}
+
+void Optimizer::collectAssignments(const NodeList& list) {
+    for (auto* node : list) collectAssignments(node);
+}
+
+void Optimizer::collectAssignments(const ASTNode* node) {
+    if (!node) return;
+
+    switch (node->kind) {
+    case NodeKind::AssignStmt: {
+        auto assign = static_cast<const AssignStmt*>(node);
+        assigned.insert(assign->name);
+        collectAssignments(assign->value);
+        break;
+    }
+    case NodeKind::IndexAssignStmt: {
+        auto assign = static_cast<const IndexAssignStmt*>(node);
+        assigned.insert(assign->name);
+        collectAssignments(assign->index);
+        collectAssignments(assign->value);
+        break;
+    }
+    case NodeKind::VarDecl:
+        collectAssignments(static_cast<const VarDecl*>(node)->initializer);
+        break;
+    case NodeKind::ExpressionStmt:
+        collectAssignments(static_cast<const ExpressionStmt*>(node)->expr);
+        break;
+    case NodeKind::PrintStmt:
+        collectAssignments(static_cast<const PrintStmt*>(node)->expression);
+        break;
+    case NodeKind::ReturnStmt:
+        collectAssignments(static_cast<const ReturnStmt*>(node)->expression);
+        break;
+    case NodeKind::BinaryExpr: {
+        while (auto bin = as<BinaryExpr>(node)) {
+            collectAssignments(bin->right);
+            node = bin->left;
+        }
+        collectAssignments(node);
+        break;
+    }
+    case NodeKind::CallExpr:
+        collectAssignments(static_cast<const CallExpr*>(node)->args);
+        break;
+    case NodeKind::IndexExpr: {
+        auto index = static_cast<const IndexExpr*>(node);
+        collectAssignments(index->array);
+        collectAssignments(index->index);
+        break;
+    }
+    case NodeKind::ArrayLiteral:
+        collectAssignments(static_cast<const ArrayLiteral*>(node)->elements);
+        break;
+    case NodeKind::CoerceExpr:
+        collectAssignments(static_cast<const CoerceExpr*>(node)->expr);
+        break;
+    case NodeKind::WhileStmt: {
+        auto whileStmt = static_cast<const WhileStmt*>(node);
+        collectAssignments(whileStmt->condition);
+        collectAssignments(whileStmt->body);
+        break;
+    }
+    case NodeKind::ForStmt: {
+        auto forStmt = static_cast<const ForStmt*>(node);
+        collectAssignments(forStmt->init);
+        collectAssignments(forStmt->condition);
+        collectAssignments(forStmt->increment);
+        collectAssignments(forStmt->body);
+        break;
+    }
+    case NodeKind::ForEachStmt: {
+        auto forEach = static_cast<const ForEachStmt*>(node);
+        collectAssignments(forEach->iterable);
+        collectAssignments(forEach->body);
+        break;
+    }
+    default:
+        break;
+    }
+}
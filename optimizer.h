@@ -0,0 +1,42 @@
+// optimizer.h
+#pragma once
+#include "parser.h"
+#include <unordered_set>
+#include <vector>
+
+// AST-to-AST pass run on each top-level node before it reaches the Interpreter.
+//   level 0: nothing
+//   level 1: fold constant expressions, drop statements after a return, break
+//            or continue, and loops whose condition folds to 0
+//   level 2: also propagate locals that are initialized with a constant and
+//            never reassigned (every `const`, and any `let` that qualifies)
+// Nodes are rewritten in place; new nodes come from the parser's arena.
+class Optimizer {
+public:
+    Optimizer(Arena& arena, int level = 2) : arena(arena), level(level) {}
+
+    // returns the node to run instead, or null if nothing is left of it
+    ASTNode* optimize(ASTNode* node);
+
+private:
+    struct Binding {
+        Symbol name;
+        const ASTNode* literal; // null unless the name always holds this literal
+    };
+
+    Arena& arena;
+    int level;
+    std::vector<Binding> bindings;
+    std::vector<size_t> scopes;
+    std::unordered_set<Symbol> assigned;
+
+    void function(FunctionDecl* func);
+    NodeList statements(NodeList list);
+    NodeList block(NodeList list);
+    ASTNode* statement(ASTNode* node);
+    ASTNode* expression(ASTNode* node);
+
+    void bind(Symbol name, const ASTNode* value);
+    void collectAssignments(const ASTNode* node);
+    void collectAssignments(const NodeList& list);
+};
@@ -0,0 +1,93 @@
+// output.cpp
+#include "output.h"
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+void FileDescriptorSink::write(const char* data, size_t size) {
+    while (size > 0) {
+#ifdef _WIN32
+        unsigned chunk = size > 0x40000000 ? 0x40000000u : static_cast<unsigned>(size);
+        int written = _write(fd, data, chunk);
+#else
+        ssize_t written = ::write(fd, data, size);
+#endif
+        if (written <= 0) throw std::runtime_error("Failed to write output");
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+}
+
+OutputSink& standardOutput() {
+    static FileDescriptorSink sink(1);
+    return sink;
+}
+
+char* Output::reserve(size_t n) {
+    if (buffer.size() - used < n) flush();
+    return buffer.data() + used;
+}
+
+void Output::write(const char* data, size_t size) {
+    if (size > buffer.size()) {
+        // too big to be worth copying
+        flush();
+        sink->write(data, size);
+        return;
+    }
+    std::memcpy(reserve(size), data, size);
+    used += size;
+}
+
+void Output::writeInt(int v) {
+    char* at = reserve(16);
+    used = std::to_chars(at, at + 16, v).ptr - buffer.data();
+}
+
+void Output::writeDouble(double v) {
+    // shortest text that reads back as the same double
+    char* at = reserve(32);
+    used = std::to_chars(at, at + 32, v).ptr - buffer.data();
+}
+
+void Output::writeValue(const Value& v) {
+    switch (v.kind()) {
+    case ValueType::Int:
+        writeInt(v.asInt());
+        break;
+    case ValueType::Double:
+        writeDouble(v.asDouble());
+        break;
+    case ValueType::Bool:
+        if (v.asBool()) write("true", 4);
+        else write("false", 5);
+        break;
+    case ValueType::String: {
+        std::string_view text = v.text();
+        write(text.data(), text.size());
+        break;
+    }
+    case ValueType::Array: {
+        put('[');
+        const auto& items = v.items();
+        for (size_t i = 0; i < items.size(); ++i) {
+            if (i) write(", ", 2);
+            writeInt(items[i]);
+        }
+        put(']');
+        break;
+    }
+    }
+}
+
+void Output::flush() {
+    if (used == 0) return;
+    size_t size = used;
+    used = 0; // a throwing sink must not see the same bytes again
+    sink->write(buffer.data(), size);
+}
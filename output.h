@@ -0,0 +1,78 @@
+// output.h
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "value.h"
+
+// Destination for print() output. Only whole buffers reach a sink, so write()
+// can afford a system call.
+class OutputSink {
+public:
+    virtual ~OutputSink() = default;
+    virtual void write(const char* data, size_t size) = 0;
+};
+
+// Writes straight to a file descriptor (1 is stdout) with the OS call, no stdio.
+class FileDescriptorSink : public OutputSink {
+public:
+    explicit FileDescriptorSink(int fd) : fd(fd) {}
+    void write(const char* data, size_t size) override;
+
+private:
+    int fd;
+};
+
+// Collects everything in memory, for embedders and tests.
+class MemorySink : public OutputSink {
+public:
+    void write(const char* data, size_t size) override { text.append(data, size); }
+    const std::string& str() const { return text; }
+    void clear() { text.clear(); }
+
+private:
+    std::string text;
+};
+
+// process-wide sink for fd 1
+OutputSink& standardOutput();
+
+// Buffers formatted output and hands it to the sink when the buffer fills,
+// on flush(), or when the Output is destroyed.
+class Output {
+public:
+    // capacity is at least enough for any single formatted number
+    explicit Output(OutputSink& sink, size_t capacity = 64 * 1024)
+        : sink(&sink), buffer(capacity < 64 ? 64 : capacity) {}
+    ~Output() {
+        try { flush(); }
+        catch (...) {} // a destructor has nowhere to report a failed write
+    }
+    Output(const Output&) = delete;
+    Output& operator=(const Output&) = delete;
+
+    // pending output goes to the old sink first
+    void setSink(OutputSink& next) {
+        flush();
+        sink = &next;
+    }
+
+    void put(char c) {
+        if (used == buffer.size()) flush();
+        buffer[used++] = c;
+    }
+
+    void write(const char* data, size_t size);
+    void writeInt(int v);
+    void writeDouble(double v);
+    void writeValue(const Value& v);
+    void flush();
+
+private:
+    OutputSink* sink;
+    std::vector<char> buffer;
+    size_t used = 0;
+
+    // room for n more bytes, flushing first if needed
+    char* reserve(size_t n);
+};
@@ -1,332 +1,349 @@
 // parser.cpp
 #include "parser.h"
+#include <charconv>
 #include <iostream>
 
 void Parser::advance() {
-    currentToken = lexer.nextToken();
+    tokens.advance();
 }
 
 void Parser::expect(token_type type, const std::string& msg) {
-    if (currentToken.type != type) {
-        throw std::runtime_error(msg + ". Got: " + tokenTypeToString(currentToken.type) + " at line " + std::to_string(currentToken.line) + ":" + std::to_string(currentToken.column));
+    if (tokens.type() != type) {
+        throw std::runtime_error(msg + ". Got: " + tokenTypeToString(tokens.type()) + " at line " + std::to_string(tokens.line()) + ":" + std::to_string(tokens.column()));
     }
     advance();
 }
 
-std::string Parser::parseType() {
-    if (currentToken.type != token_type::Int && currentToken.type != token_type::Double && currentToken.type != token_type::Bool) {
-        throw std::runtime_error("Expected type. Got: " + tokenTypeToString(currentToken.type));
+// `string` is a name anywhere but here, so it isn't a keyword
+static bool isTypeName(const TokenBuffer& tokens) {
+    switch (tokens.type()) {
+    case token_type::Int: case token_type::Double: case token_type::Bool: return true;
+    case token_type::Identifier: return tokens.lexeme() == "string";
+    default: return false;
     }
-    std::string type = currentToken.lexeme;
+}
+
+Symbol Parser::parseType() {
+    if (!isTypeName(tokens)) {
+        throw std::runtime_error("Expected type. Got: " + tokenTypeToString(tokens.type()));
+    }
+    std::string type(tokens.lexeme());
     advance();
-    if (currentToken.type == token_type::LBracket) {
+    if (tokens.type() == token_type::LBracket) {
         advance();
         expect(token_type::RBracket, "Expected ']' after '[' in type");
         type += "[]";
     }
-    return type;
+    return intern(type);
 }
 
-std::pair<std::string, std::string> Parser::parseParam() {
-    if (currentToken.type != token_type::Identifier) {
+Param Parser::parseParam() {
+    if (tokens.type() != token_type::Identifier) {
         throw std::runtime_error("Expected identifier in parameter");
     }
-    std::string name = currentToken.lexeme;
-    int line = currentToken.line, col = currentToken.column;
+    Symbol name = intern(tokens.lexeme());
     advance();
     expect(token_type::Colon, "Expected colon after parameter name");
-    std::string type = parseType();
+    Symbol type = parseType();
     return { name, type };
 }
 
-std::vector<std::shared_ptr<ASTNode>> Parser::parseBlock() {
-    expect(token_type::LBrace, "Expected '{' to start block");
-    std::vector<std::shared_ptr<ASTNode>> body;
+// `let name: type = expr` or `const name: type = expr`, without the trailing ';'.
+// In a for header it may stop before `in`, leaving the initializer null.
+VarDecl* Parser::parseVarDecl(bool inForHeader) {
+    int line = tokens.line(), col = tokens.column();
+    bool isConst = tokens.type() == token_type::Const;
+    advance();
+    if (tokens.type() != token_type::Identifier)
+        throw std::runtime_error(std::string("Expected identifier after '") + (isConst ? "const" : "let") + "'");
+    Symbol name = intern(tokens.lexeme());
+    advance();
+    expect(token_type::Colon, "Expected ':' after variable name");
+    Symbol type = parseType();
+    auto varDecl = arena.make<VarDecl>(line, col, name);
+    varDecl->type = type;
+    varDecl->isConst = isConst;
+    if (inForHeader && tokens.type() == token_type::In) return varDecl;
+    expect(token_type::Equal, "Expected '=' after type");
+    varDecl->initializer = parseExpression();
+    return varDecl;
+}
 
-    while (currentToken.type != token_type::RBrace && currentToken.type != token_type::End) {
-        if (currentToken.type == token_type::Return) {
-            int line = currentToken.line;
-            int col = currentToken.column;
-            advance();
-            auto expr = parseExpression();
-            expect(token_type::Semicolon, "Expected ';' after return");
-            auto returnNode = std::make_shared<ReturnStmt>(line, col);
-            returnNode->expression = expr;
-            body.push_back(returnNode);
-        }
-        else if (currentToken.type == token_type::For) {
-            auto forStmt = parseStatement();
-            body.push_back(forStmt);
-        }
-        else if (currentToken.type == token_type::While) {
-            auto whileStmt = parseStatement();
-            body.push_back(whileStmt);
-        }
-        else if (currentToken.type == token_type::Print) {
-            int line = currentToken.line;
-            int col = currentToken.column;
-            advance();
-            expect(token_type::LParen, "Expected '(' after print");
-            auto expr = parseExpression();
-            expect(token_type::RParen, "Expected ')' after print expression");
-            expect(token_type::Semicolon, "Expected ';' after print");
-            auto printNode = std::make_shared<PrintStmt>(line, col);
-            printNode->expression = expr;
-            body.push_back(printNode);
-        }
-        else if (currentToken.type == token_type::Let) {
-            int line = currentToken.line;
-            int col = currentToken.column;
-            advance();
-            std::string name = currentToken.lexeme;
-            advance();
-            expect(token_type::Colon, "Expected ':' after variable name");
-            std::string type = parseType();
-            expect(token_type::Equal, "Expected '=' after type");
-            auto initializer = parseExpression();
-            expect(token_type::Semicolon, "Expected ';' after variable declaration");
-            auto varDecl = std::make_shared<VarDecl>(line, col, name);
-            varDecl->type = type;
-            varDecl->initializer = initializer;
-            body.push_back(varDecl);
-        }
-        else if (currentToken.type == token_type::Identifier) {
-            std::string name = currentToken.lexeme;
-            int line = currentToken.line;
-            int col = currentToken.column;
-            advance();
-            if (currentToken.type == token_type::Equal) {
-                advance();
-                auto value = parseExpression();
-                expect(token_type::Semicolon, "Expected ';' after assignment");
-                auto assign = std::make_shared<AssignStmt>(line, col, name);
-                assign->value = value;
-                body.push_back(assign);
-            }
-            else {
-                auto exprStmt = std::make_shared<ExpressionStmt>(line, col);
-                exprStmt->expr = parseExpression();
-                expect(token_type::Semicolon, "Expected ';' after expression");
-                body.push_back(exprStmt);
-            }
-        }
-        else {
-            throw std::runtime_error(
-                "Unsupported statement in block: " +
-                tokenTypeToString(currentToken.type) +
-                " ('" + currentToken.lexeme + "') at line " +
-                std::to_string(currentToken.line) + ":" +
-                std::to_string(currentToken.column)
-            );
-        }
+NodeList Parser::parseBlock() {
+    expect(token_type::LBrace, "Expected '{' to start block");
+    std::vector<ASTNode*> body;
+    while (tokens.type() != token_type::RBrace && tokens.type() != token_type::End) {
+        body.push_back(parseStatement());
     }
     expect(token_type::RBrace, "Expected '}' to end block");
+    return arena.copy(body);
+}
+
+// body of a for/while, where break and continue are allowed
+NodeList Parser::parseLoopBody() {
+    ++loopDepth;
+    NodeList body = parseBlock();
+    --loopDepth;
     return body;
 }
 
-std::shared_ptr<ASTNode> Parser::parseBinaryExpression()
+static bool binaryOpFor(token_type type, BinaryOp& op) {
+    switch (type) {
+    case token_type::Plus: op = BinaryOp::Add; return true;
+    case token_type::Minus: op = BinaryOp::Sub; return true;
+    case token_type::Star: op = BinaryOp::Mul; return true;
+    case token_type::Slash: op = BinaryOp::Div; return true;
+    case token_type::Less: op = BinaryOp::Less; return true;
+    case token_type::LessEqual: op = BinaryOp::LessEqual; return true;
+    case token_type::Greater: op = BinaryOp::Greater; return true;
+    case token_type::GreaterEqual: op = BinaryOp::GreaterEqual; return true;
+    case token_type::EqualEqual: op = BinaryOp::Equal; return true;
+    case token_type::BangEqual: op = BinaryOp::NotEqual; return true;
+    default: return false;
+    }
+}
+
+// literal-only subtrees are folded as they are built
+ASTNode* Parser::makeBinary(int line, int col, BinaryOp op, ASTNode* left, ASTNode* right) {
+    if (auto folded = foldLiterals(arena, line, col, op, left, right)) return folded;
+    auto bin = arena.make<BinaryExpr>(line, col, op);
+    bin->left = left;
+    bin->right = right;
+    return bin;
+}
+
+// C's ordering: comparisons below arithmetic, equality below both
+static int precedence(BinaryOp op) {
+    switch (op) {
+    case BinaryOp::Equal: case BinaryOp::NotEqual: return 1;
+    case BinaryOp::Less: case BinaryOp::LessEqual:
+    case BinaryOp::Greater: case BinaryOp::GreaterEqual: return 2;
+    case BinaryOp::Add: case BinaryOp::Sub: return 3;
+    case BinaryOp::Mul: case BinaryOp::Div: return 4;
+    }
+    return 0;
+}
+
+// Precedence climbing. Operators of one level are gathered by the loop, so
+// chains are left-associative and cost no stack; only a tighter operator on
+// the right recurses, which bounds the depth by the number of levels.
+ASTNode* Parser::parseBinaryExpression(int minPrecedence)
 {
-    std::shared_ptr<ASTNode> left;
+    ASTNode* left = parsePrimary();
+
+    BinaryOp op;
+    while (binaryOpFor(tokens.type(), op) && precedence(op) >= minPrecedence) {
+        int line = tokens.line();
+        int col = tokens.column();
+        advance();
+        auto right = parseBinaryExpression(precedence(op) + 1);
+        left = makeBinary(line, col, op, left, right);
+    }
+
+    return left;
+}
 
-    // std::cout << "parseExpression: token = " << tokenTypeToString(currentToken.type) << std::endl;
+// The text of a string token, quotes stripped: \n, \t, \r and \0 name control
+// characters, and a backslash before anything else stands for that character.
+static std::string unescape(std::string_view lexeme) {
+    std::string_view body = lexeme.substr(1, lexeme.size() - 2);
+    std::string text;
+    text.reserve(body.size());
+    for (size_t i = 0; i < body.size(); ++i) {
+        char c = body[i];
+        if (c == '\\' && i + 1 < body.size()) {
+            switch (c = body[++i]) {
+            case 'n': c = '\n'; break;
+            case 't': c = '\t'; break;
+            case 'r': c = '\r'; break;
+            case '0': c = '\0'; break;
+            default: break;
+            }
+        }
+        text += c;
+    }
+    return text;
+}
 
-    if (currentToken.type == token_type::Identifier) {
-        left = std::make_shared<Identifier>(
-            currentToken.line, currentToken.column, currentToken.lexeme
+// a literal, name, call, index, array literal or parenthesized expression
+ASTNode* Parser::parsePrimary()
+{
+    ASTNode* left;
+
+    if (tokens.type() == token_type::Identifier) {
+        left = arena.make<Identifier>(
+            tokens.line(), tokens.column(), intern(tokens.lexeme())
         );
         advance();
 
         while (true) {
-            if (currentToken.type == token_type::LParen) {
+            if (tokens.type() == token_type::LParen) {
                 // Function call
-                int line = currentToken.line, col = currentToken.column;
+                int line = tokens.line(), col = tokens.column();
                 advance(); // consume '('
-                std::vector<std::shared_ptr<ASTNode>> args;
-                if (currentToken.type != token_type::RParen) {
-                    do {
-                        args.push_back(parseExpression());
-                        if (currentToken.type == token_type::Comma)
-                            advance();
-                        else
-                            break;
-                    } while (true);
-                }
-                expect(token_type::RParen, "Expected ')' after function call");
-                std::string funcName = std::dynamic_pointer_cast<Identifier>(left)->name;
-                left = std::make_shared<CallExpr>(line, col, funcName);
-                std::static_pointer_cast<CallExpr>(left)->args = args;
+                NodeList args = parseArguments(token_type::RParen, "Expected ')' after function call");
+                auto ident = as<Identifier>(left);
+                if (!ident)
+                    throw std::runtime_error("Only named functions can be called at line " + std::to_string(line) + ":" + std::to_string(col));
+                auto callNode = arena.make<CallExpr>(line, col, ident->name);
+                callNode->args = args;
+                left = callNode;
             }
-            else if (currentToken.type == token_type::LBracket) {
-                int line = currentToken.line, col = currentToken.column;
+            else if (tokens.type() == token_type::LBracket) {
+                int line = tokens.line(), col = tokens.column();
                 advance();
                 auto indexExpr = parseExpression();
                 expect(token_type::RBracket, "Expected ']' after array index");
-                left = std::make_shared<IndexExpr>(line, col, left, indexExpr);
+                left = arena.make<IndexExpr>(line, col, left, indexExpr);
             }
             else {
                 break;
             }
         }
     }
-    else if (currentToken.type == token_type::Number) {
-        int value = std::stoi(currentToken.lexeme);
-        left = std::make_shared<NumberLiteral>(currentToken.line, currentToken.column, value);
+    else if (tokens.type() == token_type::Number) {
+        const char* first = tokens.lexeme().data();
+        const char* last = first + tokens.lexeme().size();
+        std::errc ec;
+        if (tokens.lexeme().find('.') != std::string_view::npos) {
+            double value = 0;
+            ec = std::from_chars(first, last, value).ec;
+            left = arena.make<DoubleLiteral>(tokens.line(), tokens.column(), value);
+        }
+        else {
+            int value = 0;
+            ec = std::from_chars(first, last, value).ec;
+            left = arena.make<NumberLiteral>(tokens.line(), tokens.column(), value);
+        }
+        if (ec != std::errc())
+            throw std::runtime_error("Invalid number literal '" + std::string(tokens.lexeme()) + "' at line " + std::to_string(tokens.line()) + ":" + std::to_string(tokens.column()));
+        advance();
+    }
+    else if (tokens.type() == token_type::String) {
+        left = arena.make<StringLiteral>(tokens.line(), tokens.column(), intern(unescape(tokens.lexeme())));
+        advance();
+    }
+    else if (tokens.type() == token_type::True || tokens.type() == token_type::False) {
+        left = arena.make<BoolLiteral>(tokens.line(), tokens.column(), tokens.type() == token_type::True);
         advance();
     }
-    else if (currentToken.type == token_type::LParen) {
+    else if (tokens.type() == token_type::LParen) {
         advance();
         left = parseExpression();
         expect(token_type::RParen, "Expected ')' after expression");
     }
-    else if (currentToken.type == token_type::LBracket) {
-        int line = currentToken.line, col = currentToken.column;
+    else if (tokens.type() == token_type::LBracket) {
+        int line = tokens.line(), col = tokens.column();
         advance();
-        std::vector<std::shared_ptr<ASTNode>> elements;
-        if (currentToken.type != token_type::RBracket) {
-            do {
-                elements.push_back(parseExpression());
-                if (currentToken.type == token_type::Comma)
-                    advance();
-                else
-                    break;
-            } while (true);
-        }
-        expect(token_type::RBracket, "Expected ']' after array literal");
-        left = std::make_shared<ArrayLiteral>(line, col, elements);
+        NodeList elements = parseArguments(token_type::RBracket, "Expected ']' after array literal");
+        left = arena.make<ArrayLiteral>(line, col, elements);
     }
     else {
-        throw std::runtime_error("Unsupported expression: " + tokenTypeToString(currentToken.type) + " '" + currentToken.lexeme + "'");
-    }
-
-    while (currentToken.type == token_type::Plus ||
-        currentToken.type == token_type::Minus ||
-        currentToken.type == token_type::Star ||
-        currentToken.type == token_type::Slash ||
-        currentToken.type == token_type::Less ||
-        currentToken.type == token_type::Greater ||
-        currentToken.type == token_type::EqualEqual ||
-        currentToken.type == token_type::BangEqual ||
-        currentToken.type == token_type::LessEqual ||
-        currentToken.type == token_type::GreaterEqual) {
-        std::string op = currentToken.lexeme;
-        int line = currentToken.line;
-        int col = currentToken.column;
-        advance();
-        auto right = parseExpression();
-        auto binExpr = std::make_shared<BinaryExpr>(line, col, op);
-        binExpr->left = left;
-        binExpr->right = right;
-        left = binExpr;
+        throw std::runtime_error("Unsupported expression: " + tokenTypeToString(tokens.type()) + " '" + std::string(tokens.lexeme()) + "'");
     }
 
     return left;
 }
 
-std::shared_ptr<ASTNode> Parser::parseStatement() {
-    if (currentToken.type == token_type::Return) {
-        int line = currentToken.line, col = currentToken.column;
+// the tokens parsePrimary accepts first
+static bool startsExpression(token_type type) {
+    switch (type) {
+    case token_type::Identifier: case token_type::Number: case token_type::String:
+    case token_type::True: case token_type::False: case token_type::LParen: case token_type::LBracket:
+        return true;
+    default:
+        return false;
+    }
+}
+
+ASTNode* Parser::parseStatement() {
+    if (tokens.type() == token_type::Return) {
+        int line = tokens.line(), col = tokens.column();
         advance();
         auto expr = parseExpression();
         expect(token_type::Semicolon, "Expected ';' after return");
-        auto returnNode = std::make_shared<ReturnStmt>(line, col);
+        auto returnNode = arena.make<ReturnStmt>(line, col);
         returnNode->expression = expr;
         return returnNode;
     }
-    else if (currentToken.type == token_type::Print) {
-        int line = currentToken.line, col = currentToken.column;
+    else if (tokens.type() == token_type::Print) {
+        int line = tokens.line(), col = tokens.column();
         advance();
         expect(token_type::LParen, "Expected '(' after print");
         auto expr = parseExpression();
         expect(token_type::RParen, "Expected ')' after print expression");
         expect(token_type::Semicolon, "Expected ';' after print");
-        auto printNode = std::make_shared<PrintStmt>(line, col);
+        auto printNode = arena.make<PrintStmt>(line, col);
         printNode->expression = expr;
         return printNode;
     }
-    else if (currentToken.type == token_type::Let) {
-        int line = currentToken.line, col = currentToken.column;
-        advance();
-        if (currentToken.type != token_type::Identifier)
-            throw std::runtime_error("Expected identifier after 'let'");
-        std::string name = currentToken.lexeme;
-        advance();
-        expect(token_type::Colon, "Expected ':' after variable name");
-        std::string type = parseType();
-        expect(token_type::Equal, "Expected '=' after type");
-        auto initializer = parseExpression();
+    else if (tokens.type() == token_type::Let || tokens.type() == token_type::Const) {
+        auto varDecl = parseVarDecl();
         expect(token_type::Semicolon, "Expected ';' after variable declaration");
-        auto varDecl = std::make_shared<VarDecl>(line, col, name);
-        varDecl->type = type;
-        varDecl->initializer = initializer;
         return varDecl;
     }
-    else if (currentToken.type == token_type::Identifier) {
-        std::string name = currentToken.lexeme;
-        int line = currentToken.line, col = currentToken.column;
+    else if (tokens.type() == token_type::Break || tokens.type() == token_type::Continue) {
+        bool isBreak = tokens.type() == token_type::Break;
+        int line = tokens.line(), col = tokens.column();
+        if (loopDepth == 0)
+            throw std::runtime_error(std::string("'") + (isBreak ? "break" : "continue") + "' outside of a loop at line " + std::to_string(line) + ":" + std::to_string(col));
         advance();
-        if (currentToken.type == token_type::Equal) {
+        expect(token_type::Semicolon, isBreak ? "Expected ';' after break" : "Expected ';' after continue");
+        if (isBreak) return arena.make<BreakStmt>(line, col);
+        return arena.make<ContinueStmt>(line, col);
+    }
+    else if (startsExpression(tokens.type())) {
+        // assignments, ++/-- and calls all come back from parseExpression, as
+        // do the bare literals and arithmetic the REPL evaluates
+        int line = tokens.line(), col = tokens.column();
+        if (tokens.type() == token_type::Identifier && tokens.type(1) == token_type::Equal) {
+            // `name = value;`, the most common statement, skips the expression parser for its target
+            auto assign = arena.make<AssignStmt>(tokens.line(1), tokens.column(1), intern(tokens.lexeme()));
             advance();
-            auto value = parseExpression();
-            expect(token_type::Semicolon, "Expected ';' after assignment");
-            auto assign = std::make_shared<AssignStmt>(line, col, name);
-            assign->value = value;
-            return assign;
-        }
-        else if (currentToken.type == token_type::LParen) {
             advance();
-            std::vector<std::shared_ptr<ASTNode>> args;
-            if (currentToken.type != token_type::RParen) {
-                do {
-                    args.push_back(parseExpression());
-                    if (currentToken.type == token_type::Comma)
-                        advance();
-                    else
-                        break;
-                } while (true);
-            }
-            expect(token_type::RParen, "Expected ')' after function call");
-            expect(token_type::Semicolon, "Expected ';' after function call");
-            auto call = std::make_shared<CallExpr>(line, col, name);
-            call->args = args;
-            return call;
-        }
-        else {
-            auto exprStmt = std::make_shared<ExpressionStmt>(line, col);
-            exprStmt->expr = std::make_shared<Identifier>(line, col, name);
+            assign->value = parseExpression();
             expect(token_type::Semicolon, "Expected ';' after expression");
-            return exprStmt;
+            return assign;
         }
+        auto expr = parseExpression();
+        expect(token_type::Semicolon, "Expected ';' after expression");
+        if (expr->kind == NodeKind::AssignStmt || expr->kind == NodeKind::IndexAssignStmt ||
+            expr->kind == NodeKind::CallExpr) return expr;
+        auto exprStmt = arena.make<ExpressionStmt>(line, col);
+        exprStmt->expr = expr;
+        return exprStmt;
     }
-    else if (currentToken.type == token_type::For) {
-        int line = currentToken.line, col = currentToken.column;
+    else if (tokens.type() == token_type::For) {
+        int line = tokens.line(), col = tokens.column();
         advance();
         expect(token_type::LParen, "Expected '(' after for");
 
-        std::shared_ptr<ASTNode> init = nullptr;
-        if (currentToken.type != token_type::Semicolon) {
-            if (currentToken.type == token_type::Let) {
-                int vline = currentToken.line, vcol = currentToken.column;
-                advance();
-                if (currentToken.type != token_type::Identifier)
-                    throw std::runtime_error("Expected identifier after 'let'");
-                std::string name = currentToken.lexeme;
-                advance();
-                expect(token_type::Colon, "Expected ':' after variable name");
-                std::string type = parseType();
-                expect(token_type::Equal, "Expected '=' after type");
-                auto initializer = parseExpression();
-                init = std::make_shared<VarDecl>(vline, vcol, name);
-                std::static_pointer_cast<VarDecl>(init)->type = type;
-                std::static_pointer_cast<VarDecl>(init)->initializer = initializer;
+        ASTNode* init = nullptr;
+        if (tokens.type() != token_type::Semicolon) {
+            if (tokens.type() == token_type::Let || tokens.type() == token_type::Const) {
+                VarDecl* var = parseVarDecl(true);
+                if (!var->initializer) {
+                    // for (let x: int in iterable) { ... }
+                    advance();
+                    auto node = arena.make<ForEachStmt>(line, col);
+                    node->varName = var->name;
+                    node->varType = var->type;
+                    node->iterable = parseExpression();
+                    expect(token_type::RParen, "Expected ')' after for-in iterable");
+                    node->body = parseLoopBody();
+                    return node;
+                }
+                init = var;
             }
-            else if (currentToken.type == token_type::Identifier) {
-                std::string name = currentToken.lexeme;
-                int aline = currentToken.line, acol = currentToken.column;
+            else if (tokens.type() == token_type::Identifier) {
+                Symbol name = intern(tokens.lexeme());
+                int aline = tokens.line(), acol = tokens.column();
                 advance();
                 expect(token_type::Equal, "Expected '=' after variable name");
                 auto value = parseExpression();
-                init = std::make_shared<AssignStmt>(aline, acol, name);
-                std::static_pointer_cast<AssignStmt>(init)->value = value;
+                auto assign = arena.make<AssignStmt>(aline, acol, name);
+                assign->value = value;
+                init = assign;
             }
             else {
                 throw std::runtime_error("Unsupported for-loop initializer");
@@ -337,87 +354,116 @@ std::shared_ptr<ASTNode> Parser::parseStatement() {
             advance();
         }
 
-        std::shared_ptr<ASTNode> condition = nullptr;
-        if (currentToken.type != token_type::Semicolon) {
+        ASTNode* condition = nullptr;
+        if (tokens.type() != token_type::Semicolon) {
             condition = parseExpression();
         }
         
         expect(token_type::Semicolon, "Expected ';' after for condition");
 
-        std::shared_ptr<ASTNode> increment = nullptr;
-        if (currentToken.type != token_type::RParen) {
+        ASTNode* increment = nullptr;
+        if (tokens.type() != token_type::RParen) {
             increment = parseExpression();
         }
         expect(token_type::RParen, "Expected ')' after for increment");
 
-        auto body = parseBlock();
-        auto node = std::make_shared<ForStmt>(line, col);
+        auto body = parseLoopBody();
+        auto node = arena.make<ForStmt>(line, col);
         node->init = init;
         node->condition = condition;
         node->increment = increment;
         node->body = body;
         return node;
     }
-    else if (currentToken.type == token_type::While) {
-        int line = currentToken.line, col = currentToken.column;
+    else if (tokens.type() == token_type::While) {
+        int line = tokens.line(), col = tokens.column();
         advance();
         expect(token_type::LParen, "Expected '(' after while");
         auto condition = parseExpression();
         expect(token_type::RParen, "Expected ')' after while");
-        auto body = parseBlock();
-        auto node = std::make_shared<WhileStmt>(line, col);
+        auto body = parseLoopBody();
+        auto node = arena.make<WhileStmt>(line, col);
         node->condition = condition;
         node->body = body;
         return node;
     }
     else {
-        throw std::runtime_error("Unsupported statement at top level");
+        throw std::runtime_error(
+            "Unsupported statement: " +
+            tokenTypeToString(tokens.type()) +
+            " ('" + std::string(tokens.lexeme()) + "') at line " +
+            std::to_string(tokens.line()) + ":" +
+            std::to_string(tokens.column())
+        );
     }
 }
 
-std::shared_ptr<ASTNode> Parser::parseTopLevel() {
-    if (currentToken.type == token_type::Function) {
+ASTNode* Parser::parseTopLevel() {
+    if (tokens.type() == token_type::Function) {
         return parseFunction();
     }
 
     return parseStatement();
 }
 
+NodeList Parser::parseArguments(token_type close, const char* msg) {
+    std::vector<ASTNode*> items;
+    if (tokens.type() != close) {
+        do {
+            items.push_back(parseExpression());
+            if (tokens.type() == token_type::Comma)
+                advance();
+            else
+                break;
+        } while (true);
+    }
+    expect(close, msg);
+    return arena.copy(items);
+}
+
 bool Parser::isAtEnd() const {
-    return currentToken.type == token_type::End;
+    return tokens.type() == token_type::End;
 }
 
-std::shared_ptr<ASTNode> Parser::parseExpression() {
+ASTNode* Parser::parseExpression() {
     auto left = parseBinaryExpression();
 
-    if (currentToken.type == token_type::Equal) {
-        auto ident = std::dynamic_pointer_cast<Identifier>(left);
+    if (tokens.type() == token_type::Equal) {
+        int line = tokens.line();
+        int col = tokens.column();
+        if (auto index = as<IndexExpr>(left)) {
+            auto array = as<Identifier>(index->array);
+            if (!array)
+                throw std::runtime_error("Only named arrays can be assigned into at line " + std::to_string(line) + ":" + std::to_string(col));
+            advance();
+            auto assign = arena.make<IndexAssignStmt>(line, col, array->name);
+            assign->index = index->index;
+            assign->value = parseExpression();
+            return assign;
+        }
+        auto ident = as<Identifier>(left);
         if (!ident) {
             throw std::runtime_error("Left side of assignment must be an identifier");
         }
-        int line = currentToken.line;
-        int col = currentToken.column;
         advance();
         auto value = parseExpression();
-        auto assign = std::make_shared<AssignStmt>(line, col, ident->name);
+        auto assign = arena.make<AssignStmt>(line, col, ident->name);
         assign->value = value;
         return assign;
     }
 
-    if (currentToken.type == token_type::PlusPlus || currentToken.type == token_type::MinusMinus) {
-        auto ident = std::dynamic_pointer_cast<Identifier>(left);
+    if (tokens.type() == token_type::PlusPlus || tokens.type() == token_type::MinusMinus) {
+        auto ident = as<Identifier>(left);
         if (!ident) {
             throw std::runtime_error("Left side of increment/decrement must be an identifier");
         }
-        int line = currentToken.line;
-        int col = currentToken.column;
-        std::string op = (currentToken.type == token_type::PlusPlus) ? "+" : "-";
+        int line = tokens.line();
+        int col = tokens.column();
+        BinaryOp op = (tokens.type() == token_type::PlusPlus) ? BinaryOp::Add : BinaryOp::Sub;
         advance();
-        auto one = std::make_shared<NumberLiteral>(line, col, 1);
-        auto bin = std::make_shared<BinaryExpr>(line, col, op);
-        bin->left = left;
-        bin->right = one;
-        auto assign = std::make_shared<AssignStmt>(line, col, ident->name);
+        auto one = arena.make<NumberLiteral>(line, col, 1);
+        auto bin = makeBinary(line, col, op, left, one);
+        auto assign = arena.make<AssignStmt>(line, col, ident->name);
         assign->value = bin;
         return assign;
     }
@@ -425,22 +471,22 @@ std::shared_ptr<ASTNode> Parser::parseExpression() {
     return left;
 }
 
-std::shared_ptr<FunctionDecl> Parser::parseFunction() {
+FunctionDecl* Parser::parseFunction() {
     try {
         expect(token_type::Function, "Expected 'function' keyword");
-        if (currentToken.type != token_type::Identifier) {
+        if (tokens.type() != token_type::Identifier) {
             throw std::runtime_error("Expected function name");
         }
-        std::string name = currentToken.lexeme;
-        int line = currentToken.line, col = currentToken.column;
+        Symbol name = intern(tokens.lexeme());
+        int line = tokens.line(), col = tokens.column();
         advance();
         expect(token_type::LParen, "Expected '(' after function name");
 
-        std::vector<std::pair<std::string, std::string>> params;
-        if (currentToken.type != token_type::RParen) {
+        std::vector<Param> params;
+        if (tokens.type() != token_type::RParen) {
             while (true) {
                 params.push_back(parseParam());
-                if (currentToken.type == token_type::Comma) {
+                if (tokens.type() == token_type::Comma) {
                     advance(); // consume comma
                 }
                 else {
@@ -451,16 +497,16 @@ std::shared_ptr<FunctionDecl> Parser::parseFunction() {
         expect(token_type::RParen, "Expected ')' after parameters");
 
 
-        std::string returnType = "void";
-        if (currentToken.type == token_type::Colon) {
+        Symbol returnType = intern("void");
+        if (tokens.type() == token_type::Colon) {
             advance();
             returnType = parseType();
         }
 
         auto body = parseBlock();
 
-        auto func = std::make_shared<FunctionDecl>(line, col, name);
-        func->params = params;
+        auto func = arena.make<FunctionDecl>(line, col, name);
+        func->params = arena.copy(params);
         func->returnType = returnType;
         func->body = body;
         return func;
@@ -470,7 +516,7 @@ std::shared_ptr<FunctionDecl> Parser::parseFunction() {
     }
 }
 
-void Parser::printAST(const std::shared_ptr<ASTNode>& node, int indent) {
+void Parser::printAST(const ASTNode* node, int indent) {
     if (!node) {
         std::cout << "AST is empty!" << std::endl;
         return;
@@ -478,36 +524,51 @@ void Parser::printAST(const std::shared_ptr<ASTNode>& node, int indent) {
 
     std::string spacer(indent, ' ');
 
-    if (auto func = std::dynamic_pointer_cast<FunctionDecl>(node)) {
-        std::cout << spacer << "FunctionDecl " << func->name << "(";
+    switch (node->kind) {
+    case NodeKind::FunctionDecl: {
+        auto func = static_cast<const FunctionDecl*>(node);
+        std::cout << spacer << "FunctionDecl " << symbolName(func->name) << "(";
         bool first = true;
         for (const auto& [name, type] : func->params) {
             if (!first) std::cout << ", ";
-            std::cout << name << ":" << type;
+            std::cout << symbolName(name) << ":" << symbolName(type);
             first = false;
         }
-        std::cout << "):" << func->returnType << std::endl;
-		for (const auto& stmt : func->body) {
-			printAST(stmt, indent + 2);
-		}
+        std::cout << "):" << symbolName(func->returnType) << std::endl;
+        for (const auto* stmt : func->body) {
+            printAST(stmt, indent + 2);
+        }
+        break;
     }
-    else if (auto ret = std::dynamic_pointer_cast<ReturnStmt>(node)) {
+    case NodeKind::ReturnStmt:
         std::cout << spacer << "ReturnStmt" << std::endl;
-        printAST(ret->expression, indent + 2);
-    }
-    else if (auto print = std::dynamic_pointer_cast<PrintStmt>(node)) {
+        printAST(static_cast<const ReturnStmt*>(node)->expression, indent + 2);
+        break;
+    case NodeKind::PrintStmt:
         std::cout << spacer << "PrintStmt" << std::endl;
-        printAST(print->expression, indent + 2);
-    }
-    else if (auto bin = std::dynamic_pointer_cast<BinaryExpr>(node)) {
-        std::cout << spacer << "BinaryExpr: " << bin->op << std::endl;
+        printAST(static_cast<const PrintStmt*>(node)->expression, indent + 2);
+        break;
+    case NodeKind::BinaryExpr: {
+        auto bin = static_cast<const BinaryExpr*>(node);
+        std::cout << spacer << "BinaryExpr: " << binaryOpToString(bin->op) << std::endl;
         printAST(bin->left, indent + 2);
         printAST(bin->right, indent + 2);
+        break;
     }
-    else if (auto ident = std::dynamic_pointer_cast<Identifier>(node)) {
-        std::cout << spacer << "Identifier: " << ident->name << std::endl;
-    }
-    else {
+    case NodeKind::Identifier:
+        std::cout << spacer << "Identifier: " << symbolName(static_cast<const Identifier*>(node)->name) << std::endl;
+        break;
+    case NodeKind::StringLiteral:
+        std::cout << spacer << "StringLiteral: \"" << symbolName(static_cast<const StringLiteral*>(node)->text) << "\"" << std::endl;
+        break;
+    case NodeKind::BreakStmt:
+        std::cout << spacer << "BreakStmt" << std::endl;
+        break;
+    case NodeKind::ContinueStmt:
+        std::cout << spacer << "ContinueStmt" << std::endl;
+        break;
+    default:
         std::cout << spacer << "Unknown node type" << std::endl;
+        break;
     }
 }
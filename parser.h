@@ -1,151 +1,390 @@
 // parser.h
 #pragma once
 #include "lexer.h"
+#include "tokenbuffer.h"
+#include "symbols.h"
+#include "arena.h"
+#include "value.h"
 #include <vector>
-#include <memory>
 #include <string>
 #include <stdexcept>
 
+// Every node lives in the Arena handed to the Parser and is freed with it.
+// Nodes are plain structs tagged with a kind, so dispatch is a switch.
+enum class NodeKind : uint8_t {
+    FunctionDecl, ReturnStmt, PrintStmt, BinaryExpr, Identifier,
+    VarDecl, AssignStmt, ExpressionStmt, NumberLiteral, ForStmt,
+    ForEachStmt, WhileStmt, IndexExpr, CallExpr, ArrayLiteral,
+    BreakStmt, ContinueStmt, IndexAssignStmt, DoubleLiteral, BoolLiteral,
+    CoerceExpr, StringLiteral
+};
+
 struct ASTNode {
-    virtual ~ASTNode() = default;
+    NodeKind kind;
+    StaticType type = StaticType::Unknown; // set by the TypeChecker on expressions
     int line;
     int column;
-    std::string typeName;
-    ASTNode(int line, int col, const std::string& type) : line(line), column(col), typeName(type) {}
+    ASTNode(NodeKind kind, int line, int col) : kind(kind), line(line), column(col) {}
+};
+
+using NodeList = ArenaSpan<ASTNode*>;
+
+// Checked downcast: null unless node has T's kind.
+template <typename T>
+T* as(ASTNode* node) {
+    return node && node->kind == T::Kind ? static_cast<T*>(node) : nullptr;
+}
+
+template <typename T>
+const T* as(const ASTNode* node) {
+    return node && node->kind == T::Kind ? static_cast<const T*>(node) : nullptr;
+}
+
+// Decoded once by the parser so evaluation never looks at operator text.
+enum class BinaryOp : uint8_t {
+    Add, Sub, Mul, Div,
+    Less, LessEqual, Greater, GreaterEqual,
+    Equal, NotEqual
+};
+
+inline const char* binaryOpToString(BinaryOp op) {
+    switch (op) {
+    case BinaryOp::Add: return "+";
+    case BinaryOp::Sub: return "-";
+    case BinaryOp::Mul: return "*";
+    case BinaryOp::Div: return "/";
+    case BinaryOp::Less: return "<";
+    case BinaryOp::LessEqual: return "<=";
+    case BinaryOp::Greater: return ">";
+    case BinaryOp::GreaterEqual: return ">=";
+    case BinaryOp::Equal: return "==";
+    case BinaryOp::NotEqual: return "!=";
+    }
+    return "?";
+}
+
+inline bool isComparison(BinaryOp op) {
+    return op >= BinaryOp::Less;
+}
+
+// Evaluates op on two int constants. Returns false when the result has to be left
+// to runtime (division by zero or INT_MIN / -1), so the error still happens there.
+inline bool foldBinaryOp(BinaryOp op, int left, int right, int& result) {
+    unsigned l = static_cast<unsigned>(left), r = static_cast<unsigned>(right);
+    switch (op) {
+    case BinaryOp::Add: result = static_cast<int>(l + r); return true;
+    case BinaryOp::Sub: result = static_cast<int>(l - r); return true;
+    case BinaryOp::Mul: result = static_cast<int>(l * r); return true;
+    case BinaryOp::Div:
+        if (right == 0 || (left == INT32_MIN && right == -1)) return false;
+        result = left / right;
+        return true;
+    case BinaryOp::Less: result = left < right; return true;
+    case BinaryOp::LessEqual: result = left <= right; return true;
+    case BinaryOp::Greater: result = left > right; return true;
+    case BinaryOp::GreaterEqual: result = left >= right; return true;
+    case BinaryOp::Equal: result = left == right; return true;
+    case BinaryOp::NotEqual: result = left != right; return true;
+    }
+    return false;
+}
+
+struct Param {
+    Symbol name;
+    Symbol type;
 };
 
 struct FunctionDecl : ASTNode {
-    std::string name;
-    std::vector<std::pair<std::string, std::string>> params; // (name, type)
-    std::string returnType;
-    std::vector<std::shared_ptr<ASTNode>> body;
+    static constexpr NodeKind Kind = NodeKind::FunctionDecl;
+    Symbol name;
+    ArenaSpan<Param> params;
+    Symbol returnType = 0;
+    NodeList body;
+    bool typed = false; // checked by the TypeChecker, so the body relies on its parameter types
 
-    FunctionDecl(int line, int col, const std::string& name)
-        : ASTNode(line, col, "FunctionDecl"), name(name) {}
+    FunctionDecl(int line, int col, Symbol name)
+        : ASTNode(Kind, line, col), name(name) {}
 };
 
 struct ReturnStmt : ASTNode {
-    std::shared_ptr<ASTNode> expression;
+    static constexpr NodeKind Kind = NodeKind::ReturnStmt;
+    ASTNode* expression = nullptr;
     ReturnStmt(int line, int col)
-        : ASTNode(line, col, "ReturnStmt") {}
+        : ASTNode(Kind, line, col) {}
 };
 
 struct PrintStmt : ASTNode {
-    std::shared_ptr<ASTNode> expression;
+    static constexpr NodeKind Kind = NodeKind::PrintStmt;
+    ASTNode* expression = nullptr;
     PrintStmt(int line, int col)
-        : ASTNode(line, col, "PrintStmt") {}
+        : ASTNode(Kind, line, col) {}
 };
 
 struct BinaryExpr : ASTNode {
-    std::shared_ptr<ASTNode> left;
-    std::string op;
-    std::shared_ptr<ASTNode> right;
-    BinaryExpr(int line, int col, const std::string& op)
-        : ASTNode(line, col, "BinaryExpr"), op(op) {}
+    static constexpr NodeKind Kind = NodeKind::BinaryExpr;
+    ASTNode* left = nullptr;
+    BinaryOp op;
+    ASTNode* right = nullptr;
+    BinaryExpr(int line, int col, BinaryOp op)
+        : ASTNode(Kind, line, col), op(op) {}
 };
 
 struct Identifier : ASTNode {
-    std::string name;
-    Identifier(int line, int col, const std::string& name)
-        : ASTNode(line, col, "Identifier"), name(name) {}
+    static constexpr NodeKind Kind = NodeKind::Identifier;
+    Symbol name;
+    Identifier(int line, int col, Symbol name)
+        : ASTNode(Kind, line, col), name(name) {}
 };
 
 struct VarDecl : ASTNode {
-    std::string name;
-    std::string type;
-    std::shared_ptr<ASTNode> initializer;
-    VarDecl(int line, int col, const std::string& name)
-        : ASTNode(line, col, "VarDecl"), name(name) {
+    static constexpr NodeKind Kind = NodeKind::VarDecl;
+    Symbol name;
+    Symbol type = 0;
+    ASTNode* initializer = nullptr;
+    bool isConst = false;
+    VarDecl(int line, int col, Symbol name)
+        : ASTNode(Kind, line, col), name(name) {
     }
 };
 
 struct AssignStmt : ASTNode {
-    std::string name;
-    std::shared_ptr<ASTNode> value;
-    AssignStmt(int line, int col, const std::string& name)
-        : ASTNode(line, col, "AssignStmt"), name(name) {
+    static constexpr NodeKind Kind = NodeKind::AssignStmt;
+    Symbol name;
+    ASTNode* value = nullptr;
+    AssignStmt(int line, int col, Symbol name)
+        : ASTNode(Kind, line, col), name(name) {
+    }
+};
+
+// `name[index] = value`
+struct IndexAssignStmt : ASTNode {
+    static constexpr NodeKind Kind = NodeKind::IndexAssignStmt;
+    Symbol name;
+    ASTNode* index = nullptr;
+    ASTNode* value = nullptr;
+    IndexAssignStmt(int line, int col, Symbol name)
+        : ASTNode(Kind, line, col), name(name) {
     }
 };
 
 struct ExpressionStmt : ASTNode {
-    std::shared_ptr<ASTNode> expr;
+    static constexpr NodeKind Kind = NodeKind::ExpressionStmt;
+    ASTNode* expr = nullptr;
     ExpressionStmt(int line, int col)
-        : ASTNode(line, col, "ExpressionStmt") {
+        : ASTNode(Kind, line, col) {
     }
 };
 
 struct NumberLiteral : ASTNode {
+    static constexpr NodeKind Kind = NodeKind::NumberLiteral;
     int value;
     NumberLiteral(int line, int col, int value)
-        : ASTNode(line, col, "NumberLiteral"), value(value) {
+        : ASTNode(Kind, line, col), value(value) {
+        type = StaticType::Int;
+    }
+};
+
+struct DoubleLiteral : ASTNode {
+    static constexpr NodeKind Kind = NodeKind::DoubleLiteral;
+    double value;
+    DoubleLiteral(int line, int col, double value)
+        : ASTNode(Kind, line, col), value(value) {
+        type = StaticType::Double;
+    }
+};
+
+struct BoolLiteral : ASTNode {
+    static constexpr NodeKind Kind = NodeKind::BoolLiteral;
+    bool value;
+    BoolLiteral(int line, int col, bool value)
+        : ASTNode(Kind, line, col), value(value) {
+        type = StaticType::Bool;
+    }
+};
+
+// "text", its escapes decoded. Interned like a name, so chunks can keep
+// viewing it after the source and the arena are gone.
+struct StringLiteral : ASTNode {
+    static constexpr NodeKind Kind = NodeKind::StringLiteral;
+    Symbol text;
+    StringLiteral(int line, int col, Symbol text)
+        : ASTNode(Kind, line, col), text(text) {
+        type = StaticType::String;
     }
 };
 
 struct ForStmt : ASTNode {
-    std::shared_ptr<ASTNode> init;
-    std::shared_ptr<ASTNode> condition;
-    std::shared_ptr<ASTNode> increment;
-    std::vector<std::shared_ptr<ASTNode>> body;
-    ForStmt(int line, int col) : ASTNode(line, col, "ForStmt") {}
+    static constexpr NodeKind Kind = NodeKind::ForStmt;
+    ASTNode* init = nullptr;
+    ASTNode* condition = nullptr;
+    ASTNode* increment = nullptr;
+    NodeList body;
+    ForStmt(int line, int col) : ASTNode(Kind, line, col) {}
 };
 
 struct ForEachStmt : ASTNode {
-    std::string varName;
-    std::string varType;
-    std::shared_ptr<ASTNode> iterable;
-    std::vector<std::shared_ptr<ASTNode>> body;
-    ForEachStmt(int line, int col) : ASTNode(line, col, "ForEachStmt") {}
+    static constexpr NodeKind Kind = NodeKind::ForEachStmt;
+    Symbol varName = 0;
+    Symbol varType = 0;
+    ASTNode* iterable = nullptr;
+    NodeList body;
+    ForEachStmt(int line, int col) : ASTNode(Kind, line, col) {}
 };
 
 struct WhileStmt : ASTNode {
-    std::shared_ptr<ASTNode> condition;
-    std::vector<std::shared_ptr<ASTNode>> body;
-    WhileStmt(int line, int col) : ASTNode(line, col, "WhileStmt") {}
+    static constexpr NodeKind Kind = NodeKind::WhileStmt;
+    ASTNode* condition = nullptr;
+    NodeList body;
+    WhileStmt(int line, int col) : ASTNode(Kind, line, col) {}
+};
+
+struct BreakStmt : ASTNode {
+    static constexpr NodeKind Kind = NodeKind::BreakStmt;
+    BreakStmt(int line, int col) : ASTNode(Kind, line, col) {}
+};
+
+struct ContinueStmt : ASTNode {
+    static constexpr NodeKind Kind = NodeKind::ContinueStmt;
+    ContinueStmt(int line, int col) : ASTNode(Kind, line, col) {}
 };
 
 struct IndexExpr : ASTNode {
-    std::shared_ptr<ASTNode> array;
-    std::shared_ptr<ASTNode> index;
-    IndexExpr(int line, int col, std::shared_ptr<ASTNode> arr, std::shared_ptr<ASTNode> idx)
-        : ASTNode(line, col, "IndexExpr"), array(arr), index(idx) {
+    static constexpr NodeKind Kind = NodeKind::IndexExpr;
+    ASTNode* array;
+    ASTNode* index;
+    IndexExpr(int line, int col, ASTNode* arr, ASTNode* idx)
+        : ASTNode(Kind, line, col), array(arr), index(idx) {
     }
 };
 
 struct CallExpr : ASTNode {
-    std::string funcName;
-    std::vector<std::shared_ptr<ASTNode>> args;
-    CallExpr(int line, int col, const std::string& name)
-        : ASTNode(line, col, "CallExpr"), funcName(name) {
+    static constexpr NodeKind Kind = NodeKind::CallExpr;
+    Symbol funcName;
+    NodeList args;
+    bool checked = false; // the TypeChecker matched the arguments to the callee's parameter types
+    CallExpr(int line, int col, Symbol name)
+        : ASTNode(Kind, line, col), funcName(name) {
     }
 };
 
 struct ArrayLiteral : ASTNode {
-    std::vector<std::shared_ptr<ASTNode>> elements;
-    ArrayLiteral(int line, int col, const std::vector<std::shared_ptr<ASTNode>>& elems)
-        : ASTNode(line, col, "ArrayLiteral"), elements(elems) {
+    static constexpr NodeKind Kind = NodeKind::ArrayLiteral;
+    NodeList elements;
+    ArrayLiteral(int line, int col, NodeList elems)
+        : ASTNode(Kind, line, col), elements(elems) {
     }
 };
 
+// Inserted by the TypeChecker where a value meets a declared type it isn't
+// known to have: widens an int to double, and checks anything else at runtime.
+struct CoerceExpr : ASTNode {
+    static constexpr NodeKind Kind = NodeKind::CoerceExpr;
+    ASTNode* expr;
+    CoerceExpr(int line, int col, ASTNode* expr, StaticType to)
+        : ASTNode(Kind, line, col), expr(expr) {
+        type = to;
+    }
+};
+
+inline bool isLiteral(const ASTNode* node) {
+    return node && (node->kind == NodeKind::NumberLiteral || node->kind == NodeKind::DoubleLiteral ||
+        node->kind == NodeKind::BoolLiteral || node->kind == NodeKind::StringLiteral);
+}
+
+// Sets truth and returns true if node is a literal, whose truth is known now.
+inline bool literalTruth(const ASTNode* node, bool& truth) {
+    if (auto num = as<NumberLiteral>(node)) truth = num->value != 0;
+    else if (auto dbl = as<DoubleLiteral>(node)) truth = dbl->value != 0;
+    else if (auto boolean = as<BoolLiteral>(node)) truth = boolean->value;
+    else if (as<StringLiteral>(node)) truth = true; // as every string is
+    else return false;
+    return true;
+}
+
+// A copy of a literal node, placed at another source position.
+inline ASTNode* copyLiteral(Arena& arena, const ASTNode* literal, int line, int col) {
+    if (auto num = as<NumberLiteral>(literal)) return arena.make<NumberLiteral>(line, col, num->value);
+    if (auto dbl = as<DoubleLiteral>(literal)) return arena.make<DoubleLiteral>(line, col, dbl->value);
+    if (auto boolean = as<BoolLiteral>(literal)) return arena.make<BoolLiteral>(line, col, boolean->value);
+    if (auto string = as<StringLiteral>(literal)) return arena.make<StringLiteral>(line, col, string->text);
+    return nullptr;
+}
+
+// Folds op over two literals with the same rules as the VM: int op int stays
+// int, a double on either side makes it double, comparisons give bool, and
+// two strings concatenate. Returns null if the operands aren't literals or the
+// result must be left to runtime.
+inline ASTNode* foldLiterals(Arena& arena, int line, int col, BinaryOp op, const ASTNode* left, const ASTNode* right) {
+    auto li = as<NumberLiteral>(left), ri = as<NumberLiteral>(right);
+    if (li && ri) {
+        int value;
+        if (!foldBinaryOp(op, li->value, ri->value, value)) return nullptr;
+        if (isComparison(op)) return arena.make<BoolLiteral>(line, col, value != 0);
+        return arena.make<NumberLiteral>(line, col, value);
+    }
+
+    auto ld = as<DoubleLiteral>(left), rd = as<DoubleLiteral>(right);
+    if ((ld || li) && (rd || ri) && (ld || rd)) {
+        double l = ld ? ld->value : li->value;
+        double r = rd ? rd->value : ri->value;
+        switch (op) {
+        case BinaryOp::Add: return arena.make<DoubleLiteral>(line, col, l + r);
+        case BinaryOp::Sub: return arena.make<DoubleLiteral>(line, col, l - r);
+        case BinaryOp::Mul: return arena.make<DoubleLiteral>(line, col, l * r);
+        case BinaryOp::Div: return arena.make<DoubleLiteral>(line, col, l / r);
+        case BinaryOp::Less: return arena.make<BoolLiteral>(line, col, l < r);
+        case BinaryOp::LessEqual: return arena.make<BoolLiteral>(line, col, l <= r);
+        case BinaryOp::Greater: return arena.make<BoolLiteral>(line, col, l > r);
+        case BinaryOp::GreaterEqual: return arena.make<BoolLiteral>(line, col, l >= r);
+        case BinaryOp::Equal: return arena.make<BoolLiteral>(line, col, l == r);
+        case BinaryOp::NotEqual: return arena.make<BoolLiteral>(line, col, l != r);
+        }
+        return nullptr;
+    }
+
+    auto lb = as<BoolLiteral>(left), rb = as<BoolLiteral>(right);
+    if (lb && rb && op == BinaryOp::Equal) return arena.make<BoolLiteral>(line, col, lb->value == rb->value);
+    if (lb && rb && op == BinaryOp::NotEqual) return arena.make<BoolLiteral>(line, col, lb->value != rb->value);
+
+    // equal text is one symbol
+    auto ls = as<StringLiteral>(left), rs = as<StringLiteral>(right);
+    if (ls && rs && op == BinaryOp::Add) return arena.make<StringLiteral>(line, col, intern(symbolName(ls->text) + symbolName(rs->text)));
+    if (ls && rs && op == BinaryOp::Equal) return arena.make<BoolLiteral>(line, col, ls->text == rs->text);
+    if (ls && rs && op == BinaryOp::NotEqual) return arena.make<BoolLiteral>(line, col, ls->text != rs->text);
+    return nullptr;
+}
+
 class Parser {
 public:
-    Parser(Lexer& lexer) : lexer(lexer) { currentToken = lexer.nextToken(); }
+    // nodes are allocated in arena, which must outlive every use of them
+    Parser(Lexer& lexer, Arena& arena) : tokens(lexer), arena(arena) {}
 
-    std::shared_ptr<FunctionDecl> parseFunction();
-    std::shared_ptr<ASTNode> parseExpression();
-    std::shared_ptr<ASTNode> parseBinaryExpression();
-    void printAST(const std::shared_ptr<ASTNode>& node, int indent = 0);
+    FunctionDecl* parseFunction();
+    ASTNode* parseExpression();
+    ASTNode* parseBinaryExpression(int minPrecedence = 1);
+    void printAST(const ASTNode* node, int indent = 0);
 
-    std::shared_ptr<ASTNode> parseTopLevel();
+    ASTNode* parseTopLevel();
     bool isAtEnd() const;
-    std::shared_ptr<ASTNode> parseStatement();
+    ASTNode* parseStatement();
+    // offset in the source of the current token, i.e. where the next item starts
+    size_t position() const { return tokens.offset(); }
+    // tokens the lexer has produced for this parser, some of them lookahead
+    size_t tokensLexed() const { return tokens.lexed(); }
 
 private:
-    Lexer& lexer;
-    Token currentToken;
+    TokenBuffer tokens;
+    Arena& arena;
+    int loopDepth = 0;
 
     void advance();
     void expect(token_type type, const std::string& msg = "Unexpected token");
-    std::string parseType();
-    std::pair<std::string, std::string> parseParam();
-    std::vector<std::shared_ptr<ASTNode>> parseBlock();
+    Symbol parseType();
+    Param parseParam();
+    NodeList parseBlock();
+    NodeList parseLoopBody();
+    VarDecl* parseVarDecl(bool inForHeader = false);
+    NodeList parseArguments(token_type close, const char* msg);
+    ASTNode* parsePrimary();
+    ASTNode* makeBinary(int line, int col, BinaryOp op, ASTNode* left, ASTNode* right);
 };
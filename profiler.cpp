@@ -0,0 +1,108 @@
+// profiler.cpp
+#include "profiler.h"
+#include <algorithm>
+#include <iomanip>
+
+Profiler::Profiler() {
+    nodes.push_back({ UINT32_MAX, UINT32_MAX });
+}
+
+uint32_t Profiler::child(uint32_t parent, const std::string& name) {
+    for (uint32_t c : nodes[parent].children) {
+        if (functions[nodes[c].function].name == name) return c;
+    }
+
+    auto [it, added] = functionIds.try_emplace(name, static_cast<uint32_t>(functions.size()));
+    if (added) functions.push_back({ name });
+    uint32_t id = static_cast<uint32_t>(nodes.size());
+    nodes.push_back({ it->second, parent });
+    nodes[parent].children.push_back(id);
+    return id;
+}
+
+void Profiler::enter(const Chunk& chunk) {
+    uint32_t node = child(stack.empty() ? 0 : stack.back().node, chunk.name);
+    FunctionStats& f = functions[nodes[node].function];
+    f.calls++;
+    f.active++;
+    stack.push_back({ node, Clock::now(), {}, lastChunk, lastPc, lastLine });
+}
+
+void Profiler::leave() {
+    Activation a = stack.back();
+    stack.pop_back();
+    Clock::duration elapsed = Clock::now() - a.start;
+    Clock::duration self = elapsed - a.children;
+
+    Node& node = nodes[a.node];
+    node.self += self;
+    FunctionStats& f = functions[node.function];
+    f.exclusive += self;
+    if (--f.active == 0) f.inclusive += elapsed;
+    if (!stack.empty()) stack.back().children += elapsed;
+
+    lastChunk = a.lastChunk;
+    lastPc = a.lastPc;
+    lastLine = a.lastLine;
+}
+
+void Profiler::unwind(size_t depth) {
+    while (stack.size() > depth) leave();
+}
+
+static double milliseconds(Profiler::Clock::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+void Profiler::report(std::ostream& out, size_t maxLines) const {
+    std::vector<const FunctionStats*> byTime;
+    for (const auto& f : functions) byTime.push_back(&f);
+    std::stable_sort(byTime.begin(), byTime.end(), [](auto l, auto r) { return l->exclusive > r->exclusive; });
+
+    auto flags = out.flags();
+    out << std::left << std::setw(24) << "function" << std::right
+        << std::setw(12) << "calls" << std::setw(16) << "inclusive ms" << std::setw(16) << "exclusive ms" << '\n';
+    out << std::fixed << std::setprecision(3);
+    for (auto f : byTime) {
+        out << std::left << std::setw(24) << f->name << std::right
+            << std::setw(12) << f->calls
+            << std::setw(16) << milliseconds(f->inclusive)
+            << std::setw(16) << milliseconds(f->exclusive) << '\n';
+    }
+
+    std::vector<size_t> hot;
+    for (size_t line = 0; line < lines.size(); ++line) {
+        if (lines[line].instructions) hot.push_back(line);
+    }
+    std::stable_sort(hot.begin(), hot.end(), [this](size_t l, size_t r) {
+        return lines[l].instructions > lines[r].instructions;
+    });
+    if (hot.size() > maxLines) hot.resize(maxLines);
+
+    out << '\n' << std::setw(8) << "line" << std::setw(16) << "hits" << std::setw(16) << "instructions" << '\n';
+    for (size_t line : hot) {
+        out << std::setw(8) << line << std::setw(16) << lines[line].hits
+            << std::setw(16) << lines[line].instructions << '\n';
+    }
+    out.flags(flags);
+}
+
+void Profiler::writeFolded(std::ostream& out) const {
+    // depth-first with an explicit stack; recursive scripts make deep trees
+    std::string path;
+    std::vector<std::pair<uint32_t, size_t>> pending; // node, length of path above it
+    for (auto it = nodes[0].children.rbegin(); it != nodes[0].children.rend(); ++it) pending.push_back({ *it, 0 });
+
+    while (!pending.empty()) {
+        auto [id, prefix] = pending.back();
+        pending.pop_back();
+        const Node& node = nodes[id];
+        path.resize(prefix);
+        if (prefix) path += ';';
+        path += functions[node.function].name;
+
+        auto micros = std::chrono::duration_cast<std::chrono::microseconds>(node.self).count();
+        if (micros > 0) out << path << ' ' << micros << '\n';
+        for (auto it = node.children.rbegin(); it != node.children.rend(); ++it) pending.push_back({ *it, path.size() });
+    }
+}
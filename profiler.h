@@ -0,0 +1,87 @@
+// profiler.h
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "bytecode.h"
+
+// Counts calls, time per function and hits per source line while attached to
+// an Interpreter. Detached it costs nothing: the interpreter only calls in
+// from a separate instantiation of its dispatch loop.
+class Profiler {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct FunctionStats {
+        std::string name;
+        uint64_t calls = 0;
+        Clock::duration inclusive{};  // outermost activations only, so recursion isn't counted twice
+        Clock::duration exclusive{};
+        int active = 0;
+    };
+
+    struct LineStats {
+        uint64_t hits = 0;          // times control arrived at the line from elsewhere
+        uint64_t instructions = 0;  // instructions executed on it
+    };
+
+    Profiler();
+
+    // a frame for chunk was pushed / the innermost frame returned
+    void enter(const Chunk& chunk);
+    void leave();
+    // an error unwound the frames; keeps only the outermost depth activations
+    void unwind(size_t depth);
+    size_t depth() const { return stack.size(); }
+
+    void instruction(const Chunk& chunk, size_t pc) {
+        int line = chunk.lines[pc];
+        if (static_cast<size_t>(line) >= lines.size()) lines.resize(line + 1);
+        // straight-line code within a line is one hit; jumps and calls arrive anew
+        if (line != lastLine || pc != lastPc + 1 || &chunk != lastChunk) lines[line].hits++;
+        lines[line].instructions++;
+        lastChunk = &chunk;
+        lastPc = pc;
+        lastLine = line;
+    }
+
+    const std::vector<FunctionStats>& functionStats() const { return functions; }
+    const std::vector<LineStats>& lineStats() const { return lines; }
+
+    // functions by exclusive time, then the hottest lines
+    void report(std::ostream& out, size_t maxLines = 20) const;
+    // one "outer;inner microseconds" line per call stack, for flamegraph.pl and friends
+    void writeFolded(std::ostream& out) const;
+
+private:
+    struct Node {
+        uint32_t function;
+        uint32_t parent;
+        Clock::duration self{};
+        std::vector<uint32_t> children;
+    };
+
+    struct Activation {
+        uint32_t node;
+        Clock::time_point start;
+        Clock::duration children{};
+        // the caller's position, so returning to it isn't counted as a new hit
+        const Chunk* lastChunk;
+        size_t lastPc;
+        int lastLine;
+    };
+
+    std::vector<FunctionStats> functions;
+    std::unordered_map<std::string, uint32_t> functionIds;
+    std::vector<Node> nodes;  // nodes[0] is the root above every outermost call
+    std::vector<Activation> stack;
+    std::vector<LineStats> lines;  // by source line
+    const Chunk* lastChunk = nullptr;
+    size_t lastPc = 0;
+    int lastLine = -1;
+
+    uint32_t child(uint32_t parent, const std::string& name);
+};
@@ -0,0 +1,241 @@
+// program.cpp
+#include "program.h"
+#include "compiler.h"
+#include "optimizer.h"
+#include "typechecker.h"
+#include "charscan.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+
+uint32_t Program::slotFor(const std::string& name) {
+    auto [it, added] = ids.try_emplace(name, static_cast<uint32_t>(names.size()));
+    if (added) names.push_back(name);
+    return it->second;
+}
+
+FunctionHandle Program::function(const std::string& name) const {
+    auto it = ids.find(name);
+    bool defined = it != ids.end() && std::any_of(unitList.begin(), unitList.end(),
+        [&](const CompiledUnit& unit) { return unit.isFunction && unit.chunk->name == name; });
+    if (!defined) throw std::runtime_error("Function not found: " + name);
+    return { it->second };
+}
+
+void Program::add(bool isFunction, std::unique_ptr<Chunk> chunk) {
+    if (isFunction) slotFor(chunk->name);
+    linkCalls(*chunk, [this](const std::string& name) { return slotFor(name); });
+    unitList.push_back({ isFunction, std::move(chunk) });
+}
+
+// stands in for a function whose body didn't compile
+static std::unique_ptr<Chunk> failingFunction(const FunctionDecl& func, const std::string& error) {
+    auto chunk = std::make_unique<Chunk>();
+    chunk->name = symbolName(func.name);
+    chunk->numParams = static_cast<int>(func.params.size());
+    chunk->numRegisters = chunk->numParams > 0 ? chunk->numParams : 1;
+    chunk->names.push_back(error);
+    chunk->code.push_back(Instruction::abc(OpCode::Error, 0, 0));
+    chunk->lines.push_back(func.line);
+    return chunk;
+}
+
+std::unique_ptr<Chunk> compileFunctionOrDefer(const FunctionDecl& func) {
+    try {
+        return Compiler().compileFunction(func);
+    }
+    catch (const std::exception& e) {
+        return failingFunction(func, e.what());
+    }
+}
+
+namespace {
+
+// where a run of top-level items starts, and the line and column there
+struct Split {
+    size_t offset;
+    int line;
+    int column;
+};
+
+// Sources smaller than this parse faster than threads start.
+const size_t parallelThreshold = 256 * 1024;
+
+// Every `function` keyword outside braces, strings and comments. Each one
+// starts a top-level item, so the source between two of them holds whole
+// items as far as the parser is concerned. If the braces don't balance the
+// splits may be wrong; parsing the pieces then fails and compile falls back
+// to one serial pass for the exact error.
+std::vector<Split> topLevelFunctions(std::string_view source) {
+    std::vector<Split> splits;
+    const char* begin = source.data();
+    const char* end = begin + source.size();
+    const char* lineStart = begin;
+    int line = 1;
+    int depth = 0;
+    for (const char* p = begin; p < end; ++p) {
+        switch (*p) {
+        case '\n':
+            line++;
+            lineStart = p + 1;
+            break;
+        case '{':
+            depth++;
+            break;
+        case '}':
+            depth--;
+            break;
+        case '/':
+            if (p + 1 < end && p[1] == '/') p = charscan::lineEnd(p, end) - 1;
+            break;
+        case '"':
+            for (++p; p < end && *p != '"'; ++p) {
+                if (*p == '\\' && p + 1 < end) ++p;
+                if (*p == '\n') {
+                    line++;
+                    lineStart = p + 1;
+                }
+            }
+            break;
+        case 'f':
+            if (depth == 0 && static_cast<size_t>(end - p) > 8 && std::string_view(p, 8) == "function" &&
+                !charscan::isAlphaNumeric(p[8]) && (p == begin || !charscan::isAlphaNumeric(p[-1]))) {
+                splits.push_back({ static_cast<size_t>(p - begin), line, static_cast<int>(p - lineStart) + 1 });
+            }
+            p = charscan::identifierTail(p, end) - 1;
+            break;
+        default:
+            if (charscan::isAlpha(*p)) p = charscan::identifierTail(p, end) - 1;
+            break;
+        }
+    }
+    return splits;
+}
+
+// A run of top-level items, parsed. The AST is only needed until they are compiled.
+struct Piece {
+    Split from;
+    size_t end;
+    Arena arena;
+    std::vector<ASTNode*> items;
+};
+
+// Parses source[from.offset, end), which holds whole items.
+void parseItems(std::string_view source, Piece& piece) {
+    Lexer lexer(source.substr(piece.from.offset, piece.end - piece.from.offset), piece.from.line, piece.from.column);
+    Parser parser(lexer, piece.arena);
+    while (!parser.isAtEnd()) piece.items.push_back(parser.parseTopLevel());
+    recordParse(piece.end - piece.from.offset, parser.tokensLexed(), piece.arena.allocations(), piece.arena.bytesAllocated());
+}
+
+void declareFunctions(const Piece& piece, Signatures& signatures) {
+    for (const ASTNode* item : piece.items) {
+        if (auto func = as<FunctionDecl>(item)) declareSignature(signatures, *func);
+    }
+}
+
+// Type checks, optimizes and compiles the piece's items, in order.
+void compileItems(Piece& piece, const Signatures& signatures, int optimize, std::vector<CompiledUnit>& units) {
+    TypeChecker checker(piece.arena, signatures);
+    Optimizer optimizer(piece.arena, optimize);
+    for (ASTNode* item : piece.items) {
+        checker.check(item);
+        auto node = optimizer.optimize(item);
+        if (!node) continue;
+        if (auto func = as<FunctionDecl>(node)) units.push_back({ true, compileFunctionOrDefer(*func) });
+        else units.push_back({ false, Compiler().compileStatement(node) });
+    }
+}
+
+// Runs work(i) for every i below count, on up to threads threads counting this one.
+template <typename Work>
+void forEachPiece(size_t count, unsigned threads, Work work) {
+    std::atomic<size_t> next{ 0 };
+    auto worker = [&]() {
+        for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count;) work(i);
+    };
+    std::vector<std::thread> workers;
+    threads = static_cast<unsigned>(std::min<size_t>(threads, count));
+    for (unsigned t = 1; t < threads; ++t) workers.emplace_back(worker);
+    worker();
+    for (auto& thread : workers) thread.join();
+}
+
+// Splits into about four pieces per thread, of similar size, and parses them
+// on threads workers; then, with every signature known, checks and compiles
+// them the same way. False if any piece fails to parse. A type error is
+// rethrown from the first piece that has one, which holds the first in the
+// source, as each piece stops at its own first.
+bool compileParallel(std::string_view source, int optimize, unsigned threads, std::vector<CompiledUnit>& units) {
+    std::vector<Split> functions = topLevelFunctions(source);
+    std::vector<Split> splits{ { 0, 1, 1 } };
+    size_t target = source.size() / (threads * 4) + 1;
+    for (const Split& split : functions) {
+        if (split.offset - splits.back().offset >= target) splits.push_back(split);
+    }
+    if (splits.size() < 2) return false;
+
+    std::vector<Piece> pieces(splits.size());
+    for (size_t i = 0; i < splits.size(); ++i) {
+        pieces[i].from = splits[i];
+        pieces[i].end = i + 1 < splits.size() ? splits[i + 1].offset : source.size();
+    }
+    std::atomic<bool> failed{ false };
+    forEachPiece(pieces.size(), threads, [&](size_t i) {
+        if (failed.load(std::memory_order_relaxed)) return;
+        try {
+            parseItems(source, pieces[i]);
+        }
+        catch (const std::exception&) {
+            failed.store(true, std::memory_order_relaxed);
+        }
+    });
+    if (failed) return false;
+
+    Signatures signatures;
+    for (const Piece& piece : pieces) declareFunctions(piece, signatures);
+    std::vector<std::vector<CompiledUnit>> results(pieces.size());
+    std::vector<std::exception_ptr> errors(pieces.size());
+    forEachPiece(pieces.size(), threads, [&](size_t i) {
+        try {
+            compileItems(pieces[i], signatures, optimize, results[i]);
+        }
+        catch (...) {
+            errors[i] = std::current_exception();
+        }
+    });
+    for (auto& error : errors) {
+        if (error) std::rethrow_exception(error);
+    }
+
+    for (auto& piece : results) {
+        for (auto& unit : piece) units.push_back(std::move(unit));
+    }
+    return true;
+}
+
+}
+
+Program Program::compile(std::string_view source, int optimize, unsigned threads) {
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<CompiledUnit> units;
+    if (threads < 2 || source.size() < parallelThreshold || !compileParallel(source, optimize, threads, units)) {
+        units.clear();
+        Piece whole;
+        whole.from = { 0, 1, 1 };
+        whole.end = source.size();
+        parseItems(source, whole);
+        Signatures signatures;
+        declareFunctions(whole, signatures);
+        compileItems(whole, signatures, optimize, units);
+    }
+    return fromUnits(std::move(units));
+}
+
+Program Program::fromUnits(std::vector<CompiledUnit> units) {
+    Program program;
+    for (auto& unit : units) program.add(unit.isFunction, std::move(unit.chunk));
+    return program;
+}
@@ -0,0 +1,56 @@
+// program.h
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "bytecode.h"
+
+struct FunctionDecl;
+
+// A function resolved once by name, then called without looking it up again.
+// It names the function's slot, so it follows the function through
+// redefinition, and one from Program::function works in every Interpreter
+// that loaded that Program.
+struct FunctionHandle {
+    uint32_t slot = UINT32_MAX;
+};
+
+// Compiles func, or if that fails, to a body that throws the same error when
+// called, as if it had been compiled on first call.
+std::unique_ptr<Chunk> compileFunctionOrDefer(const FunctionDecl& func);
+
+// A script compiled once and then only read: every function and top-level
+// statement as linked bytecode, in source order. Any number of Interpreters
+// on any threads can load the same Program at once; each keeps its own
+// globals, registers and output. The Program must outlive them.
+//
+// Call sites are linked against the Program's own function numbering, which
+// every Interpreter loading it adopts, so nothing in a chunk is written after
+// construction.
+class Program {
+public:
+    // Parses, type checks, optimizes and compiles the whole source; throws on
+    // a syntax or type error. Functions compile as compileFunctionOrDefer
+    // does. A large source is split at its top-level functions and parsed on
+    // up to threads workers (0: one per core); the result, errors included,
+    // is the same as parsing it in one pass.
+    static Program compile(std::string_view source, int optimize = 2, unsigned threads = 0);
+    // from already compiled units, e.g. the program cache
+    static Program fromUnits(std::vector<CompiledUnit> units);
+
+    const std::vector<CompiledUnit>& units() const { return unitList; }
+    // index i is the function every callTargets entry equal to i refers to
+    const std::vector<std::string>& functionNames() const { return names; }
+    // throws if the program doesn't define name
+    FunctionHandle function(const std::string& name) const;
+
+private:
+    std::vector<CompiledUnit> unitList;
+    std::vector<std::string> names;
+    std::unordered_map<std::string, uint32_t> ids;
+
+    uint32_t slotFor(const std::string& name);
+    void add(bool isFunction, std::unique_ptr<Chunk> chunk);
+};
@@ -0,0 +1,291 @@
+// programcache.cpp
+#include "programcache.h"
+#include "mappedfile.h"
+#include "symbols.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <system_error>
+
+static_assert(sizeof(Instruction) == 8, "instructions are stored as 8 raw bytes");
+
+static const char magic[4] = { 'J', 'S', 'P', 'C' };
+static const uint32_t opcodeCount = static_cast<uint32_t>(OpCode::Error) + 1;
+
+uint64_t programCacheKey(std::string_view source, int optimize) {
+    // FNV-1a over the source, seeded with what else decides the bytecode
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&hash](unsigned char c) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    };
+    mix(static_cast<unsigned char>(optimize));
+    mix(static_cast<unsigned char>(programCacheVersion));
+    for (char c : source) mix(static_cast<unsigned char>(c));
+    return hash;
+}
+
+std::string programCachePath(const std::string& scriptPath) {
+    return scriptPath + ".jsc";
+}
+
+ProgramCacheWriter::ProgramCacheWriter(uint64_t key) {
+    put(magic, sizeof(magic));
+    putU32(programCacheVersion);
+    putU32(opcodeCount);
+    put(&key, sizeof(key));
+    putU32(0); // unit count, filled in by save()
+}
+
+void ProgramCacheWriter::putString(const std::string& s) {
+    putU32(static_cast<uint32_t>(s.size()));
+    put(s.data(), s.size());
+}
+
+void ProgramCacheWriter::unit(uint8_t kind, const Chunk& chunk) {
+    put(&kind, 1);
+    putString(chunk.name);
+    put(&chunk.numParams, sizeof(int32_t));
+    put(&chunk.numRegisters, sizeof(int32_t));
+    putU32(static_cast<uint32_t>(chunk.paramTypes.size()));
+    put(chunk.paramTypes.data(), chunk.paramTypes.size());
+
+    putU32(static_cast<uint32_t>(chunk.code.size()));
+    put(chunk.code.data(), chunk.code.size() * sizeof(Instruction));
+    for (int line : chunk.lines) put(&line, sizeof(int32_t));
+
+    putU32(static_cast<uint32_t>(chunk.constants.size()));
+    for (const Value& v : chunk.constants) {
+        uint8_t type = static_cast<uint8_t>(v.kind());
+        int64_t i = 0;
+        double d = 0;
+        put(&type, 1);
+        switch (v.kind()) {
+        case ValueType::Int: i = v.asInt(); put(&i, 8); break;
+        case ValueType::Double: d = v.asDouble(); put(&d, 8); break;
+        case ValueType::Bool: i = v.asBool(); put(&i, 8); break;
+        case ValueType::String: {
+            std::string_view text = v.text();
+            i = static_cast<int64_t>(text.size());
+            put(&i, 8);
+            put(text.data(), text.size());
+            break;
+        }
+        case ValueType::Array: throw std::runtime_error("Array constants cannot be cached");
+        }
+    }
+
+    putU32(static_cast<uint32_t>(chunk.names.size()));
+    for (const auto& name : chunk.names) putString(name);
+    units++;
+}
+
+bool ProgramCacheWriter::save(const std::string& path) {
+    std::memcpy(&bytes[sizeof(magic) + 16], &units, sizeof(units));
+
+    // unique per writer, so scripts launched side by side don't share a temporary
+    std::string temp = path + "." + std::to_string(std::random_device{}()) + ".tmp";
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        if (!out.write(bytes.data(), bytes.size())) {
+            out.close();
+            std::error_code ignored;
+            std::filesystem::remove(temp, ignored);
+            return false;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(temp, path, error); // replaces any older cache
+    if (error) std::filesystem::remove(temp, error);
+    return !error;
+}
+
+namespace {
+
+// Whether chunk can run without reading or writing outside its registers,
+// code, constants or names, however the file was damaged: every register
+// operand is below numRegisters, every jump lands on an instruction, every
+// index is in range, and the code ends in a Return. GetIndexUnchecked is
+// turned back into GetIndex, as the compiler's proof that its index is in
+// range can't be checked here.
+bool verify(Chunk& chunk) {
+    size_t size = chunk.code.size();
+    size_t registers = static_cast<size_t>(chunk.numRegisters);
+    if (chunk.numParams < 0 || chunk.numRegisters < chunk.numParams || chunk.numRegisters > 0x10000) return false;
+    if (size == 0 || size > INT32_MAX || chunk.code.back().op != OpCode::Return) return false;
+
+    for (size_t pc = 0; pc < size; ++pc) {
+        Instruction& ins = chunk.code[pc];
+        auto reg = [registers](size_t r, size_t count = 1) { return r + count <= registers; };
+        auto jump = [&] {
+            int64_t target = static_cast<int64_t>(pc) + 1 + ins.bx();
+            return target >= 0 && target < static_cast<int64_t>(size);
+        };
+        bool ok;
+        switch (ins.op) {
+        case OpCode::LoadInt: case OpCode::LoadBool: case OpCode::Print: case OpCode::Return:
+            ok = reg(ins.a);
+            break;
+        case OpCode::LoadConst:
+            ok = reg(ins.a) && ins.bx() >= 0 && static_cast<size_t>(ins.bx()) < chunk.constants.size();
+            break;
+        case OpCode::Move: case OpCode::AllocArray: case OpCode::Length:
+            ok = reg(ins.a) && reg(ins.b);
+            break;
+        case OpCode::Coerce:
+            ok = reg(ins.a) && ins.b <= static_cast<uint16_t>(StaticType::String);
+            break;
+        case OpCode::GetGlobal: case OpCode::SetGlobal:
+            ok = reg(ins.a) && ins.b < chunk.names.size();
+            break;
+        case OpCode::SetGlobalIndex:
+            ok = reg(ins.a) && ins.b < chunk.names.size() && reg(ins.c);
+            break;
+        case OpCode::Jump:
+            ok = jump();
+            break;
+        case OpCode::JumpIfFalse:
+            ok = reg(ins.a) && jump();
+            break;
+        case OpCode::ForIter: case OpCode::ForLoop: case OpCode::ForLoopInclusive:
+            ok = reg(ins.a, 3) && jump();
+            break;
+        case OpCode::Call: case OpCode::TailCall: case OpCode::CallChecked: case OpCode::TailCallChecked:
+            // the result lands in a, even when there are no arguments
+            ok = reg(ins.a, std::max<size_t>(ins.c, 1)) && ins.b < chunk.names.size();
+            break;
+        case OpCode::NewArray:
+            ok = reg(ins.a) && reg(ins.b, ins.c);
+            break;
+        case OpCode::Error:
+            ok = ins.b < chunk.names.size();
+            break;
+        case OpCode::GetIndexUnchecked:
+            ins.op = OpCode::GetIndex;
+            ok = reg(ins.a) && reg(ins.b) && reg(ins.c);
+            break;
+        default: // the three-register arithmetic, comparisons and indexing
+            ok = static_cast<uint32_t>(ins.op) < opcodeCount && reg(ins.a) && reg(ins.b) && reg(ins.c);
+            break;
+        }
+        if (!ok) return false;
+    }
+    return true;
+}
+
+// bounds-checked cursor over the mapped file
+struct Reader {
+    const char* at;
+    const char* end;
+
+    bool take(void* dst, size_t size) {
+        if (size == 0) return true; // dst may be the null data() of an empty vector
+        if (static_cast<size_t>(end - at) < size) return false;
+        std::memcpy(dst, at, size);
+        at += size;
+        return true;
+    }
+
+    bool u32(uint32_t& v) { return take(&v, sizeof(v)); }
+    bool i32(int& v) { return take(&v, sizeof(int32_t)); }
+
+    bool string(std::string& s) {
+        uint32_t size;
+        if (!u32(size) || static_cast<size_t>(end - at) < size) return false;
+        s.assign(at, size);
+        at += size;
+        return true;
+    }
+
+    bool chunk(Chunk& chunk) {
+        uint32_t count;
+        if (!string(chunk.name) || !i32(chunk.numParams) || !i32(chunk.numRegisters) || !u32(count))
+            return false;
+        if (count != 0 && count != static_cast<uint32_t>(chunk.numParams)) return false;
+        chunk.paramTypes.resize(count);
+        if (!take(chunk.paramTypes.data(), count)) return false;
+        for (StaticType type : chunk.paramTypes) {
+            if (type > StaticType::String) return false;
+        }
+        if (!u32(count)) return false;
+        if (static_cast<size_t>(end - at) / (sizeof(Instruction) + sizeof(int32_t)) < count) return false;
+        chunk.code.resize(count);
+        chunk.lines.resize(count);
+        take(chunk.code.data(), count * sizeof(Instruction));
+        take(chunk.lines.data(), count * sizeof(int32_t));
+
+        if (!u32(count)) return false;
+        chunk.constants.reserve(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            uint8_t type;
+            char payload[8];
+            if (!take(&type, 1) || !take(payload, 8)) return false;
+            int64_t n;
+            double d;
+            std::memcpy(&n, payload, 8);
+            std::memcpy(&d, payload, 8);
+            switch (static_cast<ValueType>(type)) {
+            case ValueType::Int: chunk.constants.emplace_back(static_cast<int>(n)); break;
+            case ValueType::Double: chunk.constants.emplace_back(d); break;
+            case ValueType::Bool: chunk.constants.emplace_back(n != 0); break;
+            case ValueType::String: {
+                // interned, as the compiler's are, so the constant outlives the mapping
+                if (n < 0 || static_cast<uint64_t>(end - at) < static_cast<uint64_t>(n)) return false;
+                std::string_view text(at, static_cast<size_t>(n));
+                at += n;
+                chunk.constants.push_back(Value::literal(symbolName(intern(text))));
+                break;
+            }
+            default: return false;
+            }
+        }
+
+        if (!u32(count)) return false;
+        chunk.names.resize(count);
+        for (auto& name : chunk.names) {
+            if (!string(name)) return false;
+        }
+        return verify(chunk);
+    }
+};
+
+}
+
+bool loadProgramCache(const std::string& path, uint64_t key, std::vector<CompiledUnit>& units) {
+    units.clear();
+    std::error_code error;
+    if (!std::filesystem::is_regular_file(path, error)) return false;
+
+    try {
+        MappedFile file(path);
+        std::string_view data = file.text();
+        Reader in{ data.data(), data.data() + data.size() };
+
+        char header[sizeof(magic)];
+        uint32_t version, opcodes, count;
+        uint64_t fileKey;
+        if (!in.take(header, sizeof(header)) || std::memcmp(header, magic, sizeof(magic)) != 0) return false;
+        if (!in.u32(version) || version != programCacheVersion) return false;
+        if (!in.u32(opcodes) || opcodes != opcodeCount) return false;
+        if (!in.take(&fileKey, sizeof(fileKey)) || fileKey != key) return false;
+        if (!in.u32(count)) return false;
+
+        units.reserve(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            uint8_t kind;
+            if (!in.take(&kind, 1) || kind > 1) break;
+            auto chunk = std::make_unique<Chunk>();
+            if (!in.chunk(*chunk)) break;
+            units.push_back({ kind == 0, std::move(chunk) });
+        }
+        if (units.size() == count && in.at == in.end) return true;
+    }
+    catch (const std::exception&) {
+        // unreadable counts as missing
+    }
+    units.clear();
+    return false;
+}
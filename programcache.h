@@ -0,0 +1,55 @@
+// programcache.h
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "bytecode.h"
+
+// Compiled form of a whole script, saved next to it as <script>.jsc so that
+// later runs skip lexing, parsing and compiling. A cache file is only used
+// when its key matches the source text and optimizer level it was built from.
+//
+// Layout, native byte order and unpadded:
+//   header  "JSPC", u32 version, u32 opcode count, u64 key, u32 unit count
+//   unit    u8 kind (0 function, 1 top-level statement), chunk
+//   chunk   str name, i32 params, i32 registers,
+//           u32 n (0 or params), n u8 parameter types,
+//           u32 n, n instructions, n i32 lines,
+//           u32 n, n constants (u8 type, 8-byte payload; for a string
+//           the payload is its length and its bytes follow),
+//           u32 n, n str names
+//   str     u32 length, bytes
+// Bump programCacheVersion whenever the bytecode changes meaning.
+constexpr uint32_t programCacheVersion = 5;
+
+uint64_t programCacheKey(std::string_view source, int optimize);
+std::string programCachePath(const std::string& scriptPath);
+
+// Collects chunks in the order the script defines and runs them.
+class ProgramCacheWriter {
+public:
+    explicit ProgramCacheWriter(uint64_t key);
+
+    void addFunction(const Chunk& chunk) { unit(0, chunk); }
+    void addStatement(const Chunk& chunk) { unit(1, chunk); }
+
+    // goes through a temporary file, so readers never see half a cache;
+    // false if it could not be written
+    bool save(const std::string& path);
+
+private:
+    std::string bytes;
+    uint32_t units = 0;
+
+    void unit(uint8_t kind, const Chunk& chunk);
+    void put(const void* data, size_t size) { bytes.append(static_cast<const char*>(data), size); }
+    void putU32(uint32_t v) { put(&v, sizeof(v)); }
+    void putString(const std::string& s);
+};
+
+// Reads the whole cache out of one mapping. False if it is missing, was built
+// from other source or an older format, is cut short, or holds a chunk whose
+// operands point outside it; units is then empty.
+bool loadProgramCache(const std::string& path, uint64_t key, std::vector<CompiledUnit>& units);
@@ -0,0 +1,77 @@
+// runner.cpp
+#include "runner.h"
+#include "interpreter.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+// a Value whose array or string buffer, if any, belongs to this invocation alone
+static Value isolated(const Value& v) {
+    if (v.isArray()) return Value::array(v.items());
+    if (v.isString()) return Value::string(v.text());
+    return v;
+}
+
+// What a worker hands back for a returned array or string: its elements or
+// text as plain copies, which the calling thread makes a Value of, so the
+// buffer is counted in that thread's liveArrayBytes or liveStringBytes and
+// freed there. Other values go straight into RunResult::value.
+struct Returned {
+    ValueType kind = ValueType::Int;
+    std::vector<int> items;
+    std::string text;
+};
+
+static void invoke(const Program& program, const std::string& function,
+    const std::vector<Value>& args, const ExecutionLimits& limits, RunResult& result, Returned& returned) {
+    if (limits.cancel && limits.cancel->load(std::memory_order_relaxed)) {
+        result.error = "Script cancelled";
+        return;
+    }
+    MemorySink sink;
+    try {
+        std::vector<Value> own;
+        own.reserve(args.size());
+        for (const Value& arg : args) own.push_back(isolated(arg));
+
+        Interpreter interp;
+        interp.setOutput(sink);
+        interp.setLimits(limits);
+        interp.load(program);
+        Value value = interp.callFunction(function, own);
+        returned.kind = value.kind();
+        if (value.isArray()) returned.items = value.items();
+        else if (value.isString()) returned.text = value.text();
+        else result.value = value;
+        interp.flushOutput();
+    }
+    catch (const std::exception& e) {
+        result.error = e.what();
+    }
+    result.output = sink.str(); // the interpreter flushed into it on the way out
+}
+
+std::vector<RunResult> runParallel(const Program& program, const std::string& function,
+    const std::vector<std::vector<Value>>& invocations, unsigned threads, const ExecutionLimits& limits) {
+    std::vector<RunResult> results(invocations.size());
+    std::vector<Returned> returned(invocations.size());
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = static_cast<unsigned>(std::min<size_t>(threads, invocations.size()));
+
+    std::atomic<size_t> next{ 0 };
+    auto work = [&]() {
+        for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < invocations.size();)
+            invoke(program, function, invocations[i], limits, results[i], returned[i]);
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 1; t < threads; ++t) workers.emplace_back(work);
+    work(); // the calling thread is one of the workers
+    for (auto& worker : workers) worker.join();
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        if (returned[i].kind == ValueType::Array) results[i].value = Value::array(std::move(returned[i].items));
+        else if (returned[i].kind == ValueType::String) results[i].value = Value::string(returned[i].text);
+    }
+    return results;
+}
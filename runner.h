@@ -0,0 +1,29 @@
+// runner.h
+#pragma once
+#include <string>
+#include <vector>
+#include "executionlimits.h"
+#include "program.h"
+#include "value.h"
+
+struct RunResult {
+    Value value;         // what the function returned
+    std::string output;  // everything it printed, top-level statements included
+    std::string error;   // empty unless it threw
+};
+
+// Runs function once per argument list, each time in a fresh Interpreter over
+// the shared program, on up to threads workers (0: one per core). Workers
+// claim invocations from one atomic counter and share nothing else, so there
+// are no locks on the way. Results come back in invocation order.
+//
+// Array and string arguments are copied for each invocation, and returned
+// ones are copied again on the calling thread: reference counts are not
+// atomic, so no Value may be shared between workers, and each buffer is
+// counted against the memory limit of the thread that frees it.
+//
+// limits apply to each invocation; setting limits.cancel stops every one
+// still running, and the ones not started yet fail straight away.
+std::vector<RunResult> runParallel(const Program& program, const std::string& function,
+    const std::vector<std::vector<Value>>& invocations, unsigned threads = 0,
+    const ExecutionLimits& limits = {});
@@ -0,0 +1,183 @@
+// session.cpp
+#include "session.h"
+#include "optimizer.h"
+#include "typechecker.h"
+#include <algorithm>
+#include <unordered_map>
+
+namespace {
+
+// a top-level item parsed out of an edited region
+struct Parsed {
+    size_t begin;
+    size_t end;
+    int line;
+    ASTNode* node;             // optimized; null if nothing is left to run
+    const FunctionDecl* func;  // set for function declarations
+};
+
+int newlines(std::string_view text) {
+    return static_cast<int>(std::count(text.begin(), text.end(), '\n'));
+}
+
+// Parses source[begin, end), which has to hold whole items. Offsets and
+// lines in the result are the whole source's.
+//
+// No call is checked against a signature: a later edit can redefine its
+// callee with other types, so every call has the callee check its arguments.
+std::vector<Parsed> parseItems(std::string_view source, size_t begin, size_t end, Arena& arena, int optimize) {
+    static const Signatures unknown;
+    size_t lineStart = begin == 0 ? std::string_view::npos : source.rfind('\n', begin - 1);
+    int line = 1 + newlines(source.substr(0, begin));
+    int column = static_cast<int>(begin - (lineStart == std::string_view::npos ? 0 : lineStart + 1)) + 1;
+
+    Lexer lexer(source.substr(begin, end - begin), line, column);
+    Parser parser(lexer, arena);
+    TypeChecker checker(arena, unknown);
+    Optimizer optimizer(arena, optimize);
+    std::vector<Parsed> items;
+    size_t at = begin;
+    size_t nodes = arena.allocations(), nodeBytes = arena.bytesAllocated();
+    while (!parser.isAtEnd()) {
+        ASTNode* node = parser.parseTopLevel();
+        size_t next = begin + parser.position();
+        checker.check(node);
+        items.push_back({ at, next, node->line, optimizer.optimize(node), as<FunctionDecl>(node) });
+        at = next;
+    }
+    // the checker's and optimizer's nodes are in there too, as they are interleaved with parsing
+    recordParse(end - begin, parser.tokensLexed(), arena.allocations() - nodes, arena.bytesAllocated() - nodeBytes);
+    return items;
+}
+
+// an item's text without the whitespace that runs up to the next one
+std::string_view itemText(std::string_view source, size_t begin, size_t end) {
+    std::string_view text = source.substr(begin, end - begin);
+    size_t last = text.find_last_not_of(" \t\r\n");
+    return text.substr(0, last == std::string_view::npos ? 0 : last + 1);
+}
+
+void shiftLines(Chunk& chunk, int delta) {
+    if (delta == 0) return;
+    for (int& line : chunk.lines) line += delta;
+}
+
+}
+
+void Session::reload(std::string source) {
+    apply(std::move(source), false);
+}
+
+std::optional<Value> Session::eval(std::string_view input) {
+    std::string next = text;
+    if (!next.empty() && next.back() != '\n') next += '\n';
+    next += input;
+    next += '\n';
+    return apply(std::move(next), true);
+}
+
+std::optional<Value> Session::apply(std::string next, bool evaluate) {
+    size_t oldSize = text.size(), newSize = next.size();
+    size_t limit = std::min(oldSize, newSize);
+    size_t prefix = std::mismatch(text.begin(), text.begin() + limit, next.begin()).first - text.begin();
+    parsedBytes = 0;
+    if (prefix == oldSize && prefix == newSize) return std::nullopt;
+    size_t suffix = 0;
+    while (suffix < limit - prefix && text[oldSize - 1 - suffix] == next[newSize - 1 - suffix]) ++suffix;
+
+    // items [first, last) overlap the edit; an insertion belongs to the item it lands in
+    size_t editEnd = oldSize - suffix;
+    size_t first = 0;
+    while (first < items.size() && items[first].end <= prefix) ++first;
+    size_t last = first;
+    while (last < items.size() && items[last].begin < editEnd) ++last;
+    if (last == first && first < items.size()) ++last;
+
+    size_t begin = first == 0 ? 0 : items[first - 1].end;
+    size_t oldEnd = std::max(editEnd, last > first ? items[last - 1].end : begin);
+    size_t newEnd = newSize - (oldSize - oldEnd);
+
+    Arena arena; // only needed until the new items are compiled and run
+    std::vector<Parsed> parsed;
+    try {
+        parsed = parseItems(next, begin, newEnd, arena, optimize);
+    }
+    catch (const std::exception&) {
+        // the edit moved item boundaries, e.g. opened a brace; a syntax error
+        // from the whole source leaves everything as it was
+        first = 0;
+        last = items.size();
+        begin = 0;
+        oldEnd = oldSize;
+        newEnd = newSize;
+        parsed = parseItems(next, begin, newEnd, arena, optimize);
+    }
+    parsedBytes = newEnd - begin;
+
+    // every name defined before or after the edit gets its live definition sorted out below
+    std::vector<std::string> touched;
+    // by text, so an item the edit only moved keeps its body, or doesn't run again
+    std::unordered_multimap<std::string_view, size_t> replaced;
+    for (size_t i = first; i < last; ++i) {
+        if (items[i].isFunction) touched.push_back(items[i].chunk->name);
+        replaced.emplace(itemText(text, items[i].begin, items[i].end), i);
+    }
+
+    std::vector<Item> fresh;
+    std::vector<const ASTNode*> statements; // to run once everything is defined
+    fresh.reserve(parsed.size());
+    for (const Parsed& p : parsed) {
+        Item item{ p.begin, p.end, p.line, p.func != nullptr, nullptr };
+        auto same = replaced.find(itemText(next, p.begin, p.end));
+        bool moved = same != replaced.end() && items[same->second].isFunction == item.isFunction;
+        if (p.func) {
+            if (moved) {
+                Item& old = items[same->second];
+                item.chunk = std::move(old.chunk);
+                shiftLines(*item.chunk, p.line - old.line);
+            }
+            else {
+                item.chunk = compileFunctionOrDefer(*p.func);
+            }
+            touched.push_back(item.chunk->name);
+        }
+        else if (!moved) {
+            statements.push_back(p.node);
+        }
+        if (moved) replaced.erase(same);
+        fresh.push_back(std::move(item));
+    }
+
+    // everything past the edit only moves
+    int lineDelta = newlines(std::string_view(next).substr(begin, newEnd - begin)) -
+        newlines(std::string_view(text).substr(begin, oldEnd - begin));
+    for (size_t i = last; i < items.size(); ++i) {
+        items[i].begin = items[i].begin + newSize - oldSize;
+        items[i].end = items[i].end + newSize - oldSize;
+        items[i].line += lineDelta;
+        if (items[i].chunk) shiftLines(*items[i].chunk, lineDelta);
+    }
+    items.erase(items.begin() + first, items.begin() + last);
+    items.insert(items.begin() + first, std::make_move_iterator(fresh.begin()), std::make_move_iterator(fresh.end()));
+    if (fresh.empty() && first > 0) items[first - 1].end = newEnd;
+    text = std::move(next);
+
+    // the last definition of a name is the live one, as when running the file
+    for (const auto& name : touched) {
+        auto live = std::find_if(items.rbegin(), items.rend(),
+            [&name](const Item& item) { return item.isFunction && item.chunk->name == name; });
+        if (live != items.rend()) interp.addFunction(*live->chunk);
+        else interp.removeFunction(name);
+    }
+
+    std::optional<Value> result;
+    for (const ASTNode* node : statements) {
+        result.reset();
+        if (!node) continue;
+        if (evaluate && node->kind == NodeKind::ExpressionStmt) result = interp.evalExpr(as<ExpressionStmt>(node)->expr);
+        else if (evaluate && node->kind == NodeKind::CallExpr) result = interp.evalExpr(node);
+        else interp.execStatement(node);
+    }
+    if (!parsed.empty() && parsed.back().func) result.reset();
+    return result;
+}
@@ -0,0 +1,49 @@
+// session.h
+#pragma once
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "interpreter.h"
+
+// A script kept loaded across edits, for hot reload and the REPL. Top-level
+// items are tracked by their span in the source, so an edit re-lexes and
+// re-parses only the items it touches; every other function keeps its
+// compiled body, and call sites stay linked to the same slots throughout.
+class Session {
+public:
+    explicit Session(int optimize = 2) : optimize(optimize) {}
+
+    // Replaces the source. Changed and new functions are compiled and swapped
+    // in, removed ones are undefined, and changed or new top-level statements
+    // run; the others don't run again. On a syntax or type error nothing
+    // changes.
+    void reload(std::string source);
+
+    // Appends input to the source as a REPL line. Returns the value of its
+    // last item if that is a bare expression.
+    std::optional<Value> eval(std::string_view input);
+
+    Interpreter& interpreter() { return interp; }
+    const std::string& source() const { return text; }
+    // how much of the source the last reload or eval went through the parser
+    size_t lastParsedBytes() const { return parsedBytes; }
+
+private:
+    struct Item {
+        size_t begin;  // span in text; runs up to the next item, trailing whitespace included
+        size_t end;
+        int line;
+        bool isFunction;
+        std::unique_ptr<Chunk> chunk; // functions only, installed while it is the last definition of its name
+    };
+
+    int optimize;
+    std::string text;
+    std::vector<Item> items; // in source order, each ending where the next begins
+    Interpreter interp;
+    size_t parsedBytes = 0;
+
+    std::optional<Value> apply(std::string next, bool evaluate);
+};
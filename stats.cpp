@@ -0,0 +1,124 @@
+// stats.cpp
+#include "stats.h"
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+// Every live thread's counters, and what finished threads left behind.
+struct Registry {
+    std::mutex lock;
+    std::vector<const ThreadStats*> live;
+    Stats finished;
+};
+
+Registry& registry() {
+    static Registry* instance = new Registry; // never destroyed: threads may exit during static destruction
+    return *instance;
+}
+
+void writeString(std::ostream& out, const std::string& text) {
+    out << '"';
+    for (char c : text) {
+        if (c == '"' || c == '\\') out << '\\' << c;
+        else if (static_cast<unsigned char>(c) < 0x20) out << ' ';
+        else out << c;
+    }
+    out << '"';
+}
+
+}
+
+void Stats::add(const Stats& other) {
+    instructions += other.instructions;
+    calls += other.calls;
+    peakFrameDepth = std::max(peakFrameDepth, other.peakFrameDepth);
+    peakRegisters = std::max(peakRegisters, other.peakRegisters);
+    peakGlobals = std::max(peakGlobals, other.peakGlobals);
+    arrays += other.arrays;
+    strings += other.strings;
+    memoHits += other.memoHits;
+    memoMisses += other.memoMisses;
+    astNodes += other.astNodes;
+    astBytes += other.astBytes;
+    bytesLexed += other.bytesLexed;
+    tokensLexed += other.tokensLexed;
+    for (const auto& [name, count] : other.callsByFunction) callsByFunction[name] += count;
+}
+
+void Stats::writeJson(std::ostream& out) const {
+    out << "{\"instructions\":" << instructions
+        << ",\"calls\":" << calls
+        << ",\"peakFrameDepth\":" << peakFrameDepth
+        << ",\"peakRegisters\":" << peakRegisters
+        << ",\"peakGlobals\":" << peakGlobals
+        << ",\"arrays\":" << arrays
+        << ",\"strings\":" << strings
+        << ",\"memoHits\":" << memoHits
+        << ",\"memoMisses\":" << memoMisses
+        << ",\"astNodes\":" << astNodes
+        << ",\"astBytes\":" << astBytes
+        << ",\"bytesLexed\":" << bytesLexed
+        << ",\"tokensLexed\":" << tokensLexed
+        << ",\"callsByFunction\":{";
+    bool first = true;
+    for (const auto& [name, count] : callsByFunction) {
+        if (!first) out << ',';
+        first = false;
+        writeString(out, name);
+        out << ':' << count;
+    }
+    out << "}}";
+}
+
+ThreadStats::ThreadStats() {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> guard(r.lock);
+    r.live.push_back(this);
+}
+
+ThreadStats::~ThreadStats() {
+    Registry& r = registry();
+    Stats last = snapshot();
+    std::lock_guard<std::mutex> guard(r.lock);
+    r.live.erase(std::find(r.live.begin(), r.live.end(), this));
+    r.finished.add(last);
+}
+
+void ThreadStats::addCalls(const std::string& function, uint64_t n) {
+    std::lock_guard<std::mutex> guard(callsLock);
+    callsByFunction[function] += n;
+}
+
+Stats ThreadStats::snapshot() const {
+    Stats s;
+    s.instructions = instructions.load(std::memory_order_relaxed);
+    s.calls = calls.load(std::memory_order_relaxed);
+    s.peakFrameDepth = peakFrameDepth.load(std::memory_order_relaxed);
+    s.peakRegisters = peakRegisters.load(std::memory_order_relaxed);
+    s.peakGlobals = peakGlobals.load(std::memory_order_relaxed);
+    s.arrays = arrays.load(std::memory_order_relaxed);
+    s.strings = strings.load(std::memory_order_relaxed);
+    s.memoHits = memoHits.load(std::memory_order_relaxed);
+    s.memoMisses = memoMisses.load(std::memory_order_relaxed);
+    s.astNodes = astNodes.load(std::memory_order_relaxed);
+    s.astBytes = astBytes.load(std::memory_order_relaxed);
+    s.bytesLexed = bytesLexed.load(std::memory_order_relaxed);
+    s.tokensLexed = tokensLexed.load(std::memory_order_relaxed);
+    std::lock_guard<std::mutex> guard(callsLock);
+    s.callsByFunction = callsByFunction;
+    return s;
+}
+
+ThreadStats& threadStats() {
+    thread_local ThreadStats stats;
+    return stats;
+}
+
+Stats collectStats() {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> guard(r.lock);
+    Stats total = r.finished;
+    for (const ThreadStats* stats : r.live) total.add(stats->snapshot());
+    return total;
+}
@@ -0,0 +1,83 @@
+// stats.h
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+// Built with INTERPRETER_STATS=0, every counter is compiled out: each hook is
+// an `if constexpr (statsEnabled)` and goes away with its operands.
+#ifndef INTERPRETER_STATS
+#define INTERPRETER_STATS 1
+#endif
+constexpr bool statsEnabled = INTERPRETER_STATS != 0;
+
+// Counters for one thread, or summed over threads.
+struct Stats {
+    uint64_t instructions = 0;   // bytecode instructions dispatched; compiled code runs uncounted
+    uint64_t calls = 0;          // from the host, the bytecode and the helpers of compiled code
+    uint64_t peakFrameDepth = 0;
+    uint64_t peakRegisters = 0;  // register slots in use across every frame
+    uint64_t peakGlobals = 0;
+    uint64_t arrays = 0;         // arrays allocated
+    uint64_t strings = 0;        // string buffers allocated; short strings and literals need none
+    uint64_t memoHits = 0;       // calls answered from a memo cache
+    uint64_t memoMisses = 0;
+    uint64_t astNodes = 0;       // arena allocations while parsing
+    uint64_t astBytes = 0;
+    uint64_t bytesLexed = 0;     // every lexed byte is parsed too
+    uint64_t tokensLexed = 0;
+    std::map<std::string, uint64_t> callsByFunction;
+
+    // sums, except that peaks keep the larger
+    void add(const Stats& other);
+    void writeJson(std::ostream& out) const;
+};
+
+// The running totals of the thread that owns them. Only that thread writes,
+// with a relaxed load and store, which costs what a plain add does; any
+// thread may read them, which is how collectStats gets them without a lock.
+// Interpreters keep their hottest counts in locals and add them here at
+// flushStats, so this is written per run, not per instruction.
+class ThreadStats {
+public:
+    std::atomic<uint64_t> instructions{ 0 }, calls{ 0 }, peakFrameDepth{ 0 }, peakRegisters{ 0 }, peakGlobals{ 0 },
+        arrays{ 0 }, strings{ 0 }, memoHits{ 0 }, memoMisses{ 0 }, astNodes{ 0 }, astBytes{ 0 }, bytesLexed{ 0 }, tokensLexed{ 0 };
+
+    static void add(std::atomic<uint64_t>& counter, uint64_t n) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    static void raise(std::atomic<uint64_t>& peak, uint64_t n) {
+        if (n > peak.load(std::memory_order_relaxed)) peak.store(n, std::memory_order_relaxed);
+    }
+
+    void addCalls(const std::string& function, uint64_t n);
+    Stats snapshot() const;
+
+    ThreadStats();
+    ~ThreadStats(); // its totals outlive the thread, in collectStats
+    ThreadStats(const ThreadStats&) = delete;
+    ThreadStats& operator=(const ThreadStats&) = delete;
+
+private:
+    mutable std::mutex callsLock; // taken per flush, never per call
+    std::map<std::string, uint64_t> callsByFunction;
+};
+
+// this thread's counters
+ThreadStats& threadStats();
+
+// every thread's counters, running or finished, added up
+Stats collectStats();
+
+// what a Parser run over bytes of source added to its arena
+inline void recordParse(uint64_t bytes, uint64_t tokens, uint64_t nodes, uint64_t nodeBytes) {
+    if constexpr (!statsEnabled) return;
+    ThreadStats& stats = threadStats();
+    ThreadStats::add(stats.bytesLexed, bytes);
+    ThreadStats::add(stats.tokensLexed, tokens);
+    ThreadStats::add(stats.astNodes, nodes);
+    ThreadStats::add(stats.astBytes, nodeBytes);
+}
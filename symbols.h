@@ -0,0 +1,51 @@
+// symbols.h
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Interned identifier. Two names are equal exactly when their symbols are.
+using Symbol = uint32_t;
+
+class SymbolTable {
+public:
+    // Nearly every call finds a name that is already there, so parsers on
+    // several threads mostly share the lock and only an insert takes it alone.
+    Symbol intern(std::string_view text) {
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            auto it = ids.find(text);
+            if (it != ids.end()) return it->second;
+        }
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        auto it = ids.find(text); // another thread may have added it in between
+        if (it != ids.end()) return it->second;
+        Symbol id = static_cast<Symbol>(names.size());
+        names.emplace_back(text);
+        ids.emplace(names.back(), id); // deque elements never move, so the key stays valid
+        return id;
+    }
+
+    const std::string& name(Symbol id) const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        return names[id];
+    }
+
+private:
+    mutable std::shared_mutex mutex;
+    std::deque<std::string> names;
+    std::unordered_map<std::string_view, Symbol> ids;
+};
+
+// process-wide table shared by every parser and interpreter
+inline SymbolTable& symbols() {
+    static SymbolTable table;
+    return table;
+}
+
+inline Symbol intern(std::string_view text) { return symbols().intern(text); }
+inline const std::string& symbolName(Symbol id) { return symbols().name(id); }
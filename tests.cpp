@@ -0,0 +1,537 @@
+// tests.cpp
+// Checks for behavior that is easy to break without noticing: what scripts
+// evaluate to, what the REPL accepts, how damaged caches load, and values
+// handed between threads and the memory limit that counts them.
+//   tests
+// Each failed check is printed to stderr; the exit code is 1 if any failed.
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "interpreter.h"
+#include "output.h"
+#include "program.h"
+#include "programcache.h"
+#include "runner.h"
+#include "session.h"
+#include "stats.h"
+
+namespace {
+
+int checks = 0;
+int failures = 0;
+
+void check(bool ok, std::string_view what) {
+    checks++;
+    if (ok) return;
+    failures++;
+    std::cerr << "FAILED: " << what << "\n";
+}
+
+std::string text(const std::optional<Value>& value) {
+    if (!value) return "(nothing)";
+    std::ostringstream out;
+    out << *value;
+    return out.str();
+}
+
+struct Setup {
+    int optimize = 2;
+    bool jit = false;
+    size_t memo = 0; // Interpreter::setMemoize
+};
+
+// bytecode instructions the last runMain dispatched; compiled code runs uncounted
+uint64_t lastInstructions = 0;
+
+// what main printed, then "=> " and what it returned, or the error it stopped with
+std::string runMain(const std::string& source, const Setup& setup = {}) {
+    MemorySink sink;
+    std::string result;
+    uint64_t before = collectStats().instructions;
+    try {
+        Program program = Program::compile(source, setup.optimize);
+        Interpreter interp;
+        interp.setOutput(sink);
+        interp.setJit(setup.jit);
+        interp.setMemoize(setup.memo);
+        interp.load(program);
+        try {
+            result = "=> " + text(interp.callFunction("main", {}));
+        }
+        catch (const std::exception& e) {
+            result = std::string("error: ") + e.what();
+        }
+        interp.flushOutput();
+    }
+    catch (const std::exception& e) {
+        result = std::string("error: ") + e.what();
+    }
+    lastInstructions = collectStats().instructions - before; // the interpreter flushed its counts when destroyed
+    return sink.str() + result;
+}
+
+void checkRun(const std::string& source, const Setup& setup, std::string_view expected, std::string_view what) {
+    std::string got = runMain(source, setup);
+    check(got == expected, std::string(what) + " gave\n" + got + "\nnot\n" + std::string(expected));
+}
+
+// The left operand is read after the right one is evaluated, straight from
+// its local's slot, unless the right side may assign; these hide the
+// assignment inside an index, an array literal and an element store.
+void assignmentsInOperands() {
+    const std::string source =
+        "function main(): int {\n"
+        "    let x: int = 1;\n"
+        "    let a: int[] = [10, 20, 30, 40];\n"
+        "    print(x + a[x = 3]);\n"
+        "    x = 1;\n"
+        "    print(x + len([x = 3, 1, 1, 1, 1]));\n"
+        "    x = 1;\n"
+        "    print(x + (a[0] = x = 5));\n"
+        "    return x;\n"
+        "}\n";
+    for (int optimize : { 0, 2 }) {
+        checkRun(source, { optimize }, "41\n6\n6\n=> 5", "assignments inside the right operand at -O" + std::to_string(optimize));
+    }
+}
+
+// Every optimizer level has to behave as -O0 does: folding wraps like the
+// int ops, 1 / 0 is left to fail at run time, a dropped loop still runs its
+// initializer, and propagation respects shadowing and reassignment.
+void optimizerKeepsBehavior() {
+    const std::string source =
+        "let calls: int = 0;\n"
+        "function bump(): int { calls = calls + 1; return calls; }\n"
+        "function f(n: int): int {\n"
+        "    const k: int = 6 * 7;\n"
+        "    let unchanged: int = 10;\n"
+        "    let changed: int = 1;\n"
+        "    for (let i: int = 0; i < n; i++) { changed = changed * 2; }\n"
+        "    let wrapped: int = 2147483647 + 1;\n"
+        "    let d: double = 1.5 * 4;\n"
+        "    let s: string = \"a\" + \"b\" + 1;\n"
+        "    print(k + unchanged + changed);\n"
+        "    print(wrapped);\n"
+        "    print(d);\n"
+        "    print(s);\n"
+        "    print(s == \"ab1\");\n"
+        "    while (0) { print(\"never\"); }\n"
+        "    for (let j: int = bump(); 0; j++) { print(\"never\"); }\n"
+        "    let x: int = 1;\n"
+        "    for (let i: int = 0; i < 1; i++) { let x: int = 2; print(x); }\n"
+        "    print(x);\n"
+        "    return k;\n"
+        "    print(\"dead\");\n"
+        "}\n"
+        "function main(): int { print(f(3)); print(calls); print(1 / 0); return 0; }\n";
+    const std::string expected = "60\n-2147483648\n6\nab1\ntrue\n2\n1\n42\n1\nerror: Division by zero";
+    checkRun(source, { 0 }, expected, "the optimizer's test script at -O0");
+    checkRun(source, { 1 }, expected, "the optimizer's test script at -O1");
+    checkRun(source, { 2 }, expected, "the optimizer's test script at -O2");
+
+    const std::string loop =
+        "function main(): int { const k: int = 6; let t: int = 0; for (let i: int = 0; i < 100; i++) { t = t + k * 7; } return t; }\n";
+    checkRun(loop, { 0 }, "=> 4200", "a loop with constant arithmetic at -O0");
+    uint64_t unoptimized = lastInstructions;
+    checkRun(loop, { 2 }, "=> 4200", "a loop with constant arithmetic at -O2");
+    if constexpr (statsEnabled) check(lastInstructions < unoptimized, "-O2 folds a propagated constant out of the loop");
+}
+
+// Interpreter::addFunction(name, decl) compiles a parsed function without
+// the TypeChecker, so nothing holds its locals to their declared types: a
+// len() bound can't prove s[i] in range, as s may be a string, and the
+// index must stay checked and fail as it would anywhere else.
+void uncheckedIndexes() {
+    const std::string sources[] = {
+        "function f(): int { let s: string = \"abcdefghijklmnopqrstuvwxyz0123456789\"; let t: int = 0;"
+        " for (let i: int = 0; i < len(s); i++) { t = t + s[i]; } return t; }",
+        "function f(): int { let s: int[] = \"abcdefghijklmnopqrstuvwxyz0123456789\"; let t: int = 0;"
+        " for (let i: int = 0; i < len(s); i++) { t = t + s[i]; } return t; }",
+    };
+    for (const std::string& source : sources) {
+        Arena arena;
+        Lexer lexer(source);
+        Parser parser(lexer, arena);
+        FunctionDecl* decl = parser.parseFunction();
+        Interpreter interp;
+        interp.addFunction("f", decl);
+        std::string got;
+        try {
+            got = "=> " + text(interp.callFunction("f", {}));
+        }
+        catch (const std::exception& e) {
+            got = std::string("error: ") + e.what();
+        }
+        check(got.starts_with("error: "), "indexing a string in an unchecked function gave " + got);
+    }
+}
+
+// Runs source interpreted and then with the JIT, which must print and return
+// the same. Each script warms its functions past Jit::callThreshold first;
+// with stats compiled in, the JIT run must also dispatch fewer instructions,
+// or compiled code never ran and the comparison proves nothing.
+void checkJit(const std::string& source, std::string_view expected, std::string_view what) {
+    checkRun(source, {}, expected, std::string(what) + ", interpreted");
+    uint64_t interpreted = lastInstructions;
+    if (!Jit::available()) return;
+    checkRun(source, { 2, true }, expected, std::string(what) + ", compiled");
+    if constexpr (statsEnabled) check(lastInstructions < interpreted, std::string(what) + ": compiled code ran");
+}
+
+void jitMatchesInterpreter() {
+    checkJit(
+        "function add(a: int, b: int): int { return a + b; }\n"
+        "function mul(a: int, b: int): int { return a * b; }\n"
+        "function main(): int {\n"
+        "    let s: int = 0;\n"
+        "    for (let i: int = 0; i < 3000; i++) { s = add(s, 2147483); s = mul(s, 3); }\n"
+        "    print(s);\n"
+        "    let big: int = 2147483647;\n"
+        "    print(add(big, 1));\n"
+        "    print(mul(big, big));\n"
+        "    return 0;\n"
+        "}\n",
+        "-1712108112\n-2147483648\n1\n=> 0", "int overflow wraps");
+
+    checkJit(
+        "function div(a: int, b: int): int { return a / b; }\n"
+        "function main(): int {\n"
+        "    let s: int = 0;\n"
+        "    for (let i: int = 1; i < 3000; i++) { s = s + div(100000, i); }\n"
+        "    print(s);\n"
+        "    let min: int = 0 - 2147483647 - 1;\n"
+        "    print(div(min, 0 - 1));\n"
+        "    print(div(7, 0));\n"
+        "    return 0;\n"
+        "}\n",
+        "856849\n-2147483648\nerror: Division by zero", "INT_MIN / -1 and division by zero");
+
+    // past JitContext::maxDepth native calls go back to the interpreter, and
+    // side, which holds a double, is never compiled, so frames alternate
+    checkJit(
+        "function sum(n: int): int { while (n == 0) { return 0; } return n + sum(n - 1); }\n"
+        "function down(n: int): int { while (n == 0) { return 0; } return 1 + side(n - 1); }\n"
+        "function side(n: int): int { let d: double = 0.5; while (n == 0) { return 0; } return 1 + down(n - 1); }\n"
+        "function main(): int {\n"
+        "    let s: int = 0;\n"
+        "    for (let i: int = 0; i < 20; i++) { s = s + sum(5000) + down(3000); }\n"
+        "    print(s);\n"
+        "    return 0;\n"
+        "}\n",
+        "250110000\n=> 0", "native and interpreted recursion past maxDepth");
+
+    // g is compiled, and called natively from caller's compiled loop, when
+    // it is redefined: first with a new body, then with one parameter fewer
+    const std::string caller =
+        "function caller(n: int): int {\n"
+        "    let s: int = 0;\n"
+        "    for (let i: int = 0; i < n; i++) { s = s + g(i, 2); }\n"
+        "    return s;\n"
+        "}\n";
+    auto redefine = [&caller](bool jit) {
+        Session session;
+        session.interpreter().setJit(jit);
+        std::string out;
+        auto eval = [&](const std::string& g) {
+            try {
+                session.reload(caller + g);
+                out += text(session.eval("caller(3000);"));
+            }
+            catch (const std::exception& e) {
+                out += std::string("error: ") + e.what();
+            }
+            out += "\n";
+        };
+        eval("function g(a: int, b: int): int { return a + b; }\n");
+        eval("function g(a: int, b: int): int { return a * b; }\n");
+        eval("function g(a: int): int { return a; }\n");
+        return out;
+    };
+    const std::string expected = "4504500\n8997000\nerror: Wrong number of arguments to g: expected 1, got 2\n";
+    uint64_t before = collectStats().instructions;
+    std::string interpreted = redefine(false);
+    uint64_t interpretedCount = collectStats().instructions - before;
+    check(interpreted == expected, "redefining a called function, interpreted, gave\n" + interpreted);
+    if (Jit::available()) {
+        before = collectStats().instructions;
+        std::string compiled = redefine(true);
+        check(compiled == expected, "redefining a natively called function gave\n" + compiled);
+        if constexpr (statsEnabled) check(collectStats().instructions - before < interpretedCount, "redefining: compiled code ran");
+    }
+}
+
+// input as the REPL sends it, after it has added the optional ';'
+void checkEval(Session& session, std::string_view input, std::string_view expected) {
+    std::string got;
+    try {
+        got = text(session.eval(input));
+    }
+    catch (const std::exception& e) {
+        got = std::string("error: ") + e.what();
+    }
+    check(got == expected, "REPL `" + std::string(input) + "` gave " + got + ", not " + std::string(expected));
+}
+
+void replExpressions() {
+    Session session;
+    checkEval(session, "1 + 2;", "3");
+    checkEval(session, "(3);", "3");
+    checkEval(session, "((1 + 2) * 4);", "12");
+    checkEval(session, "\"abc\";", "abc");
+    checkEval(session, "\"a\" + 1;", "a1");
+    checkEval(session, "true;", "true");
+    checkEval(session, "false;", "false");
+    checkEval(session, "[1, 2];", "[1, 2]");
+    checkEval(session, "let x: int = 4;", "(nothing)");
+    checkEval(session, "(x + 1) * 2;", "10");
+    checkEval(session, "x;", "4");
+}
+
+// Memoizing must not change what a script prints or returns: functions
+// that print, read globals or call such functions run every time, an array
+// argument is keyed on its elements, and a cache too small to hold the
+// recursion only costs time. The JIT leaves memoized functions to it.
+void memoKeepsBehavior() {
+    const std::string source =
+        "let base: int = 1;\n"
+        "function fib(n: int): int { while (n < 2) { return n; } return fib(n - 1) + fib(n - 2); }\n"
+        "function noisy(n: int): int { print(n); return n * 2; }\n"
+        "function wrap(n: int): int { return noisy(n) + 1; }\n"
+        "function plus(n: int): int { return n + base; }\n"
+        "function total(a: int[]): int { let t: int = 0; for (let i: int = 0; i < len(a); i++) { t = t + a[i]; } return t; }\n"
+        "function main(): int {\n"
+        "    print(fib(25));\n"
+        "    print(wrap(3));\n"
+        "    print(wrap(3));\n"
+        "    print(plus(1));\n"
+        "    base = 10;\n"
+        "    print(plus(1));\n"
+        "    let a: int[] = [1, 2, 3];\n"
+        "    print(total(a));\n"
+        "    a[0] = 5;\n"
+        "    print(total(a));\n"
+        "    return fib(25);\n"
+        "}\n";
+    const std::string expected = "75025\n3\n7\n3\n7\n2\n11\n6\n10\n=> 75025";
+    checkRun(source, {}, expected, "the memo test script, not memoized");
+    uint64_t plain = lastInstructions;
+    checkRun(source, { 2, false, 65536 }, expected, "the memo test script, memoized");
+    if constexpr (statsEnabled) check(lastInstructions < plain / 100, "memoized fib solves each subproblem once");
+    checkRun(source, { 2, false, 2 }, expected, "the memo test script with room for two results");
+    if (Jit::available()) checkRun(source, { 2, true, 65536 }, expected, "the memo test script, memoized and compiled");
+
+    // a throw caches nothing, and redefining a function drops every cache
+    Session session;
+    Interpreter& interp = session.interpreter();
+    interp.setMemoize(64);
+    const std::string inv = "function inv(n: int): int { return 100 / n; }\n";
+    session.reload(inv + "function fib(n: int): int { while (n < 2) { return n; } return fib(n - 1) + fib(n - 2); }\n");
+    checkEval(session, "inv(0);", "error: Division by zero");
+    checkEval(session, "inv(0);", "error: Division by zero");
+    checkEval(session, "inv(4);", "25");
+    checkEval(session, "fib(20);", "6765");
+    Interpreter::MemoCounts counts = interp.memoCounts(interp.function("fib"));
+    check(counts.misses == 21 && counts.hits == 18, "fib(20) solved each of fib(0..20) once and looked up the rest");
+    session.reload(inv + "function fib(n: int): int { while (n < 2) { return 1; } return fib(n - 1) + fib(n - 2); }\n");
+    checkEval(session, "fib(20);", "10946");
+    counts = interp.memoCounts(interp.function("fib"));
+    check(counts.misses == 21 && counts.hits == 18, "redefining fib started its cache over");
+}
+
+std::string readFile(const std::filesystem::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+void writeFile(const std::filesystem::path& path, const std::string& bytes) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+}
+
+// the first instruction in chunk with that opcode
+const Instruction* find(const Chunk& chunk, OpCode op) {
+    for (const Instruction& ins : chunk.code) {
+        if (ins.op == op) return &ins;
+    }
+    return nullptr;
+}
+
+// bytes with the stored copy of ins replaced by changed; the padding byte is skipped
+std::string corrupt(std::string bytes, const Instruction& ins, const Instruction& changed) {
+    auto fields = [](const Instruction& i, char* out) {
+        out[0] = static_cast<char>(i.op);
+        std::memcpy(out + 1, &i.a, 2);
+        std::memcpy(out + 3, &i.b, 2);
+        std::memcpy(out + 5, &i.c, 2);
+    };
+    char want[7], put[7];
+    fields(ins, want);
+    fields(changed, put);
+    for (size_t at = 0; at + sizeof(Instruction) <= bytes.size(); ++at) {
+        char* stored = bytes.data() + at;
+        if (stored[0] != want[0] || std::memcmp(stored + offsetof(Instruction, a), want + 1, 6) != 0) continue;
+        stored[0] = put[0];
+        std::memcpy(stored + offsetof(Instruction, a), put + 1, 6);
+        return bytes;
+    }
+    check(false, "corrupted instruction not found in the cache");
+    return bytes;
+}
+
+void damagedCache() {
+    const std::string source =
+        "function sum(a: int[]): int {\n"
+        "    let s: int = 0;\n"
+        "    for (let i: int = 0; i < len(a); i++) { s = s + a[i]; }\n"
+        "    return s;\n"
+        "}\n"
+        "function main(): int {\n"
+        "    let s: int = sum([1, 2, 3]);\n"
+        "    print(\"done\");\n"
+        "    return s;\n"
+        "}\n";
+    uint64_t key = programCacheKey(source, 2);
+    Program program = Program::compile(source, 2);
+    ProgramCacheWriter writer(key);
+    for (const auto& unit : program.units()) {
+        if (unit.isFunction) writer.addFunction(*unit.chunk);
+        else writer.addStatement(*unit.chunk);
+    }
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "interpreter-tests.jspp.jsc";
+    check(writer.save(path.string()), "cache saved");
+    std::string clean = readFile(path);
+
+    std::vector<CompiledUnit> units;
+    check(loadProgramCache(path.string(), key, units) && units.size() == 2, "an intact cache loads");
+    const Chunk& sum = *program.units()[0].chunk;
+    const Chunk& main = *program.units()[1].chunk;
+    check(find(sum, OpCode::GetIndexUnchecked) != nullptr, "the compiler proves a[i] in range");
+    if (!units.empty()) {
+        check(find(*units[0].chunk, OpCode::GetIndexUnchecked) == nullptr, "a loaded GetIndexUnchecked is checked again");
+    }
+
+    struct Damage {
+        const char* what;
+        const Instruction* ins;
+        uint16_t Instruction::* field;
+        uint16_t value;
+    };
+    const Damage damages[] = {
+        { "call name index", find(main, OpCode::Call), &Instruction::b, 0xFFFF },
+        { "return register", find(sum, OpCode::Return), &Instruction::a, 0xFFFF },
+        { "loop jump offset", find(sum, OpCode::ForLoop), &Instruction::b, 0x7FFF },
+        { "constant index", find(main, OpCode::LoadConst), &Instruction::b, 0x1000 },
+    };
+    for (const Damage& damage : damages) {
+        if (!damage.ins) {
+            check(false, std::string("no instruction to damage for ") + damage.what);
+            continue;
+        }
+        Instruction changed = *damage.ins;
+        changed.*damage.field = damage.value;
+        writeFile(path, corrupt(clean, *damage.ins, changed));
+        bool loaded = loadProgramCache(path.string(), key, units);
+        check(!loaded && units.empty(), std::string("a cache with a bad ") + damage.what + " is rejected");
+    }
+    std::filesystem::remove(path);
+}
+
+// Arrays and strings that runParallel returns are rebuilt on the calling
+// thread, which counts their bytes and frees them, and the workers' copies
+// never touch its counters.
+void parallelResults() {
+    const std::string source =
+        "function spin(): int {\n" // long enough that every worker gets an invocation
+        "    let s: int = 0;\n"
+        "    for (let i: int = 0; i < 2000000; i++) { s = s + i; }\n"
+        "    return s;\n"
+        "}\n"
+        "function make(n: int): int[] { spin(); return array(n); }\n"
+        "function name(n: int): string {\n"
+        "    spin();\n"
+        "    let s: string = \"\";\n"
+        "    for (let i: int = 0; i < n; i++) { s = s + \"x\"; }\n"
+        "    return s;\n"
+        "}\n";
+    Program program = Program::compile(source);
+    size_t arrays = liveArrayBytes, strings = liveStringBytes;
+    {
+        std::vector<RunResult> made = runParallel(program, "make", { { 1000 }, { 1000 }, { 1000 }, { 1000 } }, 4);
+        std::vector<RunResult> named = runParallel(program, "name", { { 100 }, { 100 }, { 100 }, { 100 } }, 4);
+        bool ok = true;
+        for (const RunResult& r : made) ok = ok && r.error.empty() && r.value.isArray() && r.value.items().size() == 1000;
+        for (const RunResult& r : named) ok = ok && r.error.empty() && r.value.isString() && r.value.text() == std::string(100, 'x');
+        check(ok, "runParallel returns arrays and strings");
+        check(liveArrayBytes == arrays + 4 * 1000 * sizeof(int), "returned arrays are counted on the calling thread");
+        check(liveStringBytes > strings, "returned strings are counted on the calling thread");
+    }
+    check(liveArrayBytes == arrays, "freeing returned arrays leaves the array count as it was");
+    check(liveStringBytes == strings, "freeing returned strings leaves the string count as it was");
+}
+
+// --max-memory reads the same counters. Freeing runParallel results used to
+// take their bytes off this thread's count without having added them, and
+// the wrapped count let a script past its limit by that much.
+void memoryLimitAfterParallelResults() {
+    const std::string source =
+        "function spin(): int {\n"
+        "    let s: int = 0;\n"
+        "    for (let i: int = 0; i < 2000000; i++) { s = s + i; }\n"
+        "    return s;\n"
+        "}\n"
+        "function make(n: int): int[] { spin(); return array(n); }\n"
+        "function fill(n: int): int { let a: int[] = array(n); return len(a); }\n";
+    Program program = Program::compile(source);
+    std::vector<RunResult> made = runParallel(program, "make", { { 100000 }, { 100000 }, { 100000 }, { 100000 } }, 4);
+    int arrays = 0;
+    for (const RunResult& r : made) arrays += r.value.isArray() && r.value.items().size() == 100000;
+    check(arrays == 4, "runParallel returns the arrays");
+    made.clear();
+
+    ExecutionLimits limits;
+    limits.maxMemory = 1 << 20;
+    auto fill = [&](int n) -> std::string {
+        Interpreter interp;
+        interp.setLimits(limits);
+        interp.load(program);
+        try {
+            Value args[] = { Value(n) };
+            std::ostringstream out;
+            out << interp.callFunction("fill", args);
+            return out.str();
+        }
+        catch (const std::exception& e) {
+            return e.what();
+        }
+    };
+    std::string small = fill(10000);
+    check(small == "10000", "40 KB fits a 1 MB limit after parallel results are freed, not: " + small);
+    std::string large = fill(300000);
+    check(large.find("Memory limit") != std::string::npos, "1.2 MB exceeds a 1 MB limit after parallel results are freed, not: " + large);
+}
+
+}
+
+int main() {
+    assignmentsInOperands();
+    optimizerKeepsBehavior();
+    uncheckedIndexes();
+    jitMatchesInterpreter();
+    replExpressions();
+    memoKeepsBehavior();
+    damagedCache();
+    parallelResults();
+    memoryLimitAfterParallelResults();
+    std::cerr << checks << " checks, " << failures << " failed\n";
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,82 @@
+// tokenbuffer.h
+#pragma once
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include "lexer.h"
+
+// Ring of tokens between the Lexer and the Parser. Tokens are lexed in
+// batches into parallel arrays, one per field, and read by position relative
+// to the current token, so the parser can look several tokens ahead without
+// lexing anything twice or copying Token structs around.
+class TokenBuffer {
+public:
+    // how far past the current token type(k) and friends may look
+    static constexpr size_t maxLookahead = 64;
+
+    explicit TokenBuffer(Lexer& lexer) : lexer(lexer), source(lexer.text()) {
+        if (source.size() > UINT32_MAX) throw std::runtime_error("Source is too large");
+        fill();
+    }
+
+    // k tokens past the current one; past the end, the End token
+    token_type type(size_t k = 0) const { return types[slot(k)]; }
+    int line(size_t k = 0) const { return lines[slot(k)]; }
+    int column(size_t k = 0) const { return columns[slot(k)]; }
+    // offset in the source where the token starts
+    size_t offset(size_t k = 0) const { return offsets[slot(k)]; }
+    // a view of the source, or the message of an Unexpected token
+    std::string_view lexeme(size_t k = 0) const {
+        size_t s = slot(k);
+        if (types[s] == token_type::Unexpected) return { messages[s], lengths[s] };
+        return source.substr(offsets[s], lengths[s]);
+    }
+
+    // tokens lexed so far, End included
+    size_t lexed() const { return filled; }
+
+    // moves to the next token, staying on End once it is reached
+    void advance() {
+        if (head + 1 < filled) ++head;
+        if (!ended && filled - head <= maxLookahead) fill();
+    }
+
+private:
+    static constexpr size_t capacity = 256; // a power of two, well above maxLookahead
+    static constexpr size_t mask = capacity - 1;
+
+    Lexer& lexer;
+    std::string_view source;
+    size_t head = 0;   // index of the current token, counting from the first one lexed
+    size_t filled = 0; // tokens lexed so far
+    bool ended = false;
+
+    std::array<token_type, capacity> types;
+    std::array<uint32_t, capacity> offsets;
+    std::array<uint32_t, capacity> lengths;
+    std::array<int, capacity> lines;
+    std::array<int, capacity> columns;
+    std::array<const char*, capacity> messages; // Unexpected tokens only
+
+    // the ring always holds more than maxLookahead tokens past head unless
+    // it already holds End, so clamping to the last one lexed yields End
+    size_t slot(size_t k) const {
+        size_t i = head + k;
+        return (i < filled ? i : filled - 1) & mask;
+    }
+
+    void fill() {
+        while (!ended && filled - head < capacity) {
+            Token token = lexer.nextToken();
+            size_t s = filled & mask;
+            types[s] = token.type;
+            offsets[s] = static_cast<uint32_t>(lexer.tokenStart());
+            lengths[s] = static_cast<uint32_t>(token.lexeme.size());
+            lines[s] = token.line;
+            columns[s] = token.column;
+            messages[s] = token.type == token_type::Unexpected ? token.lexeme.data() : nullptr;
+            ended = token.type == token_type::End;
+            ++filled;
+        }
+    }
+};
@@ -0,0 +1,299 @@
+// typechecker.cpp
+#include "typechecker.h"
+
+StaticType declaredType(Symbol type) {
+    const std::string& name = symbolName(type);
+    if (name == "int") return StaticType::Int;
+    if (name == "double") return StaticType::Double;
+    if (name == "bool") return StaticType::Bool;
+    if (name == "int[]") return StaticType::Array;
+    if (name == "string") return StaticType::String;
+    return StaticType::Unknown;
+}
+
+void declareSignature(Signatures& signatures, const FunctionDecl& func) {
+    Signature signature;
+    for (const auto& param : func.params) signature.params.push_back(declaredType(param.type));
+    signature.result = declaredType(func.returnType);
+    auto [it, added] = signatures.try_emplace(func.name, signature);
+    // the same types again changes nothing a call site relies on
+    if (!added && (it->second.params != signature.params || it->second.result != signature.result))
+        it->second.stable = false;
+}
+
+// false only for a type that can never be a number, so the operation would fail whenever it ran
+static bool mayBeNumber(StaticType type) {
+    return type == StaticType::Unknown || type == StaticType::Int || type == StaticType::Double;
+}
+
+static bool mayBe(StaticType type, StaticType expected) {
+    return type == StaticType::Unknown || type == expected;
+}
+
+void TypeChecker::check(ASTNode* node) {
+    locals.clear();
+    scopeDepth = 0;
+    function = nullptr;
+    result = StaticType::Unknown;
+    if (auto func = as<FunctionDecl>(node)) checkFunction(func);
+    else statement(node);
+}
+
+void TypeChecker::checkFunction(FunctionDecl* func) {
+    function = func;
+    result = typeOf(func->returnType, func);
+    // parameters and the top of the body share one scope, as in the compiler,
+    // where a top-level let of a parameter's name assigns to the parameter
+    scopeDepth = 1;
+    for (const auto& param : func->params) locals.push_back({ param.name, typeOf(param.type, func), scopeDepth });
+    for (auto* stmt : func->body) statement(stmt);
+    endScope();
+    func->typed = true;
+}
+
+void TypeChecker::block(const NodeList& body) {
+    scopeDepth++;
+    for (auto* stmt : body) statement(stmt);
+    endScope();
+}
+
+void TypeChecker::endScope() {
+    while (!locals.empty() && locals.back().depth == scopeDepth) locals.pop_back();
+    scopeDepth--;
+}
+
+void TypeChecker::statement(ASTNode* node) {
+    if (!node) return;
+
+    switch (node->kind) {
+    case NodeKind::FunctionDecl:
+        checkFunction(static_cast<FunctionDecl*>(node));
+        break;
+    case NodeKind::VarDecl: {
+        auto var = static_cast<VarDecl*>(node);
+        StaticType type = typeOf(var->type, var);
+        expression(var->initializer);
+        coerce(var->initializer, type, "'" + symbolName(var->name) + "'");
+        // at global scope it is a global, whose type nothing can rely on
+        if (scopeDepth > 0) locals.push_back({ var->name, type, scopeDepth });
+        break;
+    }
+    case NodeKind::ReturnStmt: {
+        auto ret = static_cast<ReturnStmt*>(node);
+        expression(ret->expression);
+        if (function) coerce(ret->expression, result, "the result of '" + symbolName(function->name) + "'");
+        break;
+    }
+    case NodeKind::PrintStmt:
+        expression(static_cast<PrintStmt*>(node)->expression);
+        break;
+    case NodeKind::ExpressionStmt:
+        expression(static_cast<ExpressionStmt*>(node)->expr);
+        break;
+    case NodeKind::WhileStmt: {
+        auto whileStmt = static_cast<WhileStmt*>(node);
+        expression(whileStmt->condition);
+        block(whileStmt->body);
+        break;
+    }
+    case NodeKind::ForStmt: {
+        auto forStmt = static_cast<ForStmt*>(node);
+        scopeDepth++;
+        statement(forStmt->init);
+        expression(forStmt->condition);
+        block(forStmt->body);
+        statement(forStmt->increment);
+        endScope();
+        break;
+    }
+    case NodeKind::ForEachStmt: {
+        auto forEach = static_cast<ForEachStmt*>(node);
+        expression(forEach->iterable);
+        if (!mayBe(forEach->iterable->type, StaticType::Array))
+            fail(forEach->iterable, std::string("for-in needs an array, got ") + staticTypeName(forEach->iterable->type));
+        StaticType type = typeOf(forEach->varType, forEach);
+        if (type != StaticType::Int)
+            fail(forEach, "'" + symbolName(forEach->varName) + "' is " + staticTypeName(type) + ", but arrays hold ints");
+        scopeDepth++;
+        locals.push_back({ forEach->varName, type, scopeDepth });
+        block(forEach->body);
+        endScope();
+        break;
+    }
+    case NodeKind::BreakStmt:
+    case NodeKind::ContinueStmt:
+        break;
+    default:
+        expression(node);
+        break;
+    }
+}
+
+void TypeChecker::expression(ASTNode* node) {
+    if (!node) return;
+
+    switch (node->kind) {
+    case NodeKind::Identifier: {
+        const Local* local = resolve(static_cast<Identifier*>(node)->name);
+        node->type = local ? local->type : StaticType::Unknown;
+        break;
+    }
+    case NodeKind::BinaryExpr: {
+        // left chains are as deep as they are long, so type them bottom up
+        std::vector<BinaryExpr*> chain;
+        ASTNode* leftmost = node;
+        while (auto bin = as<BinaryExpr>(leftmost)) {
+            chain.push_back(bin);
+            leftmost = bin->left;
+        }
+        expression(leftmost);
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+            BinaryExpr* bin = *it;
+            expression(bin->right);
+            StaticType l = bin->left->type, r = bin->right->type;
+            if (bin->op == BinaryOp::Equal || bin->op == BinaryOp::NotEqual) {
+                bin->type = StaticType::Bool; // any two values compare
+                continue;
+            }
+            if (bin->op == BinaryOp::Add && (l == StaticType::String || r == StaticType::String)) {
+                bin->type = StaticType::String; // the other side is written out as print() would
+                continue;
+            }
+            if (!mayBeNumber(l) || !mayBeNumber(r)) {
+                fail(bin, std::string("'") + binaryOpToString(bin->op) + "' needs numbers, got " +
+                    staticTypeName(mayBeNumber(l) ? r : l));
+            }
+            if (isComparison(bin->op)) bin->type = StaticType::Bool;
+            else if (l == StaticType::Int && r == StaticType::Int) bin->type = StaticType::Int;
+            // an unknown side of + may turn out to be a string
+            else if (bin->op == BinaryOp::Add && (l == StaticType::Unknown || r == StaticType::Unknown)) bin->type = StaticType::Unknown;
+            // a double on either side makes the result double, if it succeeds at all
+            else if (l == StaticType::Double || r == StaticType::Double) bin->type = StaticType::Double;
+            else bin->type = StaticType::Unknown;
+        }
+        break;
+    }
+    case NodeKind::CallExpr:
+        call(static_cast<CallExpr*>(node));
+        break;
+    case NodeKind::AssignStmt:
+        assign(static_cast<AssignStmt*>(node));
+        break;
+    case NodeKind::IndexAssignStmt:
+        indexAssign(static_cast<IndexAssignStmt*>(node));
+        break;
+    case NodeKind::IndexExpr: {
+        auto index = static_cast<IndexExpr*>(node);
+        expression(index->array);
+        expression(index->index);
+        if (!mayBe(index->array->type, StaticType::Array))
+            fail(index, std::string("only arrays can be indexed, got ") + staticTypeName(index->array->type));
+        if (!mayBe(index->index->type, StaticType::Int))
+            fail(index->index, std::string("array index must be an int, got ") + staticTypeName(index->index->type));
+        node->type = StaticType::Int;
+        break;
+    }
+    case NodeKind::ArrayLiteral: {
+        for (auto* element : static_cast<ArrayLiteral*>(node)->elements) {
+            expression(element);
+            if (!mayBe(element->type, StaticType::Int))
+                fail(element, std::string("array elements must be ints, got ") + staticTypeName(element->type));
+        }
+        node->type = StaticType::Array;
+        break;
+    }
+    case NodeKind::CoerceExpr:
+        expression(static_cast<CoerceExpr*>(node)->expr);
+        break;
+    default:
+        break; // literals are typed when they are made
+    }
+}
+
+void TypeChecker::call(CallExpr* callExpr) {
+    for (auto* arg : callExpr->args) expression(arg);
+    const std::string& name = symbolName(callExpr->funcName);
+
+    // builtins; the Compiler reports a wrong argument count
+    if (name == "len" || name == "array") {
+        bool isLen = name == "len";
+        if (callExpr->args.size() == 1) {
+            StaticType type = callExpr->args[0]->type;
+            if (isLen && !mayBe(type, StaticType::Array) && type != StaticType::String)
+                fail(callExpr->args[0], std::string("len() takes an array or a string, got ") + staticTypeName(type));
+            if (!isLen && !mayBe(type, StaticType::Int))
+                fail(callExpr->args[0], std::string("array() takes an int size, got ") + staticTypeName(type));
+        }
+        callExpr->type = isLen ? StaticType::Int : StaticType::Array;
+        return;
+    }
+
+    auto it = functions.find(callExpr->funcName);
+    if (it == functions.end() || !it->second.stable) return;
+    const Signature& signature = it->second;
+    if (callExpr->args.size() != signature.params.size()) {
+        fail(callExpr, "'" + name + "' takes " + std::to_string(signature.params.size()) + " arguments, got " +
+            std::to_string(callExpr->args.size()));
+    }
+    for (uint32_t i = 0; i < callExpr->args.count; ++i) {
+        coerce(callExpr->args.items[i], signature.params[i],
+            "argument " + std::to_string(i + 1) + " of '" + name + "'");
+    }
+    callExpr->checked = true;
+    callExpr->type = signature.result;
+}
+
+void TypeChecker::assign(AssignStmt* assignStmt) {
+    expression(assignStmt->value);
+    if (const Local* local = resolve(assignStmt->name))
+        coerce(assignStmt->value, local->type, "'" + symbolName(assignStmt->name) + "'");
+    assignStmt->type = assignStmt->value ? assignStmt->value->type : StaticType::Unknown;
+}
+
+void TypeChecker::indexAssign(IndexAssignStmt* assignStmt) {
+    expression(assignStmt->index);
+    expression(assignStmt->value);
+    const Local* local = resolve(assignStmt->name);
+    if (local && !mayBe(local->type, StaticType::Array))
+        fail(assignStmt, std::string("only arrays can be indexed, got ") + staticTypeName(local->type));
+    if (!mayBe(assignStmt->index->type, StaticType::Int))
+        fail(assignStmt->index, std::string("array index must be an int, got ") + staticTypeName(assignStmt->index->type));
+    if (!mayBe(assignStmt->value->type, StaticType::Int))
+        fail(assignStmt->value, std::string("array elements must be ints, got ") + staticTypeName(assignStmt->value->type));
+    assignStmt->type = StaticType::Int;
+}
+
+// value is about to be stored somewhere declared to hold to
+void TypeChecker::coerce(ASTNode*& value, StaticType to, const std::string& what) {
+    if (!value || to == StaticType::Unknown || value->type == to) return;
+    if (value->type == StaticType::Int && to == StaticType::Double) {
+        // a literal is widened now, so the Optimizer propagates the double
+        if (auto num = as<NumberLiteral>(value)) {
+            value = arena.make<DoubleLiteral>(num->line, num->column, num->value);
+            return;
+        }
+    }
+    else if (value->type != StaticType::Unknown) {
+        fail(value, what + " is " + staticTypeName(to) + ", got " + staticTypeName(value->type));
+    }
+    value = arena.make<CoerceExpr>(value->line, value->column, value, to);
+}
+
+StaticType TypeChecker::typeOf(Symbol type, const ASTNode* at) const {
+    StaticType result = declaredType(type);
+    const std::string& name = symbolName(type);
+    if (result == StaticType::Unknown && name != "void")
+        fail(at, "arrays hold ints, so " + name + " is not a type; use int[] or string");
+    return result;
+}
+
+const TypeChecker::Local* TypeChecker::resolve(Symbol name) const {
+    for (auto it = locals.rbegin(); it != locals.rend(); ++it) {
+        if (it->name == name) return &*it;
+    }
+    return nullptr;
+}
+
+void TypeChecker::fail(const ASTNode* at, const std::string& message) const {
+    throw std::runtime_error("Type error: " + message + " at line " + std::to_string(at->line) + ":" + std::to_string(at->column));
+}
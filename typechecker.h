@@ -0,0 +1,69 @@
+// typechecker.h
+#pragma once
+#include "parser.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// A function's declared types, as its call sites see them.
+struct Signature {
+    std::vector<StaticType> params;
+    StaticType result = StaticType::Unknown;
+    // false once the name has two definitions with different types, so a call
+    // can't know which one it reaches
+    bool stable = true;
+};
+
+using Signatures = std::unordered_map<Symbol, Signature>;
+
+// the type a declaration names: Unknown for `void` and for names that aren't types
+StaticType declaredType(Symbol type);
+
+// Adds func to signatures, as one more definition of its name.
+void declareSignature(Signatures& signatures, const FunctionDecl& func);
+
+// Runs over each top-level item after parsing and before the Optimizer. It
+// verifies declared types, throwing at the first error with its line and
+// column, and sets every expression's type to what it is known to hold.
+//
+// Locals and parameters always hold their declared type: where a value meets
+// one it isn't known to have, the checker wraps it in a CoerceExpr, which
+// widens an int to double or checks the value when it runs. Globals can be
+// assigned anything by any function, so they stay Unknown. A call is checked
+// against the callee's signature only when that is stable; other calls have
+// their arguments checked by the callee when it is entered (CallChecked).
+class TypeChecker {
+public:
+    // functions: every function of the program, to check calls against;
+    // coercions are allocated in arena
+    TypeChecker(Arena& arena, const Signatures& functions) : arena(arena), functions(functions) {}
+
+    void check(ASTNode* node);
+
+private:
+    struct Local {
+        Symbol name;
+        StaticType type;
+        int depth;
+    };
+
+    Arena& arena;
+    const Signatures& functions;
+    std::vector<Local> locals;
+    int scopeDepth = 0;  // 0 is global scope, as in the Compiler
+    const FunctionDecl* function = nullptr;
+    StaticType result = StaticType::Unknown;
+
+    void checkFunction(FunctionDecl* func);
+    void statement(ASTNode* node);
+    void block(const NodeList& body);
+    void expression(ASTNode* node);
+    void call(CallExpr* call);
+    void assign(AssignStmt* assign);
+    void indexAssign(IndexAssignStmt* assign);
+    void coerce(ASTNode*& value, StaticType to, const std::string& what);
+    StaticType typeOf(Symbol type, const ASTNode* at) const;
+    const Local* resolve(Symbol name) const;
+    void endScope();
+    [[noreturn]] void fail(const ASTNode* at, const std::string& message) const;
+};
@@ -0,0 +1,133 @@
+// value.cpp
+#include "value.h"
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+// lengths live in 32 bits, beside the form
+void checkLength(size_t size) {
+    if (size > UINT32_MAX) throw std::runtime_error("String too long");
+}
+
+}
+
+void Value::retainCounted() const {
+    if (type == ValueType::Array) payload.array->refs++;
+    else if (form == sharedForm) payload.string->refs++;
+}
+
+void Value::releaseCounted() {
+    if (type == ValueType::Array) {
+        if (--payload.array->refs == 0) delete payload.array;
+    }
+    else if (form == sharedForm) {
+        if (--payload.string->refs == 0) delete payload.string;
+    }
+}
+
+Value Value::shared(StringObject* object, size_t size) {
+    Value v;
+    v.type = ValueType::String;
+    v.form = sharedForm;
+    v.length = static_cast<uint32_t>(size);
+    v.payload.string = object;
+    return v;
+}
+
+Value Value::string(std::string_view text) {
+    checkLength(text.size());
+    if (text.size() > shortCapacity) return shared(new StringObject(std::string(text)), text.size());
+    Value v;
+    v.type = ValueType::String;
+    v.form = static_cast<uint8_t>(text.size());
+    std::memcpy(v.shortText(), text.data(), text.size());
+    return v;
+}
+
+Value Value::literal(std::string_view text) {
+    if (text.size() <= shortCapacity) return string(text);
+    checkLength(text.size());
+    Value v;
+    v.type = ValueType::String;
+    v.form = literalForm;
+    v.length = static_cast<uint32_t>(text.size());
+    v.payload.literal = text.data();
+    return v;
+}
+
+Value Value::concat(const Value& l, const Value& r) {
+    if (!l.isString() && !r.isString()) {
+        throw std::runtime_error(std::string("Cannot add ") + valueTypeName(l.kind()) + " and " + valueTypeName(r.kind()));
+    }
+    std::string formatted; // the side that isn't a string, as text
+    std::string_view left, right;
+    if (l.isString()) left = l.text();
+    else {
+        appendText(formatted, l);
+        left = formatted;
+    }
+    if (r.isString()) right = r.text();
+    else {
+        appendText(formatted, r);
+        right = formatted;
+    }
+    size_t size = left.size() + right.size();
+    checkLength(size);
+
+    // l holds the whole buffer, so nothing else can see what follows it
+    if (l.isString() && l.form == sharedForm && l.length == l.payload.string->text.size()) {
+        StringObject* object = l.payload.string;
+        if (r.isString() && r.form == sharedForm && r.payload.string == object) {
+            std::string copy(right); // appending may move the bytes right views
+            object->append(copy);
+        }
+        else {
+            object->append(right);
+        }
+        object->refs++;
+        return shared(object, size);
+    }
+    if (size <= shortCapacity) {
+        Value v;
+        v.type = ValueType::String;
+        v.form = static_cast<uint8_t>(size);
+        std::memcpy(v.shortText(), left.data(), left.size());
+        std::memcpy(v.shortText() + left.size(), right.data(), right.size());
+        return v;
+    }
+    std::string text;
+    text.reserve(size);
+    text.append(left).append(right);
+    return shared(new StringObject(std::move(text)), size);
+}
+
+void appendText(std::string& out, const Value& v) {
+    switch (v.kind()) {
+    case ValueType::Int:
+    case ValueType::Double: {
+        char buffer[32];
+        auto result = v.isInt() ? std::to_chars(buffer, buffer + sizeof(buffer), v.asInt())
+                                : std::to_chars(buffer, buffer + sizeof(buffer), v.asDouble());
+        out.append(buffer, result.ptr);
+        break;
+    }
+    case ValueType::Bool:
+        out += v.asBool() ? "true" : "false";
+        break;
+    case ValueType::String:
+        out += v.text();
+        break;
+    case ValueType::Array: {
+        out += '[';
+        const auto& items = v.items();
+        for (size_t i = 0; i < items.size(); ++i) {
+            if (i) out += ", ";
+            char buffer[16];
+            out.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), items[i]).ptr);
+        }
+        out += ']';
+        break;
+    }
+    }
+}
@@ -0,0 +1,289 @@
+// value.h
+#pragma once
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "stats.h"
+
+// bytes of array elements alive on this thread, for ExecutionLimits::maxMemory
+inline thread_local size_t liveArrayBytes = 0;
+// and of string buffers, counted by capacity
+inline thread_local size_t liveStringBytes = 0;
+
+// Element storage shared by every Value that holds the same array.
+// Writers go through Value::mutableItems, which copies it first if shared.
+struct ArrayObject {
+    uint32_t refs = 1;
+    std::vector<int> items;
+
+    explicit ArrayObject(std::vector<int> elements) : items(std::move(elements)) {
+        liveArrayBytes += items.size() * sizeof(int);
+        if constexpr (statsEnabled) ThreadStats::add(threadStats().arrays, 1);
+    }
+    ~ArrayObject() { liveArrayBytes -= items.size() * sizeof(int); } // elements are replaced, never added
+};
+
+// Characters shared by every string Value cut from the same buffer, each of
+// which views a prefix of text. Bytes inside a prefix never change, so a
+// concatenation whose left side views all of text can append to it in place
+// (Value::concat), and a string built up in a loop costs amortized O(1) per
+// append rather than a copy of everything so far.
+struct StringObject {
+    uint32_t refs = 1;
+    std::string text;
+
+    explicit StringObject(std::string initial) : text(std::move(initial)) {
+        liveStringBytes += text.capacity();
+        if constexpr (statsEnabled) ThreadStats::add(threadStats().strings, 1);
+    }
+    ~StringObject() { liveStringBytes -= text.capacity(); }
+
+    void append(std::string_view more) {
+        size_t before = text.capacity();
+        text.append(more.data(), more.size()); // more may view text itself; append copies it first when it grows
+        liveStringBytes += text.capacity() - before;
+    }
+};
+
+// Int must stay 0 so bothInts can test two tags at once. String and every
+// type after it may hold a reference, which retain and release test with
+// one compare.
+enum class ValueType : uint8_t { Int, Double, Bool, String, Array };
+
+// What registers, globals and arguments hold: a tag and an 8-byte payload.
+// Numbers and bools live inline; arrays are reference counted, so copying a
+// Value never copies the elements. A string is one of three forms: up to
+// shortCapacity bytes inline; a literal, viewing text interned for the life
+// of the process; or a prefix of a reference-counted StringObject.
+class Value {
+public:
+    static constexpr size_t shortCapacity = 14;
+
+    Value() : type(ValueType::Int) { payload.i = 0; }
+    Value(int v) : type(ValueType::Int) { payload.i = v; }
+    Value(double v) : type(ValueType::Double) { payload.d = v; }
+    explicit Value(bool v) : type(ValueType::Bool) { payload.b = v; }
+    Value(const Value& other) { copyFrom(other); retain(); }
+    Value(Value&& other) noexcept {
+        copyFrom(other);
+        other.type = ValueType::Int;
+    }
+    ~Value() { release(); }
+
+    Value& operator=(const Value& other) {
+        if (bothInts(*this, other)) {
+            payload = other.payload;
+            return *this;
+        }
+        other.retain(); // first, in case other is this
+        release();
+        copyFrom(other);
+        return *this;
+    }
+
+    Value& operator=(Value&& other) noexcept {
+        if (this != &other) {
+            release();
+            copyFrom(other);
+            other.type = ValueType::Int;
+        }
+        return *this;
+    }
+
+    static Value array(std::vector<int> items) {
+        Value v;
+        v.type = ValueType::Array;
+        v.payload.array = new ArrayObject(std::move(items));
+        return v;
+    }
+
+    // a copy of text: inline when it fits, else in a new StringObject
+    static Value string(std::string_view text);
+    // Views text without copying or counting it, so text has to outlive
+    // every copy of the Value, as interned literals do. Short text is still
+    // copied inline, which is cheaper to read.
+    static Value literal(std::string_view text);
+    // l + r, where either side is a string and the other is written as
+    // print() would write it
+    static Value concat(const Value& l, const Value& r);
+
+    // one test for the common case of two inline ints
+    static bool bothInts(const Value& l, const Value& r) {
+        return (static_cast<unsigned>(l.type) | static_cast<unsigned>(r.type)) == 0;
+    }
+
+    static bool bothDoubles(const Value& l, const Value& r) {
+        return l.type == ValueType::Double && r.type == ValueType::Double;
+    }
+
+    ValueType kind() const { return type; }
+    bool isInt() const { return type == ValueType::Int; }
+    bool isDouble() const { return type == ValueType::Double; }
+    bool isNumber() const { return type == ValueType::Int || type == ValueType::Double; }
+    bool isBool() const { return type == ValueType::Bool; }
+    bool isString() const { return type == ValueType::String; }
+    bool isArray() const { return type == ValueType::Array; }
+
+    bool truthy() const {
+        if (type == ValueType::Bool) return payload.b; // what comparisons produce
+        if (type == ValueType::Int) return payload.i != 0;
+        if (type == ValueType::Double) return payload.d != 0;
+        return true;
+    }
+
+    int asInt() const { return payload.i; }
+    double asDouble() const { return payload.d; }
+    bool asBool() const { return payload.b; }
+    // ints widen; only valid when isNumber()
+    double toDouble() const { return type == ValueType::Int ? payload.i : payload.d; }
+    const std::vector<int>& items() const { return payload.array->items; }
+    // only valid when isString(), and until this Value changes
+    std::string_view text() const {
+        if (form == sharedForm) return { payload.string->text.data(), length };
+        if (form == literalForm) return { payload.literal, length };
+        return { shortText(), form };
+    }
+
+    // copy-on-write: detaches this Value from any other holder of the array
+    std::vector<int>& mutableItems() {
+        if (payload.array->refs > 1) {
+            payload.array->refs--;
+            payload.array = new ArrayObject(payload.array->items);
+        }
+        return payload.array->items;
+    }
+
+    void setInt(int v) {
+        release();
+        type = ValueType::Int;
+        payload.i = v;
+    }
+
+    void setDouble(double v) {
+        release();
+        type = ValueType::Double;
+        payload.d = v;
+    }
+
+    void setBool(bool v) {
+        release();
+        type = ValueType::Bool;
+        payload.b = v;
+    }
+
+    // drops an array or string reference early, e.g. when a frame is popped
+    void clear() { setInt(0); }
+
+    // where generated code finds the tag and the payload
+    static constexpr size_t tagOffset() { return offsetof(Value, type); }
+    static constexpr size_t payloadOffset() { return offsetof(Value, payload); }
+
+private:
+    // a string's form, kept in the byte after the tag; below these two it is
+    // the length of a short string
+    static constexpr uint8_t literalForm = 0xFE;
+    static constexpr uint8_t sharedForm = 0xFF;
+
+    // All 16 bytes are fields, with no padding, so copying them copies a
+    // short string too: its bytes start at shortHead and run on over length
+    // and payload. Only strings read form and what follows it, so the
+    // numeric constructors leave them unset.
+    ValueType type;
+    uint8_t form;
+    char shortHead[2];
+    uint32_t length; // of a literal or shared string
+    union Payload {
+        int i;
+        double d;
+        bool b;
+        ArrayObject* array;
+        StringObject* string;
+        const char* literal;
+    } payload;
+
+    char* shortText() { return reinterpret_cast<char*>(this) + offsetof(Value, shortHead); }
+    const char* shortText() const { return reinterpret_cast<const char*>(this) + offsetof(Value, shortHead); }
+
+    static Value shared(StringObject* object, size_t size);
+
+    // two 8-byte moves, whatever the type
+    void copyFrom(const Value& other) { std::memcpy(static_cast<void*>(this), &other, sizeof(Value)); }
+
+    void retain() const {
+        if (type >= ValueType::String) [[unlikely]] retainCounted();
+    }
+
+    void release() {
+        if (type >= ValueType::String) [[unlikely]] releaseCounted();
+    }
+
+    // out of line, so the many inlined setters stay small
+    void retainCounted() const;
+    void releaseCounted();
+};
+
+static_assert(sizeof(Value) == 16, "a Value is a tag, a string form and length, and a payload");
+
+// Appends v's text as print() writes it.
+void appendText(std::string& out, const Value& v);
+
+// What the TypeChecker knows a value holds before the program runs. Unknown
+// is anything it can't see, such as globals, which any function may assign.
+enum class StaticType : uint8_t { Unknown, Int, Double, Bool, Array, String };
+
+inline const char* staticTypeName(StaticType type) {
+    switch (type) {
+    case StaticType::Unknown: return "a value of unknown type";
+    case StaticType::Int: return "int";
+    case StaticType::Double: return "double";
+    case StaticType::Bool: return "bool";
+    case StaticType::Array: return "int[]";
+    case StaticType::String: return "string";
+    }
+    return "?";
+}
+
+inline const char* valueTypeName(ValueType type) {
+    switch (type) {
+    case ValueType::Int: return "int";
+    case ValueType::Double: return "double";
+    case ValueType::Bool: return "bool";
+    case ValueType::String: return "string";
+    case ValueType::Array: return "int[]";
+    }
+    return "?";
+}
+
+inline std::ostream& operator<<(std::ostream& out, const Value& v) {
+    switch (v.kind()) {
+    case ValueType::Int:
+        return out << v.asInt();
+    case ValueType::Double: {
+        // shortest text that reads back as the same double
+        char buffer[32];
+        auto result = std::to_chars(buffer, buffer + sizeof(buffer), v.asDouble());
+        return out.write(buffer, result.ptr - buffer);
+    }
+    case ValueType::Bool:
+        return out << (v.asBool() ? "true" : "false");
+    case ValueType::String: {
+        std::string_view text = v.text();
+        return out.write(text.data(), static_cast<std::streamsize>(text.size()));
+    }
+    case ValueType::Array:
+        break;
+    }
+    out << '[';
+    const auto& items = v.items();
+    for (size_t i = 0; i < items.size(); ++i) {
+        if (i) out << ", ";
+        out << items[i];
+    }
+    return out << ']';
+}